@@ -26,6 +26,7 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <liblttctl/lttctl.h>
 #include <errno.h>
 #include <stdio.h>
@@ -34,9 +35,17 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/mount.h>
 
 #define MAX_CHANNEL	(256)
 
+#define PROC_LTT	"/proc/ltt"
+
 static char debugfsmntdir[PATH_MAX];
 
 static int initdebugfsmntdir(void)
@@ -190,6 +199,14 @@ static int lttctl_check_trace(const char *name, int expect)
 	return 0;
 }
 
+static void lttctl_free_channellist(char **channellist, int n_channel)
+{
+	int i = 0;
+	for(; i < n_channel; ++i)
+		free(channellist[i]);
+	free(channellist);
+}
+
 /*
  * get channel list of a trace
  * don't include metadata channel when metadata is 0
@@ -204,9 +221,9 @@ static int lttctl_get_channellist(const char *tracename,
 	char tracedirname[PATH_MAX];
 	struct dirent *dirent;
 	DIR *dir;
-	char **list = NULL, **old_list;
-	int nr_chan = 0;
-	
+	char **list = NULL, **new_list;
+	int nr_chan = 0, max_chan = 0;
+
 	sprintf(tracedirname, "%s/ltt/control/%s/channel", debugfsmntdir,
 		tracename);
 
@@ -225,11 +242,27 @@ static int lttctl_get_channellist(const char *tracename,
 			continue;
 		if (!metadata && !strcmp(dirent->d_name, "metadata"))
 			continue;
-		old_list = list;
-		list = malloc(sizeof(char *) * ++nr_chan);
-		memcpy(list, old_list, sizeof(*list) * (nr_chan - 1));
-		free(old_list);
-		list[nr_chan - 1] = strdup(dirent->d_name);
+		if (nr_chan == max_chan) {
+			max_chan = max_chan ? max_chan * 2 : 16;
+			new_list = realloc(list, sizeof(char *) * max_chan);
+			if (!new_list) {
+				closedir(dir);
+				lttctl_free_channellist(list, nr_chan);
+				list = NULL;
+				nr_chan = -ENOMEM;
+				goto error;
+			}
+			list = new_list;
+		}
+		list[nr_chan] = strdup(dirent->d_name);
+		if (!list[nr_chan]) {
+			closedir(dir);
+			lttctl_free_channellist(list, nr_chan);
+			list = NULL;
+			nr_chan = -ENOMEM;
+			goto error;
+		}
+		nr_chan++;
 	}	
 
 	closedir(dir);
@@ -242,14 +275,6 @@ error:
 	return nr_chan;
 }
 
-static void lttctl_free_channellist(char **channellist, int n_channel)
-{
-	int i = 0;
-	for(; i < n_channel; ++i)
-		free(channellist[i]);
-	free(channellist);
-}
-
 int lttctl_setup_trace(const char *name)
 {
 	int ret;
@@ -763,13 +788,1018 @@ arg_error:
 	return ret;
 }
 
+/*
+ * A channel directory of the trace, kept open for the whole batch.
+ */
+struct lttctl_chandir {
+	char *name;
+	int dirfd;
+};
+
+static int lttctl_chandir_cmp(const void *a, const void *b)
+{
+	const struct lttctl_chandir *ca = a, *cb = b;
+
+	return strcmp(ca->name, cb->name);
+}
+
+static void lttctl_free_chandirs(struct lttctl_chandir *chandirs, int n_chan)
+{
+	int i;
+
+	for (i = 0; i < n_chan; i++) {
+		if (chandirs[i].dirfd >= 0)
+			close(chandirs[i].dirfd);
+		free(chandirs[i].name);
+	}
+	free(chandirs);
+}
+
+/*
+ * Read the channel directory of a trace once, sorted by name so channels can be
+ * looked up with bsearch.
+ *
+ * return number of channel on success
+ * return negative number on fail
+ * Caller must free chandirs with lttctl_free_chandirs().
+ */
+static int lttctl_get_chandirs(int chandirfd, struct lttctl_chandir **chandirs)
+{
+	struct lttctl_chandir *list = NULL, *new_list;
+	struct dirent *dirent;
+	DIR *dir;
+	int fd;
+	int nr_chan = 0, max_chan = 0;
+
+	/* closedir() closes the fd it is given, keep ours open */
+	fd = dup(chandirfd);
+	if (fd < 0)
+		return -errno;
+
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -errno;
+	}
+
+	while ((dirent = readdir(dir))) {
+		if (!strcmp(dirent->d_name, ".")
+				|| !strcmp(dirent->d_name, ".."))
+			continue;
+		if (nr_chan == max_chan) {
+			max_chan = max_chan ? max_chan * 2 : 16;
+			new_list = realloc(list, sizeof(*list) * max_chan);
+			if (!new_list) {
+				closedir(dir);
+				lttctl_free_chandirs(list, nr_chan);
+				return -ENOMEM;
+			}
+			list = new_list;
+		}
+		list[nr_chan].name = strdup(dirent->d_name);
+		if (!list[nr_chan].name) {
+			closedir(dir);
+			lttctl_free_chandirs(list, nr_chan);
+			return -ENOMEM;
+		}
+		list[nr_chan].dirfd = -1;
+		nr_chan++;
+	}
+	closedir(dir);
+
+	qsort(list, nr_chan, sizeof(*list), lttctl_chandir_cmp);
+
+	*chandirs = list;
+	return nr_chan;
+}
+
+static int lttctl_sendop_at(int dirfd, const char *dirname, const char *fname,
+		const char *op)
+{
+	int fd;
+	int ret = 0;
+
+	fd = openat(dirfd, fname, O_WRONLY);
+	if (fd == -1) {
+		ret = errno;
+		fprintf(stderr, "%s: open %s/%s failed: %s\n", __func__,
+			dirname, fname, strerror(ret));
+		return ret;
+	}
+
+	if (write(fd, op, strlen(op)) == -1) {
+		ret = errno;
+		fprintf(stderr, "%s: write %s to %s/%s failed: %s\n", __func__,
+			op, dirname, fname, strerror(ret));
+	}
+
+	close(fd);
+
+	return ret;
+}
+
+static int lttctl_apply_channel_attr(int chandirfd, struct lttctl_chandir *chan,
+		struct lttctl_channel_attr *attr)
+{
+	const char *fname;
+	char opstr[32];
+
+	if (chan->dirfd < 0) {
+		chan->dirfd = openat(chandirfd, chan->name,
+				     O_RDONLY | O_DIRECTORY);
+		if (chan->dirfd < 0) {
+			fprintf(stderr, "%s: open channel %s failed: %s\n",
+				__func__, chan->name, strerror(errno));
+			return errno;
+		}
+	}
+
+	switch (attr->type) {
+	case LTTCTL_CHANNEL_ENABLE:
+		fname = "enable";
+		strcpy(opstr, attr->value ? "1" : "0");
+		break;
+	case LTTCTL_CHANNEL_OVERWRITE:
+		fname = "overwrite";
+		strcpy(opstr, attr->value ? "1" : "0");
+		break;
+	case LTTCTL_CHANNEL_SUBBUF_NUM:
+		fname = "subbuf_num";
+		sprintf(opstr, "%u", attr->value);
+		break;
+	case LTTCTL_CHANNEL_SUBBUF_SIZE:
+		fname = "subbuf_size";
+		sprintf(opstr, "%u", attr->value);
+		break;
+	case LTTCTL_CHANNEL_SWITCH_TIMER:
+		fname = "switch_timer";
+		sprintf(opstr, "%u", attr->value);
+		break;
+	default:
+		return EINVAL;
+	}
+
+	return lttctl_sendop_at(chan->dirfd, chan->name, fname, opstr);
+}
+
+/*
+ * Set a batch of channel attributes of a trace.
+ *
+ * The trace and channel directories are looked up once and kept open for the
+ * whole batch. Every item is tried, even after a failure, and gets its own
+ * result.
+ *
+ * ret:
+ *   0: every item succeeded
+ *   !0: error of the first failed item, or of the lookup of the trace
+ */
+int lttctl_set_channel_attrs(const char *name,
+		struct lttctl_channel_attr *attrs, int nr_attrs)
+{
+	char tracedirname[PATH_MAX];
+	struct lttctl_chandir *chandirs = NULL, *chan, key;
+	int chandirfd;
+	int n_channel;
+	int i, j;
+	int ret = 0;
+
+	if (!name || (nr_attrs && !attrs)) {
+		fprintf(stderr, "%s: args invalid\n", __func__);
+		return -EINVAL;
+	}
+
+	if (!debugfsmntdir[0]) {
+		fprintf(stderr, "%s: debugfsmntdir not valid\n", __func__);
+		return -EINVAL;
+	}
+
+	sprintf(tracedirname, "%s/ltt/control/%s/channel", debugfsmntdir,
+		name);
+
+	chandirfd = open(tracedirname, O_RDONLY | O_DIRECTORY);
+	if (chandirfd < 0) {
+		if (errno == ENOENT) {
+			fprintf(stderr, "Trace %s not exist\n", name);
+			return -ENOENT;
+		}
+		fprintf(stderr, "%s: %s\n", __func__, strerror(errno));
+		return -EINVAL;
+	}
+
+	n_channel = lttctl_get_chandirs(chandirfd, &chandirs);
+	if (n_channel < 0) {
+		fprintf(stderr, "%s: lttctl_get_chandirs failed\n", __func__);
+		ret = n_channel;
+		goto close_chandir;
+	}
+
+	for (i = 0; i < nr_attrs; i++) {
+		struct lttctl_channel_attr *attr = &attrs[i];
+
+		attr->result = 0;
+		if (!attr->channel) {
+			attr->result = -EINVAL;
+		} else if (strcmp(attr->channel, "all")) {
+			key.name = (char *)attr->channel;
+			chan = bsearch(&key, chandirs, n_channel,
+				       sizeof(*chandirs), lttctl_chandir_cmp);
+			if (chan) {
+				attr->result = lttctl_apply_channel_attr(
+					chandirfd, chan, attr);
+			} else {
+				fprintf(stderr, "Channel %s not exist\n",
+					attr->channel);
+				attr->result = -ENOENT;
+			}
+		} else {
+			for (j = 0; j < n_channel; j++) {
+				int err;
+
+				/*
+				 * Don't allow set enable state and overwrite
+				 * for metadata channel
+				 */
+				if ((attr->type == LTTCTL_CHANNEL_ENABLE
+				     || attr->type == LTTCTL_CHANNEL_OVERWRITE)
+				    && !strcmp(chandirs[j].name, "metadata"))
+					continue;
+				err = lttctl_apply_channel_attr(chandirfd,
+					&chandirs[j], attr);
+				if (err && !attr->result)
+					attr->result = err;
+			}
+		}
+		if (attr->result && !ret)
+			ret = attr->result;
+	}
+
+	lttctl_free_chandirs(chandirs, n_channel);
+close_chandir:
+	close(chandirfd);
+	return ret;
+}
+
+/*
+ * A marker enable file to write, found by lttctl_get_markers().
+ * chandirfd belongs to the channel table of the batch.
+ */
+struct lttctl_marker {
+	int chandirfd;
+	char *name;
+	enum lttctl_markers_class class;
+};
+
+/*
+ * Markers of one class written by the threads of a batch. Each thread takes
+ * the next marker with an atomic increment of next.
+ */
+struct lttctl_markers_batch {
+	struct lttctl_marker *markers;
+	int nr_markers;
+	int next;
+	int enable;
+	int nr_failed;
+	int ret;
+};
+
+static enum lttctl_markers_class lttctl_marker_class(const char *channel,
+		const char *marker)
+{
+	size_t len;
+
+	if (!strcmp(channel, "lockdep") || !strcmp(channel, "locking")
+	    || !strcmp(marker, "lockdep") || !strcmp(marker, "locking"))
+		return LTTCTL_MARKERS_LOCKING;
+	if (!strcmp(channel, "input") || !strcmp(marker, "input"))
+		return LTTCTL_MARKERS_INPUT;
+	len = strlen(marker);
+	if (!strcmp(channel, "net") && len >= sizeof("_extended") - 1
+	    && !strcmp(marker + len - (sizeof("_extended") - 1), "_extended"))
+		return LTTCTL_MARKERS_NETWORK;
+	return LTTCTL_MARKERS_DEFAULT;
+}
+
+static int lttctl_marker_match(const struct lttctl_markers_filter *filter,
+		const char *channel, const char *marker)
+{
+	char name[NAME_MAX * 2 + 2];
+	int i;
+
+	if (!filter->nr_include && !filter->nr_exclude)
+		return 1;
+
+	snprintf(name, sizeof(name), "%s/%s", channel, marker);
+	for (i = 0; i < filter->nr_exclude; i++)
+		if (!fnmatch(filter->exclude[i], name, 0))
+			return 0;
+	if (!filter->nr_include)
+		return 1;
+	for (i = 0; i < filter->nr_include; i++)
+		if (!fnmatch(filter->include[i], name, 0))
+			return 1;
+	return 0;
+}
+
+static DIR *lttctl_opendirat(int dirfd, const char *name, int *fd)
+{
+	DIR *dir = NULL;
+	int dirfd_dup, err;
+
+	*fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY);
+	if (*fd < 0)
+		return NULL;
+	/* closedir() closes the fd it is given, keep ours open */
+	dirfd_dup = dup(*fd);
+	if (dirfd_dup >= 0)
+		dir = fdopendir(dirfd_dup);
+	if (!dir) {
+		/* The caller reports errno */
+		err = errno;
+		if (dirfd_dup >= 0)
+			close(dirfd_dup);
+		close(*fd);
+		*fd = -1;
+		errno = err;
+	}
+	return dir;
+}
+
+/*
+ * Walk debugfs ltt/markers once, keeping one dirfd per channel, and collect
+ * the markers which pass the filter. The metadata channel is left out.
+ *
+ * return number of marker on success, *chandirfds holds nr_chandirfds fds
+ * return negative number on fail
+ * Caller must free markers, their names, and close the channel fds.
+ */
+static int lttctl_get_markers(const struct lttctl_markers_filter *filter,
+		struct lttctl_marker **markers, int **chandirfds,
+		int *nr_chandirfds)
+{
+	char markersdirname[PATH_MAX];
+	struct lttctl_marker *list = NULL, *new_list;
+	int *fds = NULL, *new_fds;
+	struct dirent *chan, *marker;
+	enum lttctl_markers_class class;
+	DIR *rootdir, *chandir;
+	int rootfd, chanfd;
+	int nr_markers = 0, max_markers = 0, nr_fds = 0;
+	int ret = 0;
+
+	sprintf(markersdirname, "%s/ltt/markers", debugfsmntdir);
+	rootdir = lttctl_opendirat(AT_FDCWD, markersdirname, &rootfd);
+	if (!rootdir) {
+		fprintf(stderr, "%s: open %s failed: %s\n", __func__,
+			markersdirname, strerror(errno));
+		return -errno;
+	}
+
+	while ((chan = readdir(rootdir))) {
+		if (chan->d_name[0] == '.' || !strcmp(chan->d_name, "metadata"))
+			continue;
+		chandir = lttctl_opendirat(rootfd, chan->d_name, &chanfd);
+		if (!chandir)
+			continue;
+
+		new_fds = realloc(fds, sizeof(*fds) * (nr_fds + 1));
+		if (!new_fds) {
+			closedir(chandir);
+			close(chanfd);
+			ret = -ENOMEM;
+			goto error;
+		}
+		fds = new_fds;
+		fds[nr_fds++] = chanfd;
+
+		while ((marker = readdir(chandir))) {
+			if (marker->d_name[0] == '.')
+				continue;
+			class = lttctl_marker_class(chan->d_name,
+						    marker->d_name);
+			if (!(filter->classes & LTTCTL_MARKERS_CLASS(class)))
+				continue;
+			if (!lttctl_marker_match(filter, chan->d_name,
+						 marker->d_name))
+				continue;
+			if (nr_markers == max_markers) {
+				max_markers = max_markers ? max_markers * 2
+					: 256;
+				new_list = realloc(list,
+						   sizeof(*list) * max_markers);
+				if (!new_list) {
+					closedir(chandir);
+					ret = -ENOMEM;
+					goto error;
+				}
+				list = new_list;
+			}
+			list[nr_markers].chandirfd = chanfd;
+			list[nr_markers].name = strdup(marker->d_name);
+			if (!list[nr_markers].name) {
+				closedir(chandir);
+				ret = -ENOMEM;
+				goto error;
+			}
+			list[nr_markers].class = class;
+			nr_markers++;
+		}
+		closedir(chandir);
+	}
+
+	closedir(rootdir);
+	close(rootfd);
+	*markers = list;
+	*chandirfds = fds;
+	*nr_chandirfds = nr_fds;
+	return nr_markers;
+
+error:
+	closedir(rootdir);
+	close(rootfd);
+	while (nr_markers)
+		free(list[--nr_markers].name);
+	free(list);
+	while (nr_fds)
+		close(fds[--nr_fds]);
+	free(fds);
+	return ret;
+}
+
+static int lttctl_write_marker(struct lttctl_marker *marker, int enable)
+{
+	char fname[NAME_MAX + sizeof("/enable")];
+	char state;
+	int fd;
+	int ret = 0;
+
+	snprintf(fname, sizeof(fname), "%s/enable", marker->name);
+	fd = openat(marker->chandirfd, fname, enable ? O_WRONLY : O_RDWR);
+	if (fd == -1) {
+		ret = errno;
+		fprintf(stderr, "%s: open %s failed: %s\n", __func__, fname,
+			strerror(ret));
+		return ret;
+	}
+
+	/* As ltt-disarmall, only disconnect markers which are connected */
+	if (!enable && pread(fd, &state, 1, 0) == 1 && state != '1')
+		goto end;
+
+	if (write(fd, enable ? "1" : "0", 1) == -1) {
+		ret = errno;
+		fprintf(stderr, "%s: write %d to %s failed: %s\n", __func__,
+			enable, fname, strerror(ret));
+	}
+end:
+	close(fd);
+	return ret;
+}
+
+static void *lttctl_markers_thread(void *arg)
+{
+	struct lttctl_markers_batch *batch = arg;
+	int i;
+	int ret;
+
+	for (;;) {
+		i = __sync_fetch_and_add(&batch->next, 1);
+		if (i >= batch->nr_markers)
+			break;
+		ret = lttctl_write_marker(&batch->markers[i], batch->enable);
+		if (ret) {
+			__sync_fetch_and_add(&batch->nr_failed, 1);
+			__sync_bool_compare_and_swap(&batch->ret, 0, ret);
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned long long lttctl_elapsed_ns(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000000000ULL
+		+ end.tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Connect (enable != 0) or disconnect the markers selected by filter, as
+ * ltt-armall and ltt-disarmall do, without a process per marker.
+ *
+ * The markers tree is walked once. The markers are then written one class
+ * after the other, by nr_threads threads in parallel, so the time taken by each
+ * class can be reported in stats (which can be NULL).
+ *
+ * ret:
+ *   0: every marker was written
+ *   !0: error of a failed marker, or of the walk
+ */
+int lttctl_set_markers(int enable, const struct lttctl_markers_filter *filter,
+		unsigned int nr_threads, struct lttctl_markers_stats *stats)
+{
+	struct lttctl_markers_stats local_stats;
+	struct lttctl_markers_batch batch;
+	struct lttctl_marker *markers, *sorted;
+	struct timespec start;
+	pthread_t *tids;
+	int *chandirfds;
+	int nr_chandirfds;
+	int nr_markers;
+	int class;
+	int i, j;
+	int ret = 0;
+
+	if (!filter) {
+		fprintf(stderr, "%s: args invalid\n", __func__);
+		return -EINVAL;
+	}
+
+	if (!debugfsmntdir[0]) {
+		fprintf(stderr, "%s: debugfsmntdir not valid\n", __func__);
+		return -EINVAL;
+	}
+
+	if (!stats)
+		stats = &local_stats;
+	memset(stats, 0, sizeof(*stats));
+	if (!nr_threads)
+		nr_threads = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	nr_markers = lttctl_get_markers(filter, &markers, &chandirfds,
+					&nr_chandirfds);
+	if (nr_markers < 0)
+		return nr_markers;
+	stats->walk_time = lttctl_elapsed_ns(&start);
+
+	/* Group the markers by class */
+	sorted = malloc(sizeof(*sorted) * (nr_markers ? nr_markers : 1));
+	tids = malloc(sizeof(*tids) * nr_threads);
+	if (!sorted || !tids) {
+		ret = -ENOMEM;
+		goto free_markers;
+	}
+	for (class = 0, j = 0; class < LTTCTL_MARKERS_NR_CLASSES; class++)
+		for (i = 0; i < nr_markers; i++)
+			if (markers[i].class == class)
+				sorted[j++] = markers[i];
+
+	batch.enable = enable;
+	batch.markers = sorted;
+	for (class = 0; class < LTTCTL_MARKERS_NR_CLASSES; class++) {
+		batch.nr_markers = 0;
+		for (i = 0; i < nr_markers; i++)
+			if (markers[i].class == class)
+				batch.nr_markers++;
+		if (!batch.nr_markers)
+			continue;
+		batch.next = 0;
+		batch.nr_failed = 0;
+		batch.ret = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < nr_threads && i < batch.nr_markers; i++)
+			if (pthread_create(&tids[i], NULL,
+					   lttctl_markers_thread, &batch))
+				break;
+		/* Without any thread, write them from this one */
+		if (!i)
+			lttctl_markers_thread(&batch);
+		while (i)
+			pthread_join(tids[--i], NULL);
+		stats->time[class] = lttctl_elapsed_ns(&start);
+		stats->nr_markers[class] = batch.nr_markers;
+		stats->nr_failed[class] = batch.nr_failed;
+		if (batch.ret && !ret)
+			ret = batch.ret;
+
+		batch.markers += batch.nr_markers;
+	}
+
+free_markers:
+	free(tids);
+	free(sorted);
+	for (i = 0; i < nr_markers; i++)
+		free(markers[i].name);
+	free(markers);
+	for (i = 0; i < nr_chandirfds; i++)
+		close(chandirfds[i]);
+	free(chandirfds);
+	return ret;
+}
+
+static int lttctl_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int lttctl_name_in(const char *name, char * const *names, int nr_names)
+{
+	return bsearch(&name, names, nr_names, sizeof(char *),
+		       lttctl_strcmp) != NULL;
+}
+
+static void lttctl_free_names(char **names, int nr_names)
+{
+	while (nr_names)
+		free(names[--nr_names]);
+	free(names);
+}
+
+/*
+ * Read PROC_LTT at once.
+ *
+ * return the length read on success, *buf must be freed by the caller
+ * return negative number on fail
+ */
+static ssize_t lttctl_read_proc_ltt(char **buf)
+{
+	char *data = NULL, *new_data;
+	size_t size = 0, len = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(PROC_LTT, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "%s: open %s failed: %s\n", __func__, PROC_LTT,
+			strerror(errno));
+		return -errno;
+	}
+
+	for (;;) {
+		if (len + 1 >= size) {
+			size = size ? size * 2 : 65536;
+			new_data = realloc(data, size);
+			if (!new_data) {
+				ret = -ENOMEM;
+				goto error;
+			}
+			data = new_data;
+		}
+		ret = read(fd, data + len, size - len - 1);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1) {
+			ret = -errno;
+			fprintf(stderr, "%s: read %s failed: %s\n", __func__,
+				PROC_LTT, strerror(errno));
+			goto error;
+		}
+		if (!ret)
+			break;
+		len += ret;
+	}
+	close(fd);
+	data[len] = 0;
+	*buf = data;
+	return len;
+
+error:
+	close(fd);
+	free(data);
+	return ret;
+}
+
+/*
+ * Markers which must not stop function tracing, as in ltt-armtap: core markers
+ * are already connected, locking markers are high traffic, ftrace_entry and
+ * the tap markers belong to function tracing itself.
+ */
+static int lttctl_tap_excluded(const char *marker)
+{
+	return !strncmp(marker, "core_", sizeof("core_") - 1)
+		|| !strncmp(marker, "locking_", sizeof("locking_") - 1)
+		|| !strncmp(marker, "lockdep", sizeof("lockdep") - 1)
+		|| !strncmp(marker, "tap_", sizeof("tap_") - 1)
+		|| strstr(marker, "ftrace_entry");
+}
+
+/*
+ * Compute the tap sets, reading PROC_LTT once: start holds the given markers,
+ * stop every other normal rate marker listed in PROC_LTT. Both sets are
+ * sorted.
+ *
+ * ret: 0 on success
+ *      negative number on fail
+ * lttctl_tap_free() must be called on success.
+ */
+int lttctl_tap_init(struct lttctl_tap *tap, const char **start, int nr_start)
+{
+	char *buf = NULL, *line, *next, *marker, *saveptr;
+	char **stop = NULL, **new_stop;
+	int nr_stop = 0, max_stop = 0;
+	int i, j;
+	ssize_t ret;
+
+	if (!tap || (nr_start && !start)) {
+		fprintf(stderr, "%s: args invalid\n", __func__);
+		return -EINVAL;
+	}
+
+	tap->start = malloc(sizeof(char *) * (nr_start ? nr_start : 1));
+	if (!tap->start)
+		return -ENOMEM;
+	for (i = 0; i < nr_start; i++) {
+		tap->start[i] = strdup(start[i]);
+		if (!tap->start[i]) {
+			tap->nr_start = i;
+			ret = -ENOMEM;
+			goto free_start;
+		}
+	}
+	qsort(tap->start, nr_start, sizeof(char *), lttctl_strcmp);
+	tap->nr_start = nr_start;
+
+	ret = lttctl_read_proc_ltt(&buf);
+	if (ret < 0)
+		goto free_start;
+
+	/* Lines are "<channel> <marker> <format>" */
+	for (line = buf; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+		if (strstr(line, "%k"))
+			continue;
+		if (!strtok_r(line, " \t", &saveptr))
+			continue;
+		marker = strtok_r(NULL, " \t", &saveptr);
+		if (!marker || lttctl_tap_excluded(marker)
+		    || lttctl_name_in(marker, tap->start, tap->nr_start))
+			continue;
+		if (nr_stop == max_stop) {
+			max_stop = max_stop ? max_stop * 2 : 256;
+			new_stop = realloc(stop, sizeof(char *) * max_stop);
+			if (!new_stop) {
+				ret = -ENOMEM;
+				goto free_stop;
+			}
+			stop = new_stop;
+		}
+		stop[nr_stop] = strdup(marker);
+		if (!stop[nr_stop]) {
+			ret = -ENOMEM;
+			goto free_stop;
+		}
+		nr_stop++;
+	}
+	free(buf);
+	buf = NULL;
+
+	/* Unique, as with sort -u */
+	qsort(stop, nr_stop, sizeof(char *), lttctl_strcmp);
+	for (i = 0, j = 0; i < nr_stop; i++) {
+		if (j && !strcmp(stop[i], stop[j - 1]))
+			free(stop[i]);
+		else
+			stop[j++] = stop[i];
+	}
+
+	tap->stop = stop;
+	tap->nr_stop = j;
+	return 0;
+
+free_stop:
+	free(buf);
+	lttctl_free_names(stop, nr_stop);
+free_start:
+	lttctl_free_names(tap->start, tap->nr_start);
+	tap->start = NULL;
+	tap->nr_start = 0;
+	return ret;
+}
+
+void lttctl_tap_free(struct lttctl_tap *tap)
+{
+	lttctl_free_names(tap->start, tap->nr_start);
+	lttctl_free_names(tap->stop, tap->nr_stop);
+	memset(tap, 0, sizeof(*tap));
+}
+
+/*
+ * Commands sent to PROC_LTT, written with writev(): procfs hands each iovec to
+ * the write handler separately, so a batch of commands costs one system call.
+ * It stops at the first command which fails and returns what was written
+ * before it.
+ */
+struct lttctl_proc_cmds {
+	struct iovec *iov;
+	int nr_iov;
+	int max_iov;
+};
+
+static int lttctl_proc_cmd_add(struct lttctl_proc_cmds *cmds, int connect,
+		const char *marker, const char *probe)
+{
+	struct iovec *new_iov;
+	char *cmd;
+
+	if (cmds->nr_iov == cmds->max_iov) {
+		cmds->max_iov = cmds->max_iov ? cmds->max_iov * 2 : 256;
+		new_iov = realloc(cmds->iov, sizeof(*new_iov) * cmds->max_iov);
+		if (!new_iov)
+			return -ENOMEM;
+		cmds->iov = new_iov;
+	}
+	if (asprintf(&cmd, "%s %s %s\n", connect ? "connect" : "disconnect",
+		     marker, probe) < 0)
+		return -ENOMEM;
+	cmds->iov[cmds->nr_iov].iov_base = cmd;
+	cmds->iov[cmds->nr_iov].iov_len = strlen(cmd);
+	cmds->nr_iov++;
+	return 0;
+}
+
+/*
+ * Write the command iov alone, from byte done, to know why it failed.
+ *
+ * ret: 0 on success
+ *      errno on fail
+ */
+static int lttctl_proc_cmd_write(int fd, const struct iovec *iov, size_t done)
+{
+	ssize_t ret;
+
+	while (done < iov->iov_len) {
+		ret = write(fd, (char *)iov->iov_base + done,
+			    iov->iov_len - done);
+		if (ret <= 0)
+			return ret ? errno : EIO;
+		done += ret;
+	}
+	return 0;
+}
+
+/*
+ * Send the commands, as ltt-armtap did with one echo each : a command which
+ * fails is reported, and the next ones are sent.
+ *
+ * ret: 0 on success
+ *      errno of the first command which failed
+ */
+static int lttctl_proc_cmds_send(struct lttctl_proc_cmds *cmds)
+{
+	ssize_t written, len;
+	int fd;
+	int i, j, n;
+	int err;
+	int ret = 0;
+
+	if (!cmds->nr_iov)
+		return 0;
+
+	fd = open(PROC_LTT, O_WRONLY);
+	if (fd == -1) {
+		ret = errno;
+		fprintf(stderr, "%s: open %s failed: %s\n", __func__, PROC_LTT,
+			strerror(ret));
+		return ret;
+	}
+
+	for (i = 0; i < cmds->nr_iov; i += n) {
+		n = cmds->nr_iov - i;
+		if (n > IOV_MAX)
+			n = IOV_MAX;
+		written = writev(fd, &cmds->iov[i], n);
+		if (written == -1) {
+			/* The first command failed */
+			err = errno;
+			n = 0;
+		} else {
+			for (len = 0, j = 0; j < n; j++)
+				len += cmds->iov[i + j].iov_len;
+			if (written == len)
+				continue;
+			/* n commands were written, the next one failed */
+			for (n = 0; written >= (ssize_t)cmds->iov[i + n].iov_len;
+			     n++)
+				written -= cmds->iov[i + n].iov_len;
+			err = lttctl_proc_cmd_write(fd, &cmds->iov[i + n],
+						    written);
+		}
+		if (err) {
+			fprintf(stderr, "%s: \"%.*s\" to %s failed: %s\n",
+				__func__, (int)cmds->iov[i + n].iov_len - 1,
+				(char *)cmds->iov[i + n].iov_base, PROC_LTT,
+				strerror(err));
+			if (!ret)
+				ret = err;
+		}
+		/* Go on after it */
+		n++;
+	}
+
+	close(fd);
+	return ret;
+}
+
+static void lttctl_proc_cmds_free(struct lttctl_proc_cmds *cmds)
+{
+	while (cmds->nr_iov)
+		free(cmds->iov[--cmds->nr_iov].iov_base);
+	free(cmds->iov);
+}
+
+/*
+ * Connect (connect != 0) the tap as ltt-armtap does, or disconnect it as
+ * ltt-disarmtap does, with one writev() per IOV_MAX commands.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+int lttctl_tap_connect(const struct lttctl_tap *tap, int connect)
+{
+	struct lttctl_proc_cmds cmds = { NULL, 0, 0 };
+	int i;
+	int ret = 0;
+
+	if (!tap) {
+		fprintf(stderr, "%s: args invalid\n", __func__);
+		return -EINVAL;
+	}
+
+	/* Stop markers are connected first and disconnected last */
+	for (i = 0; connect && !ret && i < tap->nr_stop; i++)
+		ret = lttctl_proc_cmd_add(&cmds, 1, tap->stop[i],
+					  "ftrace_system_stop");
+	for (i = 0; !ret && i < tap->nr_start; i++)
+		ret = lttctl_proc_cmd_add(&cmds, connect, tap->start[i],
+					  "ftrace_system_start");
+	for (i = 0; !connect && !ret && i < tap->nr_stop; i++)
+		ret = lttctl_proc_cmd_add(&cmds, 0, tap->stop[i],
+					  "ftrace_system_stop");
+	if (!ret)
+		ret = lttctl_proc_cmds_send(&cmds);
+
+	lttctl_proc_cmds_free(&cmds);
+	return ret;
+}
+
+/*
+ * Move from tap "from" to tap "to", which must be connected. Only the markers
+ * which change role are disconnected and connected again.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+int lttctl_tap_switch(const struct lttctl_tap *from,
+		const struct lttctl_tap *to)
+{
+	struct lttctl_proc_cmds cmds = { NULL, 0, 0 };
+	int i;
+	int ret = 0;
+
+	if (!from || !to) {
+		fprintf(stderr, "%s: args invalid\n", __func__);
+		return -EINVAL;
+	}
+
+	/* Disconnect first, so a marker is never connected to both probes */
+	for (i = 0; !ret && i < from->nr_start; i++)
+		if (!lttctl_name_in(from->start[i], to->start, to->nr_start))
+			ret = lttctl_proc_cmd_add(&cmds, 0, from->start[i],
+						  "ftrace_system_start");
+	for (i = 0; !ret && i < from->nr_stop; i++)
+		if (!lttctl_name_in(from->stop[i], to->stop, to->nr_stop))
+			ret = lttctl_proc_cmd_add(&cmds, 0, from->stop[i],
+						  "ftrace_system_stop");
+	for (i = 0; !ret && i < to->nr_stop; i++)
+		if (!lttctl_name_in(to->stop[i], from->stop, from->nr_stop))
+			ret = lttctl_proc_cmd_add(&cmds, 1, to->stop[i],
+						  "ftrace_system_stop");
+	for (i = 0; !ret && i < to->nr_start; i++)
+		if (!lttctl_name_in(to->start[i], from->start, from->nr_start))
+			ret = lttctl_proc_cmd_add(&cmds, 1, to->start[i],
+						  "ftrace_system_start");
+	if (!ret)
+		ret = lttctl_proc_cmds_send(&cmds);
+
+	lttctl_proc_cmds_free(&cmds);
+	return ret;
+}
+
+/*
+ * Get the debugfs mount point, LTT_DEBUGFS in the environment overrides it,
+ * ex. to use a stand-in of the control files.
+ */
 int getdebugfsmntdir(char *mntdir)
 {
 	char mnt_dir[PATH_MAX];
 	char mnt_type[PATH_MAX];
 	int trymount_done = 0;
+	const char *env_dir = getenv("LTT_DEBUGFS");
+	FILE *fp;
+
+	if (env_dir && *env_dir) {
+		if (strlen(env_dir) >= PATH_MAX)
+			return -ENAMETOOLONG;
+		strcpy(mntdir, env_dir);
+		return 0;
+	}
 
-	FILE *fp = fopen("/proc/mounts", "r");
+	fp = fopen("/proc/mounts", "r");
 	if (!fp)
 		return -EINVAL;
 
@@ -780,6 +1810,7 @@ find_again:
 
 		if (!strcmp(mnt_type, "debugfs")) {
 			strcpy(mntdir, mnt_dir);
+			fclose(fp);
 			return 0;
 		}
 	}
@@ -787,8 +1818,10 @@ find_again:
 	if (!trymount_done) {
 		mount("debugfs", "/sys/kernel/debug/", "debugfs", 0, NULL);
 		trymount_done = 1;
+		rewind(fp);
 		goto find_again;
 	}
 
+	fclose(fp);
 	return -ENOENT;
 }
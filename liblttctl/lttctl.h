@@ -25,6 +25,80 @@
 #ifndef _LTTCTL_H
 #define _LTTCTL_H
 
+/*
+ * Channel attributes which can be set in a batch by lttctl_set_channel_attrs().
+ */
+enum lttctl_channel_attr_type {
+	LTTCTL_CHANNEL_ENABLE,
+	LTTCTL_CHANNEL_OVERWRITE,
+	LTTCTL_CHANNEL_SUBBUF_NUM,
+	LTTCTL_CHANNEL_SUBBUF_SIZE,
+	LTTCTL_CHANNEL_SWITCH_TIMER,
+};
+
+/*
+ * One item of a channel configuration batch.
+ * channel can be set to "all" for all channels (the metadata channel is left
+ * out for enable and overwrite, as with the lttctl_set_channel_*() functions).
+ * result is set to 0 on success, or to the error of this item.
+ */
+struct lttctl_channel_attr {
+	const char *channel;
+	enum lttctl_channel_attr_type type;
+	unsigned int value;
+	int result;
+};
+
+/*
+ * Classes of markers, the ones but default are left disconnected by
+ * ltt-armall unless asked.
+ */
+enum lttctl_markers_class {
+	LTTCTL_MARKERS_DEFAULT,
+	LTTCTL_MARKERS_LOCKING,		/* lockdep and locking, high traffic */
+	LTTCTL_MARKERS_NETWORK,		/* net *_extended markers, large size */
+	LTTCTL_MARKERS_INPUT,		/* input, records keyboard inputs */
+	LTTCTL_MARKERS_NR_CLASSES,
+};
+
+#define LTTCTL_MARKERS_CLASS(class)	(1U << (class))
+
+/*
+ * Markers to connect or disconnect with lttctl_set_markers().
+ * classes is a mask of LTTCTL_MARKERS_CLASS() bits. include and exclude are
+ * fnmatch(3) patterns matched against "<channel>/<marker>"; every marker of the
+ * classes is included when nr_include is 0.
+ */
+struct lttctl_markers_filter {
+	unsigned int classes;
+	const char **include;
+	int nr_include;
+	const char **exclude;
+	int nr_exclude;
+};
+
+/*
+ * Result of lttctl_set_markers(), per class. Times are in nanoseconds.
+ */
+struct lttctl_markers_stats {
+	unsigned int nr_markers[LTTCTL_MARKERS_NR_CLASSES];
+	unsigned int nr_failed[LTTCTL_MARKERS_NR_CLASSES];
+	unsigned long long time[LTTCTL_MARKERS_NR_CLASSES];
+	unsigned long long walk_time;
+};
+
+/*
+ * Function tracing tap, as set by ltt-armtap: the start markers turn system
+ * wide function tracing on, the stop markers (every other normal rate marker)
+ * turn it off.
+ */
+struct lttctl_tap {
+	char **start;
+	int nr_start;
+	char **stop;
+	int nr_stop;
+};
+
 int lttctl_init(void);
 int lttctl_destroy(void);
 int lttctl_setup_trace(const char *name);
@@ -43,6 +117,15 @@ int lttctl_set_channel_subbuf_size(const char *name, const char *channel,
 		unsigned subbuf_size);
 int lttctl_set_channel_switch_timer(const char *name, const char *channel,
 		unsigned switch_timer);
+int lttctl_set_channel_attrs(const char *name,
+		struct lttctl_channel_attr *attrs, int nr_attrs);
+int lttctl_set_markers(int enable, const struct lttctl_markers_filter *filter,
+		unsigned int nr_threads, struct lttctl_markers_stats *stats);
+int lttctl_tap_init(struct lttctl_tap *tap, const char **start, int nr_start);
+void lttctl_tap_free(struct lttctl_tap *tap);
+int lttctl_tap_connect(const struct lttctl_tap *tap, int connect);
+int lttctl_tap_switch(const struct lttctl_tap *from,
+		const struct lttctl_tap *to);
 
 /* Helper functions */
 int getdebugfsmntdir(char *mntdir);
@@ -0,0 +1,53 @@
+#ifndef _LIBLTTD_PROBES_H
+#define _LIBLTTD_PROBES_H
+
+/*
+ * liblttd-probes.h
+ *
+ * Linux Trace Toolkit library - Static probes
+ *
+ * USDT probes on the hot paths of liblttd and liblttdvfs, for perf probe,
+ * bpftrace or SystemTap. They are built from <sys/sdt.h> when configure finds
+ * it and --disable-sdt is not given, and compile to nothing otherwise. An
+ * unused probe costs a nop in the code and a note in the ELF file.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef ENABLE_SDT
+#include <sys/sdt.h>
+
+#define LTTD_PROBE1(provider, name, a1) \
+	DTRACE_PROBE1(provider, name, a1)
+#define LTTD_PROBE2(provider, name, a1, a2) \
+	DTRACE_PROBE2(provider, name, a1, a2)
+#define LTTD_PROBE3(provider, name, a1, a2, a3) \
+	DTRACE_PROBE3(provider, name, a1, a2, a3)
+#define LTTD_PROBE4(provider, name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(provider, name, a1, a2, a3, a4)
+#else
+#define LTTD_PROBE1(provider, name, a1) \
+	do { } while (0)
+#define LTTD_PROBE2(provider, name, a1, a2) \
+	do { } while (0)
+#define LTTD_PROBE3(provider, name, a1, a2, a3) \
+	do { } while (0)
+#define LTTD_PROBE4(provider, name, a1, a2, a3, a4) \
+	do { } while (0)
+#endif
+
+#endif /*_LIBLTTD_PROBES_H */
@@ -5,7 +5,7 @@
  * This is a simple daemon that reads a few relay+debugfs channels and save
  * them in a trace.
  *
- * CPU hot-plugging is supported using inotify.
+ * CPU hot-plugging and hot-unplugging are supported using inotify.
  *
  * Copyright 2005 -
  * 	Mathieu Desnoyers <mathieu.desnoyers@polymtl.ca>
@@ -32,16 +32,20 @@
 #include <config.h>
 #endif
 
-#include "liblttd.h"
-
+/* Before any header, which would include the system headers without it */
 #define _REENTRANT
 #define _GNU_SOURCE
+#include "liblttd.h"
+#include "liblttd-probes.h"
+#include "liblttdlog.h"
+
 #include <features.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <dirent.h>
 #include <string.h>
 #include <fcntl.h>
@@ -49,7 +53,9 @@
 #include <sys/poll.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
+#include <sched.h>
 #include <asm/ioctls.h>
 
 #include <linux/version.h>
@@ -92,205 +98,774 @@ static inline int inotify_rm_watch (int fd, __u32 wd)
 #undef HAS_INOTIFY
 #endif
 
+/* Room for at least 16 events */
+#define INOTIFY_BUF_LEN	(16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
 struct liblttd_thread_data {
 	int thread_num;
 	struct liblttd_instance *instance;
 };
 
+/*
+ * The sub-buffer of a channel given to callbacks_v2. It is in the callback,
+ * then pending once the callback has returned without completing it. Only the
+ * pending channels are left out of the poll sets, so that the callbacks which
+ * complete inline cost no wake up.
+ */
+enum completion_state {
+	COMPLETION_IDLE,
+	COMPLETION_CALLBACK,
+	COMPLETION_PENDING,
+};
+
+struct liblttd_completion {
+	struct liblttd_instance *instance;
+	struct fd_pair *pair;		/* follows the pair when fd_pairs moves */
+	unsigned int consumed;
+	unsigned int len;
+	volatile int state;
+};
+
 #define printf_verbose(fmt, args...) \
   do {                               \
     if (instance->verbose_mode)      \
       printf(fmt, ##args);           \
   } while (0)
 
+/* Counters of the reader thread running, NULL in the other threads */
+static __thread struct liblttd_thread_stats *current_stats;
+
+/*
+ * Set while a reader thread holds fd_pairs_lock, which it does when the
+ * callback completes the sub-buffer itself.
+ */
+static __thread int fd_pairs_held;
+
+static inline void account_syscalls(enum liblttd_phase phase, unsigned int n)
+{
+	if (current_stats)
+		current_stats->syscalls[phase] += n;
+}
+
+/*
+ * Add the CPU time of the calling thread to the instance, at its end. The time
+ * is also returned in cpu_time if it is not NULL, never as 0.
+ */
+static void account_thread_cpu(struct liblttd_instance *instance,
+	unsigned long long *cpu_time)
+{
+	struct timespec ts;
+	unsigned long long ns = 0;
+
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	__sync_fetch_and_add(&instance->stats.cpu_time, ns);
+	if (cpu_time)
+		*cpu_time = ns ? ns : 1;
+}
+
+/* The hot paths log binary records instead, see liblttdlog.h */
+#define log_event(event, channel, arg0, arg1)			\
+  do {								\
+    if (instance->log)						\
+      liblttd_log_event(event, channel, arg0, arg1);		\
+  } while (0)
+
+
+/*
+ * Interned paths
+ *
+ * The paths of the channels and folders, relative to the root folder of the
+ * trace channels, are stored once, sized to fit, and shared by the pairs and
+ * the watches. The channel of a CPU unplugged and plugged again gets back its
+ * path. They are freed with the instance.
+ */
+struct liblttd_path {
+	struct liblttd_path *next;
+	unsigned int hash;
+	int opened;		/* a channel of this path was opened */
+	char str[];
+};
+
+static unsigned int path_hash(const char *str)
+{
+	unsigned int hash = 2166136261U;	/* FNV-1a */
+
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619U;
+	return hash;
+}
+
+static int grow_paths(struct liblttd_path_store *store)
+{
+	struct liblttd_path **buckets, *path, *next;
+	unsigned int size = store->size ? 2 * store->size : 64;
+	unsigned int i;
+
+	buckets = calloc(size, sizeof(struct liblttd_path *));
+	if (!buckets)
+		return -1;
+	for (i = 0; i < store->size; i++) {
+		for (path = store->buckets[i]; path; path = next) {
+			next = path->next;
+			path->next = buckets[path->hash & (size - 1)];
+			buckets[path->hash & (size - 1)] = path;
+		}
+	}
+	free(store->buckets);
+	store->buckets = buckets;
+	store->size = size;
+	return 0;
+}
 
-int open_buffer_file(struct liblttd_instance *instance, char *filename,
-	char *path_channel, char *base_path_channel)
+/* returns the interned copy of str, which must not be changed or freed */
+static char *intern_path(struct liblttd_path_store *store, const char *str)
 {
+	unsigned int hash = path_hash(str);
+	struct liblttd_path *path;
+	size_t len;
+
+	if (store->size) {
+		for (path = store->buckets[hash & (store->size - 1)]; path;
+		     path = path->next)
+			if (path->hash == hash && !strcmp(path->str, str))
+				return path->str;
+	}
+	if (store->num >= store->size && grow_paths(store))
+		return NULL;
+
+	len = strlen(str);
+	path = malloc(sizeof(struct liblttd_path) + len + 1);
+	if (!path)
+		return NULL;
+	path->hash = hash;
+	path->opened = 0;
+	memcpy(path->str, str, len + 1);
+	path->next = store->buckets[hash & (store->size - 1)];
+	store->buckets[hash & (store->size - 1)] = path;
+	store->num++;
+	return path->str;
+}
+
+/* The entry of an interned path */
+static struct liblttd_path *path_entry(const char *str)
+{
+	return (struct liblttd_path *)(str - offsetof(struct liblttd_path, str));
+}
+
+/* Intern the path of the entry name of the folder dir */
+static char *intern_child(struct liblttd_path_store *store, const char *dir,
+	const char *name)
+{
+	char *str, *path;
+
+	if (asprintf(&str, "%s/%s", dir, name) < 0)
+		return NULL;
+	path = intern_path(store, str);
+	free(str);
+	return path;
+}
+
+static void free_paths(struct liblttd_path_store *store)
+{
+	struct liblttd_path *path, *next;
+	unsigned int i;
+
+	for (i = 0; i < store->size; i++) {
+		for (path = store->buckets[i]; path; path = next) {
+			next = path->next;
+			free(path);
+		}
+	}
+	free(store->buckets);
+	store->buckets = NULL;
+	store->size = store->num = 0;
+}
+
+/*
+ * Inotify watches, indexed by watch descriptor.
+ */
+static struct inotify_watch *find_watch(struct liblttd_instance *instance,
+	int wd)
+{
+	struct inotify_watch_table *table = &instance->inotify_watches;
+	struct inotify_watch *watch;
+
+	if (!table->size)
+		return NULL;
+	for (watch = table->buckets[wd & (table->size - 1)]; watch;
+	     watch = watch->next)
+		if (watch->wd == wd)
+			return watch;
+	return NULL;
+}
+
+static int add_watch(struct liblttd_instance *instance, int wd, char *path)
+{
+	struct inotify_watch_table *table = &instance->inotify_watches;
+	struct inotify_watch **buckets, *watch, *next;
+	unsigned int size, i;
+
+	/* A folder watched again keeps its descriptor */
+	watch = find_watch(instance, wd);
+	if (watch) {
+		watch->path = path;
+		return 0;
+	}
+
+	if (table->num >= table->size) {
+		size = table->size ? 2 * table->size : 16;
+		buckets = calloc(size, sizeof(struct inotify_watch *));
+		if (!buckets)
+			return -1;
+		for (i = 0; i < table->size; i++) {
+			for (watch = table->buckets[i]; watch; watch = next) {
+				next = watch->next;
+				watch->next = buckets[watch->wd & (size - 1)];
+				buckets[watch->wd & (size - 1)] = watch;
+			}
+		}
+		free(table->buckets);
+		table->buckets = buckets;
+		table->size = size;
+	}
+
+	watch = malloc(sizeof(struct inotify_watch));
+	if (!watch)
+		return -1;
+	watch->wd = wd;
+	watch->path = path;
+	watch->next = table->buckets[wd & (table->size - 1)];
+	table->buckets[wd & (table->size - 1)] = watch;
+	table->num++;
+	return 0;
+}
+
+static void remove_watch(struct liblttd_instance *instance, int wd)
+{
+	struct inotify_watch_table *table = &instance->inotify_watches;
+	struct inotify_watch **prev, *watch;
+
+	if (!table->size)
+		return;
+	for (prev = &table->buckets[wd & (table->size - 1)]; (watch = *prev);
+	     prev = &watch->next) {
+		if (watch->wd == wd) {
+			*prev = watch->next;
+			free(watch);
+			table->num--;
+			return;
+		}
+	}
+}
+
+static void free_watches(struct liblttd_instance *instance)
+{
+	struct inotify_watch_table *table = &instance->inotify_watches;
+	struct inotify_watch *watch, *next;
+	unsigned int i;
+
+	for (i = 0; i < table->size; i++) {
+		for (watch = table->buckets[i]; watch; watch = next) {
+			next = watch->next;
+			free(watch);
+		}
+	}
+	free(table->buckets);
+	table->buckets = NULL;
+	table->size = table->num = 0;
+}
+
+/* An array of fd_pairs which liblttd_get_channel_stats may still read */
+struct liblttd_retired_pairs {
+	struct fd_pair *pair;
+	struct liblttd_retired_pairs *next;
+};
+
+/*
+ * fd_pairs_seq is odd while fd_pairs changes. Only the thread which changes
+ * fd_pairs calls these.
+ */
+static inline void fd_pairs_write_begin(struct liblttd_instance *instance)
+{
+	instance->fd_pairs_seq++;
+	__sync_synchronize();
+}
+
+static inline void fd_pairs_write_end(struct liblttd_instance *instance)
+{
+	__sync_synchronize();
+	instance->fd_pairs_seq++;
+}
+
+/*
+ * Make room for n more pairs. The capacity doubles, so that channels added
+ * one by one do not realloc the array each time.
+ *
+ * The array of fd_pairs is not freed while the instance runs, as
+ * liblttd_get_channel_stats reads it without lock : it is copied to a larger
+ * one and kept until the instance is deleted. Its capacity never shrinks, and
+ * it is set after the array.
+ */
+static int reserve_pairs(struct liblttd_instance *instance,
+	struct channel_trace_fd *pairs, int n)
+{
+	struct liblttd_retired_pairs *retired = NULL;
+	struct fd_pair *pair;
+	int max_pairs = pairs->max_pairs ? pairs->max_pairs : 16;
+
+	if (pairs->num_pairs + n <= pairs->max_pairs)
+		return 0;
+	while (max_pairs < pairs->num_pairs + n)
+		max_pairs *= 2;
+	if (pairs != &instance->fd_pairs) {
+		pair = realloc(pairs->pair, max_pairs * sizeof(struct fd_pair));
+		if (!pair)
+			return -1;
+		pairs->pair = pair;
+		pairs->max_pairs = max_pairs;
+		return 0;
+	}
+
+	if (pairs->pair) {
+		retired = malloc(sizeof(*retired));
+		if (!retired)
+			return -1;
+	}
+	pair = malloc(max_pairs * sizeof(struct fd_pair));
+	if (!pair) {
+		free(retired);
+		return -1;
+	}
+	memcpy(pair, pairs->pair, pairs->num_pairs * sizeof(struct fd_pair));
+	if (retired) {
+		retired->pair = pairs->pair;
+		retired->next = instance->retired_pairs;
+		instance->retired_pairs = retired;
+	}
+	pairs->pair = pair;
+	__sync_synchronize();
+	pairs->max_pairs = max_pairs;
+	return 0;
+}
+
+/*
+ * Open a channel file and append it to pairs, the published fd_pairs of the
+ * instance or channels which are not published yet. path is interned.
+ *
+ * A channel created again while the deleted one of the same path is still read
+ * waits for it to be closed before on_open_channel is called, so that they do
+ * not write the same output at once.
+ */
+int open_buffer_file(struct liblttd_instance *instance,
+	struct channel_trace_fd *pairs, char *filename, char *path)
+{
+	struct fd_pair *pair;
 	int open_ret = 0;
 	int ret = 0;
-	int fd;
+	int fd, i;
 
 	if (strncmp(filename, "flight-", sizeof("flight-")-1) != 0) {
 		if (instance->dump_flight_only) {
-			printf_verbose("Skipping normal channel %s\n",
-				path_channel);
+			printf_verbose("Skipping normal channel %s\n", path);
 			return 0;
 		}
 	} else {
 		if (instance->dump_normal_only) {
-			printf_verbose("Skipping flight channel %s\n",
-				path_channel);
+			printf_verbose("Skipping flight channel %s\n", path);
 			return 0;
 		}
 	}
 	printf_verbose("Opening file.\n");
 
-	instance->fd_pairs.pair = realloc(instance->fd_pairs.pair,
-			++instance->fd_pairs.num_pairs * sizeof(struct fd_pair));
-
-	/* Open the channel in read mode */
-	fd = open(path_channel, O_RDONLY | O_NONBLOCK);
-	instance->fd_pairs.pair[instance->fd_pairs.num_pairs-1].channel = fd;
+	if (reserve_pairs(instance, pairs, 1))
+		return -1;
+	pair = &pairs->pair[pairs->num_pairs];
 
-	if (instance->fd_pairs.pair[instance->fd_pairs.num_pairs-1].channel == -1) {
-		perror(path_channel);
-		instance->fd_pairs.num_pairs--;
+	/* Open the channel in read mode, path starts with a '/' */
+	fd = openat(instance->channel_dirfd, path + 1, O_RDONLY | O_NONBLOCK);
+	if (fd == -1) {
+		perror(path);
 		return 0;	/* continue */
 	}
+	pairs->num_pairs++;
+	pair->channel = fd;
+	pair->path = path;
+	pair->deleted = 0;
+	pair->completion = NULL;
+	pair->replaced = path_entry(path)->opened;
+	pair->waiting = 0;
+	memset(&pair->stats, 0, sizeof(struct liblttd_channel_stats));
+
+	/* fd_pairs only changes in the thread which opens channels */
+	for (i = 0; i < instance->fd_pairs.num_pairs; i++) {
+		if (instance->fd_pairs.pair[i].path == path
+		    && instance->fd_pairs.pair[i].deleted) {
+			printf_verbose("Channel %s waits for the deleted one\n",
+				path);
+			pair->waiting = 1;
+			goto end;
+		}
+	}
 
 	if (instance->callbacks->on_open_channel) ret = instance->callbacks->on_open_channel(
-			instance->callbacks, &instance->fd_pairs.pair[instance->fd_pairs.num_pairs-1],
-			base_path_channel);
+			instance->callbacks, pair, path);
 
 	if (ret != 0) {
 		open_ret = -1;
-		close(instance->fd_pairs.pair[instance->fd_pairs.num_pairs-1].channel);
-		instance->fd_pairs.num_pairs--;
+		close(pair->channel);
+		pairs->num_pairs--;
 		goto end;
 	}
+	path_entry(path)->opened = 1;
 
 end:
 	return open_ret;
 }
 
+/*
+ * Open the channels of a folder and of its subfolders, and watch them. path is
+ * interned, "" for the root folder of the trace channels.
+ */
 int open_channel_trace_pairs(struct liblttd_instance *instance,
-	char *subchannel_name, char *base_subchannel_name)
+	struct channel_trace_fd *pairs, char *path)
 {
-	DIR *channel_dir = opendir(subchannel_name);
+	DIR *channel_dir = NULL;
 	struct dirent *entry;
 	struct stat stat_buf;
-	int ret;
-	char path_channel[PATH_MAX];
-	int path_channel_len;
-	char *path_channel_ptr;
-	char *base_subchannel_ptr;
+	int ret = 0;
+	char *path_channel;
+	char *full_path;
+	int fd, wd;
 
 	int open_ret = 0;
 
+	fd = openat(instance->channel_dirfd, *path ? path + 1 : ".",
+		O_RDONLY | O_DIRECTORY);
+	if (fd != -1)
+		channel_dir = fdopendir(fd);
 	if (channel_dir == NULL) {
-		perror(subchannel_name);
+		perror(*path ? path : instance->channel_name);
+		if (fd != -1)
+			close(fd);
 		open_ret = ENOENT;
 		goto end;
 	}
 
 	printf_verbose("Calling : on new channels folder\n");
 	if (instance->callbacks->on_new_channels_folder) ret = instance->callbacks->
-			on_new_channels_folder(instance->callbacks,
-			base_subchannel_name);
+			on_new_channels_folder(instance->callbacks, path);
 	if (ret == -1) {
 		open_ret = -1;
 		goto end;
 	}
 
-	strncpy(path_channel, subchannel_name, PATH_MAX-1);
-	path_channel_len = strlen(path_channel);
-	path_channel[path_channel_len] = '/';
-	path_channel_len++;
-	path_channel_ptr = path_channel + path_channel_len;
-	base_subchannel_ptr = path_channel +
-		(base_subchannel_name - subchannel_name);
-
 #ifdef HAS_INOTIFY
-	instance->inotify_watch_array.elem = realloc(instance->inotify_watch_array.elem,
-		++instance->inotify_watch_array.num * sizeof(struct inotify_watch));
-
-	printf_verbose("Adding inotify for channel %s\n", path_channel);
-	instance->inotify_watch_array.elem[instance->inotify_watch_array.num-1].wd = inotify_add_watch(instance->inotify_fd, path_channel, IN_CREATE);
-	strcpy(instance->inotify_watch_array.elem[instance->inotify_watch_array.num-1].path_channel, path_channel);
-	instance->inotify_watch_array.elem[instance->inotify_watch_array.num-1].base_path_channel =
-		instance->inotify_watch_array.elem[instance->inotify_watch_array.num-1].path_channel +
-		(base_subchannel_name - subchannel_name);
-	printf_verbose("Added inotify for channel %s, wd %u\n",
-		instance->inotify_watch_array.elem[instance->inotify_watch_array.num-1].path_channel,
-		instance->inotify_watch_array.elem[instance->inotify_watch_array.num-1].wd);
+	/* inotify has no *at variant */
+	if (asprintf(&full_path, "%s%s", instance->channel_name, path) >= 0) {
+		printf_verbose("Adding inotify for channel %s\n", full_path);
+		wd = inotify_add_watch(instance->inotify_fd, full_path,
+			IN_CREATE | IN_DELETE | IN_DELETE_SELF);
+		if (wd < 0 || add_watch(instance, wd, path))
+			perror(full_path);
+		else
+			printf_verbose("Added inotify for channel %s, wd %u\n",
+				full_path, wd);
+		free(full_path);
+	}
 #endif
 
 	while((entry = readdir(channel_dir)) != NULL) {
 
 		if (entry->d_name[0] == '.') continue;
 
-		strncpy(path_channel_ptr, entry->d_name, PATH_MAX - path_channel_len);
-
-		ret = stat(path_channel, &stat_buf);
+		ret = fstatat(dirfd(channel_dir), entry->d_name, &stat_buf, 0);
 		if (ret == -1) {
-			perror(path_channel);
+			perror(entry->d_name);
 			continue;
 		}
 
+		path_channel = intern_child(&instance->paths, path,
+			entry->d_name);
+		if (!path_channel) {
+			open_ret = ENOMEM;
+			goto end;
+		}
 		printf_verbose("Channel file : %s\n", path_channel);
 
 		if (S_ISDIR(stat_buf.st_mode)) {
 
 			printf_verbose("Entering channel subdirectory...\n");
-			ret = open_channel_trace_pairs(instance, path_channel, base_subchannel_ptr);
+			ret = open_channel_trace_pairs(instance, pairs,
+				path_channel);
 			if (ret < 0) continue;
 		} else if (S_ISREG(stat_buf.st_mode)) {
-			open_ret = open_buffer_file(instance, entry->d_name,
-				path_channel, base_subchannel_ptr);
+			open_ret = open_buffer_file(instance, pairs,
+				entry->d_name, path_channel);
 			if (open_ret)
 				goto end;
 		}
 	}
 
 end:
-	closedir(channel_dir);
+	if (channel_dir)
+		closedir(channel_dir);
 
 	return open_ret;
 }
 
 
+/*
+ * Account the fill level of a sub-buffer read and the time since the previous
+ * one, to tune the sub-buffer size and the switch timer of the channel.
+ */
+static void account_subbuffer(struct fd_pair *pair, unsigned int len)
+{
+	struct liblttd_channel_stats *stats = &pair->stats;
+	unsigned long long now, ms;
+	struct timespec ts;
+	unsigned int i;
+
+	i = pair->max_sb_size ?
+		(unsigned long long)len * LIBLTTD_FILL_BUCKETS
+			/ pair->max_sb_size : 0;
+	if (i >= LIBLTTD_FILL_BUCKETS)
+		i = LIBLTTD_FILL_BUCKETS - 1;
+	stats->fill[i]++;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	if (stats->last_read) {
+		ms = (now - stats->last_read) / 1000000;
+		for (i = 0; ms && i < LIBLTTD_INTERVAL_BUCKETS - 1; i++)
+			ms >>= 1;
+		stats->interval[i]++;
+	}
+	stats->last_read = now;
+}
+
+static void wake_readers(struct liblttd_instance *instance)
+{
+	unsigned long i;
+
+	if (!instance->wake_pipes)
+		return;
+	for (i = 0; i < instance->num_threads; i++)
+		/* A full pipe already wakes the reader up */
+		if (write(instance->wake_pipes[2 * i + 1], "w", 1) == -1
+		    && errno != EAGAIN)
+			perror("Error waking reader thread");
+}
+
+/*
+ * Add n to a counter of the instance. The single reader is the only thread
+ * updating them, the other read loops and the completions are concurrent.
+ */
+static inline void add_instance_stat(struct liblttd_instance *instance,
+	unsigned long long *counter, unsigned long long n)
+{
+	if (instance->single_reader)
+		*counter += n;
+	else
+		__sync_fetch_and_add(counter, n);
+}
+
+/*
+ * Account the sub-buffer read from pair and release it. The caller is the only
+ * reader of pair at this time.
+ */
+static int put_subbuffer(struct liblttd_instance *instance, struct fd_pair *pair,
+	unsigned int consumed, unsigned int len, int error)
+{
+	int err;
+	int ret = 0;
+
+	if (error) {
+		pair->stats.failed++;
+		add_instance_stat(instance, &instance->stats.failed, 1);
+	} else {
+		pair->stats.subbufs++;
+		pair->stats.bytes += len;
+		account_subbuffer(pair, len);
+		add_instance_stat(instance, &instance->stats.subbufs, 1);
+		add_instance_stat(instance, &instance->stats.bytes, len);
+	}
+
+	err = ioctl(pair->channel, RELAY_PUT_SB, &consumed);
+	LTTD_PROBE3(liblttd, put_sb, pair->channel, consumed,
+		err ? errno : 0);
+	log_event(LIBLTTD_LOG_PUT_SB, pair->channel, consumed,
+		err ? errno : 0);
+	account_syscalls(LIBLTTD_PHASE_RELEASE, 1);
+	if (err != 0) {
+		ret = errno;
+		if (errno == EFAULT) {
+			perror("Error in unreserving sub buffer\n");
+		} else if (errno == EIO) {
+			/* Should never happen with newer LTTng versions */
+			perror("Reader has been pushed by the writer, last sub-buffer corrupted.");
+			pair->stats.lost++;
+			add_instance_stat(instance, &instance->stats.lost, 1);
+		}
+	}
+	return ret;
+}
+
+/*
+ * Give the sub-buffer to callbacks_v2, liblttd_complete releases it. The
+ * drains and dumps read a channel until it is empty, they wait for the
+ * completion.
+ */
+static int dispatch_subbuffer(struct liblttd_instance *instance,
+	struct fd_pair *pair, unsigned int consumed, unsigned int len)
+{
+	struct liblttd_completion *completion = pair->completion;
+	int ret;
+
+	completion->consumed = consumed;
+	completion->len = len;
+	completion->state = COMPLETION_CALLBACK;
+	pthread_mutex_lock(&instance->inflight_lock);
+	instance->inflight++;
+	pthread_mutex_unlock(&instance->inflight_lock);
+
+	LTTD_PROBE3(liblttd, callback_start, pair->channel, pair->path, len);
+	ret = instance->callbacks_v2->on_read_subbuffer(instance->callbacks,
+		pair, len, completion);
+	LTTD_PROBE3(liblttd, callback_end, pair->channel, len, ret);
+	if (ret != 0) {
+		/* The callback did not take it */
+		completion->state = COMPLETION_IDLE;
+		pthread_mutex_lock(&instance->inflight_lock);
+		instance->inflight--;
+		pthread_cond_broadcast(&instance->inflight_cond);
+		pthread_mutex_unlock(&instance->inflight_lock);
+		return put_subbuffer(instance, pair, consumed, len, ret);
+	}
+	if (current_stats)
+		current_stats->subbufs++;
+
+	/* Unless it is already completed, mask the channel until it is */
+	if (__sync_bool_compare_and_swap(&completion->state,
+			COMPLETION_CALLBACK, COMPLETION_PENDING))
+		__sync_fetch_and_add(&instance->inflight_gen, 1);
+
+	if (instance->drain_mode || instance->dump_mode) {
+		pthread_mutex_lock(&instance->inflight_lock);
+		while (completion->state != COMPLETION_IDLE)
+			pthread_cond_wait(&instance->inflight_cond,
+				&instance->inflight_lock);
+		pthread_mutex_unlock(&instance->inflight_lock);
+	}
+	return 0;
+}
+
 int read_subbuffer(struct liblttd_instance *instance, struct fd_pair *pair)
 {
 	unsigned int consumed_old, len;
 	int err;
 	long ret;
-	off_t offset;
+
+	/* The kernel lets a channel have a single sub-buffer reserved */
+	if (pair->completion && pair->completion->state != COMPLETION_IDLE)
+		return EAGAIN;
 
 	err = ioctl(pair->channel, RELAY_GET_SB, &consumed_old);
-	printf_verbose("cookie : %u\n", consumed_old);
+	LTTD_PROBE3(liblttd, get_sb, pair->channel, consumed_old, err);
+	account_syscalls(LIBLTTD_PHASE_RESERVE, 1);
 	if (err != 0) {
 		ret = errno;
-		perror("Reserving sub buffer failed (everything is normal, it is due to concurrency)");
-		goto get_error;
+		if (ret == EAGAIN)
+			log_event(LIBLTTD_LOG_GET_SB_AGAIN, pair->channel, 0, 0);
+		else
+			perror("Reserving sub buffer failed");
+		return ret;
 	}
+	log_event(LIBLTTD_LOG_GET_SB, pair->channel, consumed_old, 0);
 
 	err = ioctl(pair->channel, RELAY_GET_SB_SIZE, &len);
+	account_syscalls(LIBLTTD_PHASE_RESERVE, 1);
 	if (err != 0) {
 		ret = errno;
 		perror("Getting sub-buffer len failed.");
-		goto get_error;
+		/* Release it anyway, the channel would stay reserved */
+		return put_subbuffer(instance, pair, consumed_old, 0, ret);
 	}
 
+	if (pair->completion)
+		return dispatch_subbuffer(instance, pair, consumed_old, len);
+
+	ret = 0;
+	LTTD_PROBE3(liblttd, callback_start, pair->channel, pair->path, len);
 	if (instance->callbacks->on_read_subbuffer)
 		ret = instance->callbacks->on_read_subbuffer(
 			instance->callbacks, pair, len);
+	LTTD_PROBE3(liblttd, callback_end, pair->channel, len, ret);
+	if (ret == 0 && current_stats)
+		current_stats->subbufs++;
+	return put_subbuffer(instance, pair, consumed_old, len, ret);
+}
 
-write_error:
-	ret = 0;
-	err = ioctl(pair->channel, RELAY_PUT_SB, &consumed_old);
-	if (err != 0) {
-		ret = errno;
-		if (errno == EFAULT) {
-			perror("Error in unreserving sub buffer\n");
-		} else if (errno == EIO) {
-			/* Should never happen with newer LTTng versions */
-			perror("Reader has been pushed by the writer, last sub-buffer corrupted.");
-		}
-		goto get_error;
+void liblttd_complete(struct liblttd_completion *completion, int error)
+{
+	struct liblttd_instance *instance = completion->instance;
+	int state, relock;
+
+	/*
+	 * pair does not move while the lock is held. Taking it again from the
+	 * callback could deadlock behind a waiting writer.
+	 */
+	relock = !fd_pairs_held;
+	if (relock)
+		pthread_rwlock_rdlock(&instance->fd_pairs_lock);
+	put_subbuffer(instance, completion->pair, completion->consumed,
+		completion->len, error);
+	if (relock)
+		pthread_rwlock_unlock(&instance->fd_pairs_lock);
+
+	pthread_mutex_lock(&instance->inflight_lock);
+	__sync_synchronize();
+	state = __sync_lock_test_and_set(&completion->state, COMPLETION_IDLE);
+	instance->inflight--;
+	pthread_cond_broadcast(&instance->inflight_cond);
+	pthread_mutex_unlock(&instance->inflight_lock);
+
+	if (state == COMPLETION_PENDING) {
+		__sync_fetch_and_add(&instance->inflight_gen, 1);
+		wake_readers(instance);
 	}
+}
 
-get_error:
-	return ret;
+/*
+ * Wait for the sub-buffers given to callbacks_v2, before their channels are
+ * closed.
+ */
+static void wait_completions(struct liblttd_instance *instance)
+{
+	pthread_mutex_lock(&instance->inflight_lock);
+	while (instance->inflight)
+		pthread_cond_wait(&instance->inflight_cond,
+			&instance->inflight_lock);
+	pthread_mutex_unlock(&instance->inflight_lock);
 }
 
+/* The completions point to their pair, which moves when pairs changes */
+static void relink_completions(struct channel_trace_fd *pairs)
+{
+	int i;
+
+	for (i = 0; i < pairs->num_pairs; i++)
+		if (pairs->pair[i].completion)
+			pairs->pair[i].completion->pair = &pairs->pair[i];
+}
 
-int map_channels(struct liblttd_instance *instance, int idx_begin, int idx_end)
+int map_channels(struct liblttd_instance *instance,
+	struct channel_trace_fd *pairs, int idx_begin, int idx_end)
 {
 	int i,j;
 	int ret=0;
 
-	if (instance->fd_pairs.num_pairs <= 0) {
+	if (pairs->num_pairs <= 0) {
 		printf("No channel to read\n");
 		goto end;
 	}
@@ -298,7 +873,7 @@ int map_channels(struct liblttd_instance *instance, int idx_begin, int idx_end)
 	/* Get the subbuf sizes and number */
 
 	for(i=idx_begin;i<idx_end;i++) {
-		struct fd_pair *pair = &instance->fd_pairs.pair[i];
+		struct fd_pair *pair = &pairs->pair[i];
 
 		ret = ioctl(pair->channel, RELAY_GET_N_SB, &pair->n_sb);
 		if (ret != 0) {
@@ -316,6 +891,18 @@ int map_channels(struct liblttd_instance *instance, int idx_begin, int idx_end)
 			perror("Error in mutex init");
 			goto end;
 		}
+		if (instance->callbacks_v2
+		    && instance->callbacks_v2->on_read_subbuffer) {
+			pair->completion =
+				calloc(1, sizeof(struct liblttd_completion));
+			if (!pair->completion) {
+				ret = ENOMEM;
+				perror("Error allocating the completion");
+				goto end;
+			}
+			pair->completion->instance = instance;
+			pair->completion->pair = pair;
+		}
 	}
 
 end:
@@ -342,62 +929,494 @@ int unmap_channels(struct liblttd_instance *instance)
 	return ret;
 }
 
-#ifdef HAS_INOTIFY
-/* Inotify event arrived.
- *
- * Only support add file for now.
+/*
+ * Close the channels of pairs, which no thread reads anymore.
+ */
+static void close_pair_files(struct liblttd_instance *instance,
+	struct channel_trace_fd *pairs)
+{
+	int i;
+	int ret;
+
+	for(i=0;i<pairs->num_pairs;i++) {
+		ret = close(pairs->pair[i].channel);
+		if (ret == -1) perror("Close error on channel");
+		if (!pairs->pair[i].waiting
+		    && instance->callbacks->on_close_channel) {
+			ret = instance->callbacks->on_close_channel(
+				instance->callbacks, &pairs->pair[i]);
+			if (ret != 0) perror("Error on close channel callback");
+		}
+		free(pairs->pair[i].completion);
+	}
+}
+
+void close_pairs(struct liblttd_instance *instance,
+	struct channel_trace_fd *pairs)
+{
+	close_pair_files(instance, pairs);
+	free(pairs->pair);
+	pairs->pair = NULL;
+	pairs->num_pairs = 0;
+	pairs->max_pairs = 0;
+}
+
+#ifdef HAS_INOTIFY
+/*
+ * Channel discovery
+ *
+ * With several reader threads, a control thread reads the inotify events. New
+ * channels are opened and mapped before being published in fd_pairs, under
+ * the write lock, so the readers only see channels ready to be read. A channel
+ * whose file is deleted, like on CPU hot-unplug, is kept until it has hung
+ * up, so that its last sub-buffers are read, then it is closed and removed
+ * from fd_pairs. Each change of fd_pairs increments fd_pairs_gen and wakes
+ * every reader up through its wake pipe, to rebuild its poll set.
+ *
+ * The single reader of an instance does the same itself, without the lock.
+ * Either way, fd_pairs_seq is odd while fd_pairs changes, so that
+ * liblttd_get_channel_stats copies the channels without lock and never makes
+ * a reader wait.
+ */
+
+/*
+ * returns the channel of path which is not deleted. A deleted one may still be
+ * read beside it. path is interned.
+ */
+static struct fd_pair *find_pair(struct channel_trace_fd *pairs,
+	const char *path)
+{
+	int i;
+
+	for (i = 0; i < pairs->num_pairs; i++)
+		if (pairs->pair[i].path == path && !pairs->pair[i].deleted)
+			return &pairs->pair[i];
+	return NULL;
+}
+
+static int retire_channel(struct liblttd_instance *instance, int idx);
+
+/*
+ * Open the channel idx of fd_pairs, which waited for the deleted channel of
+ * its path to be closed. The caller holds the write lock, or is the single
+ * reader.
+ *
+ * returns 0, or 1 if it could not be opened and was removed from fd_pairs.
+ */
+static int open_waiting_channel(struct liblttd_instance *instance, int idx)
+{
+	struct fd_pair *pair = &instance->fd_pairs.pair[idx];
+	int ret = 0;
+
+	pair->replaced = 1;
+	if (instance->callbacks->on_open_channel)
+		ret = instance->callbacks->on_open_channel(instance->callbacks,
+			pair, pair->path);
+	if (!ret) {
+		pair->waiting = 0;
+		return 0;
+	}
+	printf("Error opening channel %s\n", pair->path);
+	return retire_channel(instance, idx);
+}
+
+/*
+ * Remove the channel idx of fd_pairs. The caller holds the write lock, or is
+ * the single reader.
+ *
+ * returns the number of channels removed, more than 1 if the channel which
+ * waited for it could not be opened.
+ */
+static int retire_channel(struct liblttd_instance *instance, int idx)
+{
+	struct channel_trace_fd retired;
+	char *path;
+	int i;
+
+	retired.pair = malloc(sizeof(struct fd_pair));
+	if (!retired.pair)
+		return 0;
+	retired.num_pairs = retired.max_pairs = 1;
+	*retired.pair = instance->fd_pairs.pair[idx];
+	memmove(&instance->fd_pairs.pair[idx], &instance->fd_pairs.pair[idx + 1],
+		(instance->fd_pairs.num_pairs - idx - 1) * sizeof(struct fd_pair));
+	instance->fd_pairs.num_pairs--;
+	instance->fd_pairs_gen++;
+	relink_completions(&instance->fd_pairs);
+
+	LTTD_PROBE2(liblttd, channel_retired, retired.pair->channel,
+		retired.pair->path);
+	printf_verbose("Closing deleted channel %s\n", retired.pair->path);
+	pthread_mutex_destroy(&retired.pair->mutex);
+	path = retired.pair->path;
+	close_pairs(instance, &retired);
+
+	/* The channel created again in its place can be read now */
+	for (i = 0; i < instance->fd_pairs.num_pairs; i++) {
+		if (instance->fd_pairs.pair[i].path == path
+		    && instance->fd_pairs.pair[i].waiting)
+			return 1 + open_waiting_channel(instance, i);
+	}
+	return 1;
+}
+
+/*
+ * Close the deleted channels which have hung up. pollfd holds the poll result
+ * of each channel of fd_pairs.
+ *
+ * returns the number of channels removed.
+ */
+static int retire_hung_up(struct liblttd_instance *instance,
+	const struct pollfd *pollfd, const int single)
+{
+	int i, n = 0;
+
+	for (i = instance->fd_pairs.num_pairs - 1; i >= 0; i--) {
+		if (!instance->fd_pairs.pair[i].deleted
+		    || !(pollfd[i].revents & (POLLHUP|POLLERR|POLLNVAL)))
+			continue;
+		/* It is read once the channel it replaces is closed */
+		if (instance->fd_pairs.pair[i].waiting)
+			continue;
+		/* Its sub-buffer is still reserved */
+		if (instance->fd_pairs.pair[i].completion
+		    && instance->fd_pairs.pair[i].completion->state)
+			continue;
+		if (!n++) {
+			if (!single)
+				pthread_rwlock_wrlock(&instance->fd_pairs_lock);
+			fd_pairs_write_begin(instance);
+		}
+		/* pollfd does not match the channels before i anymore */
+		if (retire_channel(instance, i) > 1)
+			break;
+	}
+	if (!n)
+		return 0;
+	fd_pairs_write_end(instance);
+	if (!single) {
+		pthread_rwlock_unlock(&instance->fd_pairs_lock);
+		wake_readers(instance);
+	}
+	return n;
+}
+
+/*
+ * Append the opened and mapped channels of staging to fd_pairs.
+ */
+static int publish_channels(struct liblttd_instance *instance,
+	struct channel_trace_fd *staging, const int single)
+{
+	int ret = 0;
+
+	if (!single)
+		pthread_rwlock_wrlock(&instance->fd_pairs_lock);
+	fd_pairs_write_begin(instance);
+	if (reserve_pairs(instance, &instance->fd_pairs, staging->num_pairs)) {
+		ret = -1;
+		goto unlock;
+	}
+	memcpy(&instance->fd_pairs.pair[instance->fd_pairs.num_pairs],
+		staging->pair, staging->num_pairs * sizeof(struct fd_pair));
+	instance->fd_pairs.num_pairs += staging->num_pairs;
+	instance->fd_pairs_gen++;
+	relink_completions(&instance->fd_pairs);
+unlock:
+	fd_pairs_write_end(instance);
+	if (!single) {
+		pthread_rwlock_unlock(&instance->fd_pairs_lock);
+		wake_readers(instance);
+	}
+	if (!ret) {
+		free(staging->pair);
+		staging->pair = NULL;
+		staging->num_pairs = 0;
+		staging->max_pairs = 0;
+	}
+	return ret;
+}
+
+/* Inotify event arrived.
+ *
+ * Open the created channels and folders, mark the deleted channels and forget
+ * the deleted folders.
+ *
+ * returns 1 if channels were published, 0 if not, -1 on error.
+ */
+int read_inotify(struct liblttd_instance *instance, const int single)
+{
+	char buf[INOTIFY_BUF_LEN]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	struct channel_trace_fd staging = { NULL, 0, 0 };
+	struct inotify_watch *watch;
+	struct fd_pair *pair;
+	ssize_t len;
+	struct inotify_event *ievent;
+	size_t offset;
+	char *path;
+	int ret;
+
+	offset = 0;
+	len = read(instance->inotify_fd, buf, sizeof(buf));
+	account_syscalls(LIBLTTD_PHASE_POLL, 1);
+	if (len < 0) {
+
+		if (errno == EAGAIN)
+			return 0;
+
+		printf("Error in read from inotify FD %s.\n", strerror(errno));
+		return -1;
+	}
+	while(offset < len) {
+		ievent = (struct inotify_event *)&(buf[offset]);
+		offset += sizeof(*ievent) + ievent->len;
+
+		if (ievent->mask & IN_Q_OVERFLOW) {
+			printf("Inotify queue overflow, new channels may be missed\n");
+			continue;
+		}
+		watch = find_watch(instance, ievent->wd);
+		if (!watch)
+			continue;
+		LTTD_PROBE3(liblttd, inotify_event, ievent->wd, ievent->mask,
+			ievent->len ? ievent->name : "");
+		printf_verbose("inotify wd %u event mask : %u for %s/%s\n",
+			ievent->wd, ievent->mask, watch->path,
+			ievent->len ? ievent->name : "");
+
+		if (ievent->mask & IN_DELETE_SELF) {
+			remove_watch(instance, ievent->wd);
+			continue;
+		}
+		if (!(ievent->mask & (IN_CREATE|IN_DELETE)))
+			continue;
+
+		path = intern_child(&instance->paths, watch->path, ievent->name);
+		if (!path)
+			goto error;
+		/* fd_pairs only changes in this thread */
+		pair = find_pair(&instance->fd_pairs, path);
+		if (!pair)
+			pair = find_pair(&staging, path);
+
+		if (ievent->mask & IN_DELETE) {
+			if (pair)
+				pair->deleted = 1;
+			continue;
+		}
+		/*
+		 * Already found by the scan of a new folder. A deleted channel
+		 * of the same path is not : the new one is opened beside it.
+		 */
+		if (pair)
+			continue;
+		if (ievent->mask & IN_ISDIR)
+			ret = open_channel_trace_pairs(instance, &staging, path);
+		else
+			ret = open_buffer_file(instance, &staging, ievent->name,
+				path);
+		if (ret < 0) {
+			printf("Error opening buffer file\n");
+			goto error;
+		}
+	}
+
+	if (!staging.num_pairs)
+		return 0;
+	if ((ret = map_channels(instance, &staging, 0, staging.num_pairs))) {
+		printf("Error mapping channel\n");
+		goto error;
+	}
+	LTTD_PROBE1(liblttd, channels_added, staging.num_pairs);
+	if (publish_channels(instance, &staging, single))
+		goto error;
+	return 1;
+
+error:
+	close_pairs(instance, &staging);
+	return -1;
+}
+
+/*
+ * Control thread, which discovers the channels for the reader threads until
+ * it is told to quit through control_pipe.
+ */
+void *discovery_main(void *arg)
+{
+	struct liblttd_instance *instance = arg;
+	struct pollfd *pollfd = NULL, *new_pollfd;
+	int num_pollfd;
+	int i;
+	long ret = 0;
+
+	liblttd_log_thread(instance, instance->num_threads);
+	for (;;) {
+		/* Poll the deleted channels to know when they hang up */
+		new_pollfd = realloc(pollfd, (2 + instance->fd_pairs.num_pairs)
+			* sizeof(struct pollfd));
+		if (!new_pollfd) {
+			ret = ENOMEM;
+			break;
+		}
+		pollfd = new_pollfd;
+		pollfd[0].fd = instance->inotify_fd;
+		pollfd[0].events = POLLIN;
+		pollfd[1].fd = instance->control_pipe[0];
+		pollfd[1].events = POLLIN;
+		for (i = 0; i < instance->fd_pairs.num_pairs; i++) {
+			/* A negative fd is ignored by poll */
+			pollfd[2 + i].fd = instance->fd_pairs.pair[i].deleted ?
+				instance->fd_pairs.pair[i].channel : -1;
+			pollfd[2 + i].events = 0;
+		}
+		num_pollfd = 2 + instance->fd_pairs.num_pairs;
+
+		if (poll(pollfd, num_pollfd, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			ret = errno;
+			perror("Poll error");
+			break;
+		}
+		if (pollfd[1].revents)
+			break;
+		if (pollfd[0].revents & POLLIN) {
+			read_inotify(instance, 0);
+			/* pollfd does not match fd_pairs anymore */
+			continue;
+		}
+		retire_hung_up(instance, &pollfd[2], 0);
+	}
+
+	free(pollfd);
+	account_thread_cpu(instance, NULL);
+	return (void *)ret;
+}
+
+static void discovery_close_pipes(struct liblttd_instance *instance)
+{
+	unsigned long i;
+
+	close(instance->control_pipe[0]);
+	close(instance->control_pipe[1]);
+	if (!instance->wake_pipes)
+		return;
+	for (i = 0; i < 2 * instance->num_threads; i++)
+		if (instance->wake_pipes[i] >= 0)
+			close(instance->wake_pipes[i]);
+	free(instance->wake_pipes);
+	instance->wake_pipes = NULL;
+}
+
+/*
+ * Start the discovery thread, before the readers which poll its wake pipes.
+ */
+int discovery_start(struct liblttd_instance *instance, pthread_t *tid)
+{
+	unsigned long i;
+	int ret;
+
+	if (pipe2(instance->control_pipe, O_NONBLOCK) == -1)
+		return errno;
+	instance->wake_pipes = malloc(2 * instance->num_threads * sizeof(int));
+	if (!instance->wake_pipes) {
+		ret = ENOMEM;
+		goto error;
+	}
+	for (i = 0; i < 2 * instance->num_threads; i++)
+		instance->wake_pipes[i] = -1;
+	for (i = 0; i < instance->num_threads; i++) {
+		if (pipe2(&instance->wake_pipes[2 * i], O_NONBLOCK) == -1) {
+			ret = errno;
+			goto error;
+		}
+	}
+
+	ret = pthread_create(tid, NULL, discovery_main, instance);
+	if (ret)
+		goto error;
+	return 0;
+
+error:
+	discovery_close_pipes(instance);
+	return ret;
+}
+
+void discovery_stop(struct liblttd_instance *instance, pthread_t tid)
+{
+	void *tret;
+
+	if (write(instance->control_pipe[1], "q", 1) == -1)
+		perror("Error stopping the discovery thread");
+	pthread_join(tid, &tret);
+	if ((long)tret != 0)
+		printf("Error %s occured in the discovery thread\n",
+			strerror((long)tret));
+	discovery_close_pipes(instance);
+}
+#endif //HAS_INOTIFY
+
+static inline unsigned long long elapsed_ns(const struct timespec *begin,
+	const struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000000ULL
+		+ end->tv_nsec - begin->tv_nsec;
+}
+
+/*
+ * Take fd_pairs_lock for a reader thread, accounting the time it waited. The
+ * single reader has nothing to synchronize with.
  */
-int read_inotify(struct liblttd_instance *instance)
+static inline void fd_pairs_lock(struct liblttd_instance *instance,
+	struct liblttd_thread_stats *tstats, int write, const int single)
 {
-	char buf[sizeof(struct inotify_event) + PATH_MAX];
-	char path_channel[PATH_MAX];
-	ssize_t len;
-	struct inotify_event *ievent;
-	size_t offset;
-	unsigned int i;
-	int ret;
-	int old_num;
+	struct timespec begin, end;
+	unsigned long long wait;
+
+	if (single)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (write)
+		pthread_rwlock_wrlock(&instance->fd_pairs_lock);
+	else
+		pthread_rwlock_rdlock(&instance->fd_pairs_lock);
+	fd_pairs_held = 1;
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	offset = 0;
-	len = read(instance->inotify_fd, buf, sizeof(struct inotify_event) + PATH_MAX);
-	if (len < 0) {
+	wait = elapsed_ns(&begin, &end);
+	tstats->rwlock_wait += wait;
+	if (wait > tstats->rwlock_max)
+		tstats->rwlock_max = wait;
+}
 
-		if (errno == EAGAIN)
-			return 0;  /* another thread got the data before us */
+static inline void fd_pairs_unlock(struct liblttd_instance *instance,
+	const int single)
+{
+	if (single)
+		return;
+	fd_pairs_held = 0;
+	pthread_rwlock_unlock(&instance->fd_pairs_lock);
+}
 
-		printf("Error in read from inotify FD %s.\n", strerror(len));
-		return -1;
-	}
-	while(offset < len) {
-		ievent = (struct inotify_event *)&(buf[offset]);
-		for(i=0; i<instance->inotify_watch_array.num; i++) {
-			if (instance->inotify_watch_array.elem[i].wd == ievent->wd &&
-				ievent->mask == IN_CREATE) {
-				printf_verbose(
-					"inotify wd %u event mask : %u for %s%s\n",
-					ievent->wd, ievent->mask,
-					instance->inotify_watch_array.elem[i].path_channel,
-					ievent->name);
-				old_num = instance->fd_pairs.num_pairs;
-				strcpy(path_channel, instance->inotify_watch_array.elem[i].path_channel);
-				strcat(path_channel, ievent->name);
-				if (ret = open_buffer_file(instance, ievent->name, path_channel,
-					path_channel + (instance->inotify_watch_array.elem[i].base_path_channel -
-					instance->inotify_watch_array.elem[i].path_channel))) {
-					printf("Error opening buffer file\n");
-					return -1;
-				}
-				if (ret = map_channels(instance, old_num, instance->fd_pairs.num_pairs)) {
-					printf("Error mapping channel\n");
-					return -1;
-				}
+/* Try to take the channel for a reader thread, counting the failures */
+static inline int fd_pair_trylock(struct fd_pair *pair,
+	struct liblttd_thread_stats *tstats, const int single)
+{
+	if (single)
+		return 1;
+	tstats->trylocks++;
+	if (pthread_mutex_trylock(&pair->mutex) == 0)
+		return 1;
+	tstats->trylock_failed++;
+	return 0;
+}
 
-			}
-		}
-		offset += sizeof(*ievent) + ievent->len;
-	}
+static inline int fd_pair_unlock(struct fd_pair *pair, const int single)
+{
+	if (single)
+		return 0;
+	return pthread_mutex_unlock(&pair->mutex);
 }
-#endif //HAS_INOTIFY
 
 /*
  * read_channels
@@ -416,43 +1435,87 @@ int read_inotify(struct liblttd_instance *instance)
  *
  * Note that a channel is considered high priority when the buffer is almost
  * full.
+ *
+ * With single set, the caller is the only thread of the instance : the
+ * channels and fd_pairs are not locked, and the thread discovers the new
+ * channels itself. It is a constant, so that the lock calls are compiled out
+ * of read_channels_single. Otherwise, the discovery thread wakes the thread up
+ * when fd_pairs changes.
  */
 
-int read_channels(struct liblttd_instance *instance, unsigned long thread_num)
+/*
+ * Poll the wake up fd first, then the channels of fd_pairs. The caller holds
+ * fd_pairs_lock. A channel pending completion is left out, liblttd_complete
+ * wakes the readers up to poll it again.
+ */
+static struct pollfd *build_pollfd(struct liblttd_instance *instance,
+	struct pollfd *pollfd, int wake_fd, int *num_pollfd)
 {
-	struct pollfd *pollfd = NULL;
-	int num_pollfd;
-	int i,j;
-	int num_rdy, num_hup;
-	int high_prio;
-	int ret = 0;
-	int inotify_fds;
-	unsigned int old_num;
-
-#ifdef HAS_INOTIFY
-	inotify_fds = 1;
-#else
-	inotify_fds = 0;
-#endif
-
-	pthread_rwlock_rdlock(&instance->fd_pairs_lock);
+	struct pollfd *new_pollfd;
+	int i;
 
-	/* Start polling the FD. Keep one fd for inotify */
-	pollfd = malloc((inotify_fds + instance->fd_pairs.num_pairs) * sizeof(struct pollfd));
+	new_pollfd = realloc(pollfd,
+		(1 + instance->fd_pairs.num_pairs) * sizeof(struct pollfd));
+	if (!new_pollfd) {
+		free(pollfd);
+		return NULL;
+	}
+	pollfd = new_pollfd;
 
-#ifdef HAS_INOTIFY
-	pollfd[0].fd = instance->inotify_fd;
+	/* A negative fd is ignored by poll */
+	pollfd[0].fd = wake_fd;
 	pollfd[0].events = POLLIN|POLLPRI;
-#endif
-
 	for(i=0;i<instance->fd_pairs.num_pairs;i++) {
-		pollfd[inotify_fds+i].fd = instance->fd_pairs.pair[i].channel;
-		pollfd[inotify_fds+i].events = POLLIN|POLLPRI;
+		struct fd_pair *pair = &instance->fd_pairs.pair[i];
+
+		pollfd[1+i].fd = pair->channel;
+		if (pair->waiting)
+			pollfd[1+i].fd = -1;
+		if (instance->wake_pipes && pair->completion
+		    && pair->completion->state == COMPLETION_PENDING)
+			pollfd[1+i].fd = -1;
+		pollfd[1+i].events = POLLIN|POLLPRI;
 	}
-	num_pollfd = inotify_fds + instance->fd_pairs.num_pairs;
+	*num_pollfd = 1 + instance->fd_pairs.num_pairs;
+	return pollfd;
+}
+
+static void drain_wake_pipe(int fd)
+{
+	char buf[64];
 
+	do {
+		account_syscalls(LIBLTTD_PHASE_POLL, 1);
+	} while (read(fd, buf, sizeof(buf)) > 0);
+}
 
-	pthread_rwlock_unlock(&instance->fd_pairs_lock);
+static inline __attribute__((always_inline))
+int __read_channels(struct liblttd_instance *instance, unsigned long thread_num,
+	const int single)
+{
+	struct pollfd *pollfd = NULL;
+	struct fd_pair *pair;
+	int num_pollfd;
+	int i;
+	int num_rdy, num_hup;
+	int high_prio;
+	int ret = 0;
+	int wake_fd = -1;
+	unsigned long gen, inflight_gen;
+	struct liblttd_thread_stats *tstats = &instance->thread_stats[thread_num];
+
+	if (single)
+		wake_fd = instance->inotify_fd;
+	else if (instance->wake_pipes)
+		wake_fd = instance->wake_pipes[2 * thread_num];
+
+	fd_pairs_lock(instance, tstats, 0, single);
+	inflight_gen = instance->inflight_gen;
+	pollfd = build_pollfd(instance, pollfd, wake_fd, &num_pollfd);
+	gen = instance->fd_pairs_gen;
+	fd_pairs_unlock(instance, single);
+	if (!pollfd)
+		return ENOMEM;
 
 	while(1) {
 		high_prio = 0;
@@ -468,159 +1531,314 @@ int read_channels(struct liblttd_instance *instance, unsigned long thread_num)
 		if (instance->quit_program) break;
 
 		num_rdy = poll(pollfd, num_pollfd, -1);
+		tstats->syscalls[LIBLTTD_PHASE_POLL]++;
 
 		if (num_rdy == -1) {
 			perror("Poll error");
 			goto free_fd;
 		}
+		tstats->polls++;
+		LTTD_PROBE2(liblttd, poll_wakeup, thread_num, num_rdy);
 
-		printf_verbose("Data received\n");
-#ifdef HAS_INOTIFY
+		log_event(LIBLTTD_LOG_POLL, -1, num_rdy, 0);
 		switch(pollfd[0].revents) {
-			case POLLERR:
-				printf_verbose(
-					"Error returned in polling inotify fd %d.\n",
-					pollfd[0].fd);
-				break;
-			case POLLHUP:
-				printf_verbose(
-					"Polling inotify fd %d tells it has hung up.\n",
-					pollfd[0].fd);
-				break;
-			case POLLNVAL:
-				printf_verbose(
-					"Polling inotify fd %d tells fd is not open.\n",
-					pollfd[0].fd);
+			case 0:
 				break;
 			case POLLPRI:
 			case POLLIN:
-				printf_verbose(
-					"Polling inotify fd %d : data ready.\n",
-					pollfd[0].fd);
-
-				pthread_rwlock_wrlock(&instance->fd_pairs_lock);
-				read_inotify(instance);
-				pthread_rwlock_unlock(&instance->fd_pairs_lock);
-
-			break;
-		}
+				log_event(LIBLTTD_LOG_WAKE, pollfd[0].fd, 0, 0);
+#ifdef HAS_INOTIFY
+				if (single) {
+					read_inotify(instance, 1);
+					break;
+				}
 #endif
+				drain_wake_pipe(pollfd[0].fd);
+				break;
+			default:
+				log_event(LIBLTTD_LOG_WAKE_ERROR, pollfd[0].fd,
+					pollfd[0].revents, 0);
+				break;
+		}
+		/* Channels were added or removed, the results are stale */
+		if (single && gen != instance->fd_pairs_gen)
+			goto update;
 
-		for(i=inotify_fds;i<num_pollfd;i++) {
+		for(i=1;i<num_pollfd;i++) {
 			switch(pollfd[i].revents) {
 				case POLLERR:
-					printf_verbose(
-						"Error returned in polling fd %d.\n",
-						pollfd[i].fd);
+					log_event(LIBLTTD_LOG_POLL_ERR,
+						pollfd[i].fd, 0, 0);
 					num_hup++;
 					break;
 				case POLLHUP:
-					printf_verbose(
-						"Polling fd %d tells it has hung up.\n",
-						pollfd[i].fd);
+					log_event(LIBLTTD_LOG_POLL_HUP,
+						pollfd[i].fd, 0, 0);
 					num_hup++;
 					break;
 				case POLLNVAL:
-					printf_verbose(
-						"Polling fd %d tells fd is not open.\n",
-						pollfd[i].fd);
+					log_event(LIBLTTD_LOG_POLL_NVAL,
+						pollfd[i].fd, 0, 0);
 					num_hup++;
 					break;
 				case POLLPRI:
-					pthread_rwlock_rdlock(&instance->fd_pairs_lock);
-					if (pthread_mutex_trylock(&instance->fd_pairs.pair[i-inotify_fds].mutex) == 0) {
-						printf_verbose(
-							"Urgent read on fd %d\n",
-							pollfd[i].fd);
+					fd_pairs_lock(instance, tstats, 0, single);
+					pair = &instance->fd_pairs.pair[i-1];
+					if (gen == instance->fd_pairs_gen
+					    && fd_pair_trylock(pair, tstats, single)) {
+						log_event(LIBLTTD_LOG_READ_URGENT,
+							pollfd[i].fd, 0, 0);
 						/* Take care of high priority channels first. */
 						high_prio = 1;
 						/* it's ok to have an unavailable sub-buffer */
-						ret = read_subbuffer(instance, &instance->fd_pairs.pair[i-inotify_fds]);
+						tstats->reads++;
+						ret = read_subbuffer(instance, pair);
 						if (ret == EAGAIN) ret = 0;
+						else pair->stats.urgent++;
 
-						ret = pthread_mutex_unlock(&instance->fd_pairs.pair[i-inotify_fds].mutex);
+						ret = fd_pair_unlock(pair, single);
 						if (ret)
 							printf("Error in mutex unlock : %s\n", strerror(ret));
 					}
-					pthread_rwlock_unlock(&instance->fd_pairs_lock);
+					fd_pairs_unlock(instance, single);
 					break;
 			}
 		}
 		/* If every buffer FD has hung up, we end the read loop here */
-		if (num_hup == num_pollfd - inotify_fds) break;
+		if (num_hup == num_pollfd - 1) {
+			fd_pairs_lock(instance, tstats, 0, single);
+			i = gen != instance->fd_pairs_gen;
+			fd_pairs_unlock(instance, single);
+			if (!i)
+				break;
+		}
+
+#ifdef HAS_INOTIFY
+		/* The channels of an unplugged CPU are closed once empty */
+		if (single && num_hup && retire_hung_up(instance, &pollfd[1], 1))
+			goto update;
+#endif
 
 		if (!high_prio) {
-			for(i=inotify_fds;i<num_pollfd;i++) {
+			for(i=1;i<num_pollfd;i++) {
 				switch(pollfd[i].revents) {
 					case POLLIN:
-						pthread_rwlock_rdlock(&instance->fd_pairs_lock);
-						if (pthread_mutex_trylock(&instance->fd_pairs.pair[i-inotify_fds].mutex) == 0) {
+						fd_pairs_lock(instance, tstats, 0, single);
+						pair = &instance->fd_pairs.pair[i-1];
+						if (gen == instance->fd_pairs_gen
+						    && fd_pair_trylock(pair, tstats, single)) {
 							/* Take care of low priority channels. */
-							printf_verbose(
-								"Normal read on fd %d\n",
-								pollfd[i].fd);
+							log_event(LIBLTTD_LOG_READ_NORMAL,
+								pollfd[i].fd, 0, 0);
 							/* it's ok to have an unavailable subbuffer */
-							ret = read_subbuffer(instance, &instance->fd_pairs.pair[i-inotify_fds]);
+							tstats->reads++;
+							ret = read_subbuffer(instance, pair);
 							if (ret == EAGAIN) ret = 0;
 
-							ret = pthread_mutex_unlock(&instance->fd_pairs.pair[i-inotify_fds].mutex);
+							ret = fd_pair_unlock(pair, single);
 							if (ret)
 								printf("Error in mutex unlock : %s\n", strerror(ret));
 						}
-						pthread_rwlock_unlock(&instance->fd_pairs_lock);
+						fd_pairs_unlock(instance, single);
 						break;
 				}
 			}
 		}
 
-		/* Update pollfd array if an entry was added to fd_pairs */
-		pthread_rwlock_rdlock(&instance->fd_pairs_lock);
-		if ((inotify_fds + instance->fd_pairs.num_pairs) != num_pollfd) {
-			pollfd = realloc(pollfd,
-					(inotify_fds + instance->fd_pairs.num_pairs) * sizeof(struct pollfd));
-			for(i=num_pollfd-inotify_fds;i<instance->fd_pairs.num_pairs;i++) {
-				pollfd[inotify_fds+i].fd = instance->fd_pairs.pair[i].channel;
-				pollfd[inotify_fds+i].events = POLLIN|POLLPRI;
-			}
-			num_pollfd = instance->fd_pairs.num_pairs + inotify_fds;
-		}
-		pthread_rwlock_unlock(&instance->fd_pairs_lock);
-
-		/* NB: If the fd_pairs structure is updated by another thread from this
-		 *     point forward, the current thread will wait in the poll without
-		 *     monitoring the new channel. However, this thread will add the
-		 *     new channel on next poll (and this should not take too much time
-		 *     on a loaded system).
-		 *
-		 *     This event is quite unlikely and can only occur if a CPU is
-		 *     hot-plugged while multple lttd threads are running.
+update:
+		/*
+		 * Rebuild the pollfd array if fd_pairs has changed, or a
+		 * channel waits for its completion or got it
 		 */
+		fd_pairs_lock(instance, tstats, 0, single);
+		if (gen != instance->fd_pairs_gen
+		    || (!single && inflight_gen != instance->inflight_gen)) {
+			inflight_gen = instance->inflight_gen;
+			pollfd = build_pollfd(instance, pollfd, wake_fd,
+				&num_pollfd);
+			gen = instance->fd_pairs_gen;
+		}
+		fd_pairs_unlock(instance, single);
+		if (!pollfd)
+			return ENOMEM;
 	}
 
 free_fd:
 	free(pollfd);
 
-end:
 	return ret;
 }
 
+int read_channels(struct liblttd_instance *instance, unsigned long thread_num)
+{
+	return __read_channels(instance, thread_num, 0);
+}
 
-void close_channel_trace_pairs(struct liblttd_instance *instance)
+int read_channels_single(struct liblttd_instance *instance,
+	unsigned long thread_num)
+{
+	return __read_channels(instance, thread_num, 1);
+}
+
+
+/*
+ * drain_channels
+ *
+ * Thread worker for the drain mode.
+ *
+ * Each thread takes the next channel nobody has read yet and reads the
+ * sub-buffers available in it. At most n_sb sub-buffers are read per channel,
+ * so a channel which keeps being written does not hold the thread forever.
+ * Like any read, it consumes them : RELAY_PUT_SB moves the reader past each.
+ *
+ * returns 0 on success, an errno value on error.
+ */
+int drain_channels(struct liblttd_instance *instance,
+	unsigned long thread_num)
 {
+	struct fd_pair *pair;
+	unsigned int j;
 	int i;
-	int ret;
+	int ret = 0;
 
-	for(i=0;i<instance->fd_pairs.num_pairs;i++) {
-		ret = close(instance->fd_pairs.pair[i].channel);
-		if (ret == -1) perror("Close error on channel");
-		if (instance->callbacks->on_close_channel) {
-			ret = instance->callbacks->on_close_channel(
-				instance->callbacks, &instance->fd_pairs.pair[i]);
-			if (ret != 0) perror("Error on close channel callback");
+	for (;;) {
+		i = __sync_fetch_and_add(&instance->drain_next, 1);
+		if (i >= instance->fd_pairs.num_pairs)
+			break;
+		pair = &instance->fd_pairs.pair[i];
+
+		printf_verbose("Drain of fd %d\n", pair->channel);
+		for (j = 0; j < pair->n_sb; j++) {
+			ret = read_subbuffer(instance, pair);
+			/* The reader was pushed, the next one is still good */
+			if (ret == EIO)
+				continue;
+			if (ret)
+				break;
 		}
+		/* No sub-buffer left in this channel */
+		if (ret == EAGAIN)
+			ret = 0;
+		if (ret)
+			printf("Error %s in drain of fd %d\n",
+				strerror(ret), pair->channel);
 	}
-	free(instance->fd_pairs.pair);
-	free(instance->inotify_watch_array.elem);
+
+	return ret;
+}
+
+/*
+ * dump_channels
+ *
+ * Thread worker for the dump mode.
+ *
+ * Thread n reads channels n, n + num_threads, n + 2 * num_threads, ... Nobody
+ * else reads them, so no lock is needed. Each ready channel is read until it
+ * has no sub-buffer left, and is removed from the poll set when it hangs up.
+ * A read error is retried at the next poll, the channel is only given up after
+ * DUMP_MAX_ERRORS errors in a row.
+ *
+ * returns 0 on success, an errno value on error.
+ */
+#define DUMP_MAX_ERRORS	16
+
+int dump_channels(struct liblttd_instance *instance, unsigned long thread_num)
+{
+	struct pollfd *pollfd;
+	struct fd_pair **pairs;
+	int *errors;
+	int num_pollfd = 0;
+	int num_hup = 0;
+	int i;
+	int ret = 0;
+
+	for (i = thread_num; i < instance->fd_pairs.num_pairs;
+	     i += instance->num_threads)
+		num_pollfd++;
+	if (!num_pollfd)
+		return 0;
+
+	pollfd = malloc(num_pollfd * sizeof(struct pollfd));
+	pairs = malloc(num_pollfd * sizeof(struct fd_pair *));
+	errors = calloc(num_pollfd, sizeof(int));
+	if (!pollfd || !pairs || !errors) {
+		ret = ENOMEM;
+		goto free_fd;
+	}
+
+	num_pollfd = 0;
+	for (i = thread_num; i < instance->fd_pairs.num_pairs;
+	     i += instance->num_threads) {
+		pairs[num_pollfd] = &instance->fd_pairs.pair[i];
+		pollfd[num_pollfd].fd = instance->fd_pairs.pair[i].channel;
+		pollfd[num_pollfd].events = POLLIN|POLLPRI;
+		num_pollfd++;
+	}
+
+	while (num_hup < num_pollfd) {
+		/* Have we received a signal ? */
+		if (instance->quit_program)
+			break;
+
+		account_syscalls(LIBLTTD_PHASE_POLL, 1);
+		if (poll(pollfd, num_pollfd, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			ret = errno;
+			perror("Poll error");
+			goto free_fd;
+		}
+
+		for (i = 0; i < num_pollfd; i++) {
+			if (pollfd[i].revents & (POLLIN|POLLPRI)) {
+				if (pollfd[i].revents & POLLPRI)
+					pairs[i]->stats.urgent++;
+				/* Read everything before polling again */
+				do {
+					ret = read_subbuffer(instance,
+							     pairs[i]);
+				} while (ret == 0 || ret == EIO);
+				if (ret == EAGAIN) {
+					ret = 0;
+					errors[i] = 0;
+					continue;
+				}
+				printf("Error %s in dump of fd %d\n",
+					strerror(ret), pollfd[i].fd);
+				/* The kernel tells a finalized channel is empty */
+				if (ret != ENODATA && ++errors[i] < DUMP_MAX_ERRORS) {
+					ret = 0;
+					continue;
+				}
+			} else if (!pollfd[i].revents) {
+				continue;
+			}
+			printf_verbose("Fd %d is done\n", pollfd[i].fd);
+			/* A negative fd is ignored by poll */
+			pollfd[i].fd = -1;
+			num_hup++;
+		}
+	}
+
+free_fd:
+	free(errors);
+	free(pairs);
+	free(pollfd);
+
+	return ret;
+}
+
+/*
+ * The reader threads are done. The array is kept for
+ * liblttd_get_channel_stats, it is freed with the instance.
+ */
+void close_channel_trace_pairs(struct liblttd_instance *instance)
+{
+	fd_pairs_write_begin(instance);
+	close_pair_files(instance, &instance->fd_pairs);
+	instance->fd_pairs.num_pairs = 0;
+	fd_pairs_write_end(instance);
+	free_watches(instance);
 }
 
 /* Thread worker */
@@ -628,20 +1846,38 @@ void * thread_main(void *arg)
 {
 	long ret = 0;
 	struct liblttd_thread_data *thread_data = (struct liblttd_thread_data*) arg;
+	struct liblttd_thread_stats *tstats =
+		&thread_data->instance->thread_stats[thread_data->thread_num];
 
+	current_stats = tstats;
 	if (thread_data->instance->callbacks->on_new_thread)
 		ret = thread_data->instance->callbacks->on_new_thread(
 		thread_data->instance->callbacks, thread_data->thread_num);
 
 	if (ret < 0) {
+		account_thread_cpu(thread_data->instance, &tstats->cpu_time);
 		return (void*)ret;
 	}
-	ret = read_channels(thread_data->instance, thread_data->thread_num);
+	liblttd_log_thread(thread_data->instance, thread_data->thread_num);
+	if (thread_data->instance->drain_mode)
+		ret = drain_channels(thread_data->instance,
+			thread_data->thread_num);
+	else if (thread_data->instance->dump_mode)
+		ret = dump_channels(thread_data->instance,
+			thread_data->thread_num);
+	else if (thread_data->instance->single_reader)
+		ret = read_channels_single(thread_data->instance,
+			thread_data->thread_num);
+	else
+		ret = read_channels(thread_data->instance,
+			thread_data->thread_num);
 
 	if (thread_data->instance->callbacks->on_close_thread)
 		thread_data->instance->callbacks->on_close_thread(
 		thread_data->instance->callbacks, thread_data->thread_num);
 
+	account_thread_cpu(thread_data->instance, &tstats->cpu_time);
+	current_stats = NULL;
 	free(thread_data);
 
 	return (void*)ret;
@@ -651,12 +1887,27 @@ int channels_init(struct liblttd_instance *instance)
 {
 	int ret = 0;
 
+	char *root;
+
+	instance->channel_dirfd = open(instance->channel_name,
+		O_RDONLY | O_DIRECTORY);
+	if (instance->channel_dirfd == -1) {
+		perror(instance->channel_name);
+		return ENOENT;
+	}
+	root = intern_path(&instance->paths, "");
+	if (!root) {
+		close(instance->channel_dirfd);
+		return -ENOMEM;
+	}
+
 	instance->inotify_fd = inotify_init();
 	fcntl(instance->inotify_fd, F_SETFL, O_NONBLOCK);
 
-	if (ret = open_channel_trace_pairs(instance, instance->channel_name,
-			instance->channel_name +
-			strlen(instance->channel_name)))
+	fd_pairs_write_begin(instance);
+	ret = open_channel_trace_pairs(instance, &instance->fd_pairs, root);
+	fd_pairs_write_end(instance);
+	if (ret)
 		goto close_channel;
 	if (instance->fd_pairs.num_pairs == 0) {
 		printf("No channel available for reading, exiting\n");
@@ -664,20 +1915,37 @@ int channels_init(struct liblttd_instance *instance)
 		goto close_channel;
 	}
 
-	if (ret = map_channels(instance, 0, instance->fd_pairs.num_pairs))
+	if ((ret = map_channels(instance, &instance->fd_pairs, 0,
+			instance->fd_pairs.num_pairs)))
 		goto close_channel;
+	relink_completions(&instance->fd_pairs);
 	return 0;
 
 close_channel:
 	close_channel_trace_pairs(instance);
 	if (instance->inotify_fd >= 0)
 		close(instance->inotify_fd);
+	close(instance->channel_dirfd);
 	return ret;
 }
 
 int delete_instance(struct liblttd_instance *instance)
 {
+	struct liblttd_retired_pairs *retired;
+
+	while ((retired = instance->retired_pairs)) {
+		instance->retired_pairs = retired->next;
+		free(retired->pair);
+		free(retired);
+	}
+	free(instance->fd_pairs.pair);
 	pthread_rwlock_destroy(&instance->fd_pairs_lock);
+	pthread_mutex_destroy(&instance->inflight_lock);
+	pthread_cond_destroy(&instance->inflight_cond);
+	free(instance->thread_stats);
+	free(instance->tids);
+	free_paths(&instance->paths);
+	free(instance->channel_name);
 	free(instance);
 	return 0;
 }
@@ -685,24 +1953,57 @@ int delete_instance(struct liblttd_instance *instance)
 int liblttd_start_instance(struct liblttd_instance *instance)
 {
 	int ret = 0;
-	pthread_t *tids;
 	unsigned long i;
 	void *tret;
+	pthread_t discovery_tid;
+	int discovery = 0;
 
 	if (!instance)
 		return -EINVAL;
 
-	if (ret = channels_init(instance))
+	instance->thread_stats = calloc(instance->num_threads,
+		sizeof(struct liblttd_thread_stats));
+	if (!instance->thread_stats)
+		return -ENOMEM;
+
+	/* The completions come from other threads, the channels are locked */
+	if (instance->callbacks_v2 && instance->callbacks_v2->on_read_subbuffer)
+		instance->single_reader = 0;
+
+	if (ret = channels_init(instance)) {
+		free(instance->thread_stats);
+		instance->thread_stats = NULL;
 		return ret;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &instance->stats.start);
+
+	ret = liblttd_log_start(instance);
+	if (ret)
+		printf("Error %s starting the log, it is disabled\n",
+			strerror(ret));
+
+#ifdef HAS_INOTIFY
+	/* The single reader, drains and dumps look for no new channel */
+	if (instance->inotify_fd >= 0 && !instance->single_reader
+	    && !instance->drain_mode && !instance->dump_mode) {
+		ret = discovery_start(instance, &discovery_tid);
+		if (ret)
+			printf("Error %s starting the discovery thread, new "
+				"channels will not be read\n", strerror(ret));
+		discovery = !ret;
+	}
+#endif
 
-	tids = malloc(sizeof(pthread_t) * instance->num_threads);
+	instance->tids = calloc(instance->num_threads, sizeof(pthread_t));
 	for(i=0; i<instance->num_threads; i++) {
 		struct liblttd_thread_data *thread_data =
 			malloc(sizeof(struct liblttd_thread_data));
 		thread_data->thread_num = i;
 		thread_data->instance = instance;
 
-		ret = pthread_create(&tids[i], NULL, thread_main, thread_data);
+		ret = pthread_create(&instance->tids[i], NULL, thread_main,
+			thread_data);
 		if (ret) {
 			perror("Error creating thread");
 			break;
@@ -710,7 +2011,7 @@ int liblttd_start_instance(struct liblttd_instance *instance)
 	}
 
 	for(i=0; i<instance->num_threads; i++) {
-		ret = pthread_join(tids[i], &tret);
+		ret = pthread_join(instance->tids[i], &tret);
 		if (ret) {
 			perror("Error joining thread");
 			break;
@@ -721,11 +2022,19 @@ int liblttd_start_instance(struct liblttd_instance *instance)
 		}
 	}
 
-	free(tids);
+	/* The wake pipes go with the discovery thread */
+	wait_completions(instance);
+#ifdef HAS_INOTIFY
+	if (discovery)
+		discovery_stop(instance, discovery_tid);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &instance->stats.end);
+	liblttd_log_stop(instance);
 	ret = unmap_channels(instance);
 	close_channel_trace_pairs(instance);
 	if (instance->inotify_fd >= 0)
 		close(instance->inotify_fd);
+	close(instance->channel_dirfd);
 
 	if (instance->callbacks->on_trace_end)
 		instance->callbacks->on_trace_end(instance);
@@ -751,6 +2060,11 @@ struct liblttd_instance * liblttd_new_instance(
 	instance = malloc(sizeof(struct liblttd_instance));
 	if (!instance)
 		return NULL;
+	instance->channel_name = strdup(channel_path);
+	if (!instance->channel_name) {
+		free(instance);
+		return NULL;
+	}
 
 	instance->callbacks = callbacks;
 
@@ -758,25 +2072,205 @@ struct liblttd_instance * liblttd_new_instance(
 
 	instance->fd_pairs.pair = NULL;
 	instance->fd_pairs.num_pairs = 0;
+	instance->fd_pairs.max_pairs = 0;
 
-	instance->inotify_watch_array.elem = NULL;
-	instance->inotify_watch_array.num = 0;
+	memset(&instance->inotify_watches, 0, sizeof(instance->inotify_watches));
+	memset(&instance->paths, 0, sizeof(instance->paths));
+	instance->channel_dirfd = -1;
+
+	instance->fd_pairs_gen = 0;
+	instance->fd_pairs_seq = 0;
+	instance->retired_pairs = NULL;
+	instance->wake_pipes = NULL;
 
 	pthread_rwlock_init(&instance->fd_pairs_lock, NULL);
 
-	strncpy(instance->channel_name, channel_path, PATH_MAX -1);
 	instance->num_threads = n_threads;
 	instance->dump_flight_only = flight_only;
 	instance->dump_normal_only = normal_only;
 	instance->verbose_mode = verbose;
 	instance->quit_program = 0;
+	instance->drain_mode = 0;
+	instance->drain_next = 0;
+	instance->dump_mode = 0;
+	instance->single_reader = n_threads == 1;
+	instance->log_fd = -1;
+	memset(&instance->stats, 0, sizeof(instance->stats));
+	instance->thread_stats = NULL;
+	instance->tids = NULL;
+	instance->log = NULL;
+	instance->callbacks_v2 = NULL;
+	instance->inflight = 0;
+	instance->inflight_gen = 0;
+	pthread_mutex_init(&instance->inflight_lock, NULL);
+	pthread_cond_init(&instance->inflight_cond, NULL);
 
 	return instance;
 }
 
+int liblttd_delete_instance(struct liblttd_instance *instance)
+{
+	if (!instance)
+		return -EINVAL;
+	return delete_instance(instance);
+}
+
 int liblttd_stop_instance(struct liblttd_instance *instance)
 {
 	instance->quit_program = 1;
 	return 0;
 }
 
+
+int liblttd_set_drain_mode(struct liblttd_instance *instance, int drain)
+{
+	if (!instance)
+		return -EINVAL;
+	instance->drain_mode = drain;
+	return 0;
+}
+
+int liblttd_set_single_reader(struct liblttd_instance *instance, int single)
+{
+	if (!instance)
+		return -EINVAL;
+	if (single && instance->num_threads != 1)
+		return -EINVAL;
+	instance->single_reader = single;
+	return 0;
+}
+
+int liblttd_set_dump_mode(struct liblttd_instance *instance, int dump)
+{
+	if (!instance)
+		return -EINVAL;
+	instance->dump_mode = dump;
+	return 0;
+}
+
+int liblttd_set_callbacks_v2(struct liblttd_instance *instance,
+	const struct liblttd_callbacks_v2 *callbacks_v2)
+{
+	if (!instance)
+		return -EINVAL;
+	instance->callbacks_v2 = callbacks_v2;
+	return 0;
+}
+
+int liblttd_get_stats(struct liblttd_instance *instance,
+	struct liblttd_stats *stats, struct liblttd_thread_stats *thread_stats)
+{
+	struct liblttd_thread_stats *tstats;
+	struct timespec ts;
+	clockid_t clock;
+	unsigned long i;
+
+	if (!instance || !stats)
+		return -EINVAL;
+	*stats = instance->stats;
+	if (!thread_stats)
+		return 0;
+	if (!instance->thread_stats) {
+		memset(thread_stats, 0,
+			instance->num_threads * sizeof(*thread_stats));
+		return 0;
+	}
+	memcpy(thread_stats, instance->thread_stats,
+		instance->num_threads * sizeof(*thread_stats));
+
+	/* The CPU time of a thread is only stored at its end */
+	for (i = 0; i < instance->num_threads; i++) {
+		tstats = &thread_stats[i];
+		if (tstats->cpu_time || !instance->tids || !instance->tids[i])
+			continue;
+		if (!pthread_getcpuclockid(instance->tids[i], &clock)
+		    && !clock_gettime(clock, &ts))
+			tstats->cpu_time = ts.tv_sec * 1000000000ULL
+				+ ts.tv_nsec;
+	}
+	return 0;
+}
+
+int liblttd_get_channel_stats(struct liblttd_instance *instance,
+	struct liblttd_channel_info **channels)
+{
+	volatile struct channel_trace_fd *pairs = &instance->fd_pairs;
+	struct liblttd_channel_info *info = NULL, *tmp;
+	struct fd_pair *pair;
+	unsigned long seq;
+	int i, num, max, max_info = 0;
+
+	if (!instance || !channels)
+		return -EINVAL;
+
+	/*
+	 * Copy fd_pairs again until it did not change meanwhile. The array is
+	 * not freed while the instance runs, and at least max_pairs long.
+	 */
+	for (;;) {
+		seq = *(volatile unsigned long *)&instance->fd_pairs_seq;
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		__sync_synchronize();
+		max = pairs->max_pairs;
+		__sync_synchronize();
+		pair = pairs->pair;
+		num = pairs->num_pairs;
+		if (num > max)
+			num = max;
+		if (num > max_info || !info) {
+			tmp = realloc(info, (num ? num : 1)
+				* sizeof(struct liblttd_channel_info));
+			if (!tmp) {
+				free(info);
+				return -ENOMEM;
+			}
+			info = tmp;
+			max_info = num;
+		}
+		for (i = 0; i < num; i++) {
+			info[i].path = pair[i].path;
+			info[i].n_sb = pair[i].n_sb;
+			info[i].max_sb_size = pair[i].max_sb_size;
+			info[i].stats = pair[i].stats;
+		}
+		__sync_synchronize();
+		if (seq == *(volatile unsigned long *)&instance->fd_pairs_seq)
+			break;
+	}
+
+	*channels = info;
+	return num;
+}
+
+void liblttd_account_syscalls(unsigned int n)
+{
+	account_syscalls(LIBLTTD_PHASE_CALLBACK, n);
+}
+
+int liblttd_splice_retry(int fd, short events, int *retries)
+{
+	struct pollfd pollfd;
+
+	if (errno == EINTR)
+		return 1;
+	if (errno != EAGAIN || (*retries)++ >= LIBLTTD_SPLICE_RETRIES)
+		return 0;
+	pollfd.fd = fd;
+	pollfd.events = events;
+	poll(&pollfd, 1, LIBLTTD_SPLICE_WAIT);
+	account_syscalls(LIBLTTD_PHASE_CALLBACK, 1);
+	/* poll must not change the errno of the splice */
+	errno = EAGAIN;
+	return 1;
+}
+
+int liblttd_set_log(struct liblttd_instance *instance, int fd)
+{
+	if (!instance)
+		return -EINVAL;
+	instance->log_fd = fd;
+	return 0;
+}
@@ -28,6 +28,45 @@
 #include <pthread.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Buckets of the fill level histogram, of 10% each */
+#define LIBLTTD_FILL_BUCKETS		10
+/* Buckets of the interval histogram, in powers of 2 of milliseconds */
+#define LIBLTTD_INTERVAL_BUCKETS	16
+
+/**
+ * struct liblttd_channel_stats - Counters of a channel, updated by liblttd.
+ * @subbufs: number of sub-buffers handed to on_read_subbuffer successfully
+ * @bytes:   number of bytes handed to on_read_subbuffer successfully
+ * @lost:    number of sub-buffers corrupted because the reader has been pushed
+ *           by the writer
+ * @failed:  number of sub-buffers released without being read, because their
+ *           size could not be read or on_read_subbuffer failed
+ * @urgent:  number of sub-buffers read while the channel was almost full
+ * @fill:    sub-buffers read by fill level, len / max_sb_size, bucket i from
+ *           10 * i % to 10 * (i + 1) %. Full sub-buffers are in the last one.
+ * @interval: sub-buffers read by time since the previous one of the channel,
+ *           bucket 0 below 1 ms, bucket i from 2^(i-1) to 2^i ms, the last
+ *           one above. The first sub-buffer read is not counted.
+ * @last_read: CLOCK_MONOTONIC time of the last sub-buffer read, in ns
+ */
+struct liblttd_channel_stats {
+	unsigned long long subbufs;
+	unsigned long long bytes;
+	unsigned long long lost;
+	unsigned long long failed;
+	unsigned long long urgent;
+	unsigned long long fill[LIBLTTD_FILL_BUCKETS];
+	unsigned long long interval[LIBLTTD_INTERVAL_BUCKETS];
+	unsigned long long last_read;
+};
+
+struct liblttd_completion;
 
 /**
  * struct fd_pair - Contains the data associated with the channel file
@@ -41,6 +80,18 @@
  * @mutex: a mutex for internal library usage
  * @user_data: library user data
  * @offset: write position in the output file descriptor (optional)
+ * @path: path of the channel file, relative to the root folder of the trace
+ *        channels
+ * @stats: counters of the channel
+ * @deleted: the channel file has been removed, the channel is closed once it
+ *           has hung up
+ * @completion: the sub-buffer given to an asynchronous on_read_subbuffer, for
+ *              internal library usage
+ * @replaced: set when on_open_channel is called for a channel whose path had
+ *            an earlier channel, like on CPU hot-plug : its output is appended
+ *            to the output of the earlier one
+ * @waiting: the channel replaces a deleted channel which is still read, it is
+ *           opened once that one is closed, for internal library usage
  */
 struct fd_pair {
 	int channel;
@@ -50,47 +101,203 @@ struct fd_pair {
 	pthread_mutex_t	mutex;
 	void *user_data;
 	off_t offset;
+	char *path;
+	struct liblttd_channel_stats stats;
+	int deleted;
+	struct liblttd_completion *completion;
+	int replaced;
+	int waiting;
+};
+
+/**
+ * struct liblttd_channel_info - Copy of the state of a channel, made by
+ * liblttd_get_channel_stats.
+ * @path:        path of the channel file, relative to the root folder of the
+ *               trace channels. It is valid until the instance is deleted.
+ * @n_sb:        the number of subbuffer for this channel
+ * @max_sb_size: the subbuffer size for this channel
+ * @stats:       counters of the channel
+ */
+struct liblttd_channel_info {
+	const char *path;
+	unsigned int n_sb;
+	unsigned int max_sb_size;
+	struct liblttd_channel_stats stats;
 };
 
+/**
+ * struct channel_trace_fd - An array of fd_pair.
+ * @pair: the pairs
+ * @num_pairs: number of pairs used
+ * @max_pairs: number of pairs allocated
+ */
 struct channel_trace_fd {
 	struct fd_pair *pair;
 	int num_pairs;
+	int max_pairs;
 };
 
+/**
+ * struct inotify_watch - A watched folder of the trace channels.
+ * @wd: inotify watch descriptor
+ * @path: path of the folder, relative to the root folder of the trace
+ *        channels
+ * @next: next watch of the same hash bucket
+ */
 struct inotify_watch {
 	int wd;
-	char path_channel[PATH_MAX];
-	char *base_path_channel;
+	char *path;
+	struct inotify_watch *next;
+};
+
+/* The watches, hashed by watch descriptor in size buckets */
+struct inotify_watch_table {
+	struct inotify_watch **buckets;
+	unsigned int size;
+	unsigned int num;
+};
+
+struct liblttd_path;
+
+/* The interned relative paths, hashed in size buckets */
+struct liblttd_path_store {
+	struct liblttd_path **buckets;
+	unsigned int size;
+	unsigned int num;
+};
+
+/**
+ * struct liblttd_stats - Counters of a tracing session, updated by liblttd.
+ * @subbufs: number of sub-buffers handed to on_read_subbuffer successfully
+ * @bytes:   number of bytes handed to on_read_subbuffer successfully
+ * @lost:    number of sub-buffers corrupted because the reader has been pushed
+ *           by the writer
+ * @failed:  number of sub-buffers released without being read
+ * @start:   CLOCK_MONOTONIC time at which the channels were open
+ * @end:     CLOCK_MONOTONIC time at which every thread was done reading
+ * @cpu_time: CPU time of every thread of the instance, readers, discovery and
+ *           log flusher, in nanoseconds. It is complete when on_trace_end is
+ *           called.
+ */
+struct liblttd_stats {
+	unsigned long long subbufs;
+	unsigned long long bytes;
+	unsigned long long lost;
+	unsigned long long failed;
+	struct timespec start;
+	struct timespec end;
+	unsigned long long cpu_time;
+};
+
+/**
+ * enum liblttd_phase - Phases of the read of a sub-buffer, in which the
+ * system calls of a reader thread are accounted.
+ * @LIBLTTD_PHASE_POLL:     waiting for data, and for new channels
+ * @LIBLTTD_PHASE_RESERVE:  getting the sub-buffer and its size
+ * @LIBLTTD_PHASE_CALLBACK: on_read_subbuffer, as told by
+ *                          liblttd_account_syscalls
+ * @LIBLTTD_PHASE_RELEASE:  putting the sub-buffer back
+ */
+enum liblttd_phase {
+	LIBLTTD_PHASE_POLL,
+	LIBLTTD_PHASE_RESERVE,
+	LIBLTTD_PHASE_CALLBACK,
+	LIBLTTD_PHASE_RELEASE,
+	LIBLTTD_NR_PHASES,
 };
 
-struct inotify_watch_array {
-	struct inotify_watch *elem;
-	int num;
+/**
+ * struct liblttd_thread_stats - Counters of a reader thread, updated by
+ * liblttd. The contention counters are only updated in the default read mode.
+ * @polls:          number of poll calls which returned
+ * @reads:          number of sub-buffers the thread tried to read
+ * @trylocks:       number of attempts to take the mutex of a ready channel
+ * @trylock_failed: number of those attempts which found the channel taken by
+ *                  another thread
+ * @rwlock_wait:    nanoseconds spent waiting for fd_pairs_lock
+ * @rwlock_max:     longest wait for fd_pairs_lock, in nanoseconds
+ * @subbufs:        number of sub-buffers the thread read successfully
+ * @syscalls:       number of system calls the thread made, by enum
+ *                  liblttd_phase
+ * @cpu_time:       CPU time of the thread, in nanoseconds
+ */
+struct liblttd_thread_stats {
+	unsigned long long polls;
+	unsigned long long reads;
+	unsigned long long trylocks;
+	unsigned long long trylock_failed;
+	unsigned long long rwlock_wait;
+	unsigned long long rwlock_max;
+	unsigned long long subbufs;
+	unsigned long long syscalls[LIBLTTD_NR_PHASES];
+	unsigned long long cpu_time;
 };
 
 struct liblttd_callbacks;
+struct liblttd_callbacks_v2;
+struct liblttd_log;
 
 /**
  * struct liblttd_instance - Contains the data associated with a trace instance.
  * The lib user can read but MUST NOT change any attributes but callbacks.
  * @callbacks: Contains the necessary callbacks for a tracing session.
+ * @stats: Counters of the session, complete when on_trace_end is called.
+ * @thread_stats: Counters of each of the num_threads threads, complete when
+ *                on_trace_end is called.
+ * @log: The self-log of the threads while the instance runs, see liblttdlog.h.
  */
 struct liblttd_instance {
 	struct liblttd_callbacks *callbacks;
 
 	int inotify_fd;
 	struct channel_trace_fd fd_pairs;
-	struct inotify_watch_array inotify_watch_array;
+	struct inotify_watch_table inotify_watches;
+	struct liblttd_path_store paths;
 
-	/* protects fd_pairs and inotify_watch_array */
+	/*
+	 * protects fd_pairs, which only the discovery thread changes.
+	 * inotify_watches and paths are only used by the discovery thread.
+	 */
 	pthread_rwlock_t fd_pairs_lock;
+	/*
+	 * odd while fd_pairs is changed, for liblttd_get_channel_stats which
+	 * reads it without fd_pairs_lock
+	 */
+	unsigned long fd_pairs_seq;
+	/* arrays of fd_pairs replaced by a larger one, freed with the instance */
+	struct liblttd_retired_pairs *retired_pairs;
+	/* incremented when channels are added to or removed from fd_pairs */
+	unsigned long fd_pairs_gen;
+	/* wake the discovery thread up to quit */
+	int control_pipe[2];
+	/* wake each reader thread up when fd_pairs changes, 2 fds per thread */
+	int *wake_pipes;
 
-	char channel_name[PATH_MAX];
+	char *channel_name;
+	int channel_dirfd;
 	unsigned long num_threads;
 	int quit_program;
 	int dump_flight_only;
 	int dump_normal_only;
 	int verbose_mode;
+	int drain_mode;
+	int drain_next;
+	int dump_mode;
+	int single_reader;
+	int log_fd;
+	struct liblttd_stats stats;
+	struct liblttd_thread_stats *thread_stats;
+	/* the reader threads, while the instance runs */
+	pthread_t *tids;
+	struct liblttd_log *log;
+
+	const struct liblttd_callbacks_v2 *callbacks_v2;
+	/* sub-buffers given to callbacks_v2 and not completed yet */
+	unsigned long inflight;
+	/* incremented when a channel waits for, or gets, its completion */
+	unsigned long inflight_gen;
+	pthread_mutex_t inflight_lock;
+	pthread_cond_t inflight_cond;
 };
 
 /**
@@ -215,6 +422,40 @@ struct liblttd_callbacks {
 	void *user_data;
 };
 
+/**
+ * struct liblttd_callbacks_v2 - Callbacks added after struct liblttd_callbacks,
+ * set with liblttd_set_callbacks_v2. The v1 callbacks are still called, except
+ * on_read_subbuffer when it is replaced here.
+ */
+struct liblttd_callbacks_v2 {
+	/**
+	 * on_read_subbuffer - Is called after a subbuffer is reserved, in place
+	 * of the on_read_subbuffer of struct liblttd_callbacks.
+	 *
+	 * @data: pointer to the callbacks structure that has been passed to the
+	 *        library.
+	 * @pair: structure that contains the data associated with the channel
+	 *        file descriptor.
+	 * @len:  represents the length the data that has to be read.
+	 * @completion:
+	 *        token of the sub-buffer, to pass to liblttd_complete.
+	 *
+	 * Returns 0 if the callback takes the sub-buffer, else not 0 and the
+	 * sub-buffer is released as failed.
+	 *
+	 * A sub-buffer taken stays reserved until liblttd_complete is called,
+	 * once, with its token : from the callback itself, or later from any
+	 * thread. The reader thread reads the other channels meanwhile. The
+	 * channel is not read again before it is completed, and pair stays
+	 * valid until then.
+	 *
+	 * It has to be thread safe, because it is called by many threads.
+	 */
+	int (*on_read_subbuffer)(struct liblttd_callbacks *data,
+				struct fd_pair *pair, unsigned int len,
+				struct liblttd_completion *completion);
+};
+
 /**
  * liblttd_new_instance - Is called to create a new tracing session.
  *
@@ -238,6 +479,184 @@ liblttd_new_instance(struct liblttd_callbacks *callbacks, char *channel_path,
 		     unsigned long n_threads, int flight_only, int normal_only,
 		     int verbose);
 
+/**
+ * liblttd_delete_instance - Is called to free an instance which will not be
+ * started. liblttd_start_instance frees the instance it runs.
+ *
+ * @instance: The tracing session instance, never started.
+ *
+ * Returns 0 if the function succeeds.
+ *
+ * The callbacks of the instance are not freed.
+ */
+int liblttd_delete_instance(struct liblttd_instance *instance);
+
+/**
+ * liblttd_set_drain_mode - Is called to read only the current content of
+ * the channels, which empties them.
+ *
+ * @instance: The tracing session instance, before it is started.
+ * @drain:    If this argument is set to 1, liblttd_start_instance reads the
+ *            sub-buffers which are available in each channel when it gets to
+ *            it, and returns without waiting for the channels to hang up. The
+ *            threads of the instance read different channels in parallel.
+ *
+ * Returns 0 if the function succeeds.
+ *
+ * The trace can keep running during a drain. Combined with flight_only, it
+ * dumps the flight recorder channels without destroying the trace.
+ *
+ * The sub-buffers read are consumed, as in the other modes : the relay ABI
+ * only gives a sub-buffer to read by reserving it, and releasing it moves the
+ * reader past it, so this cannot be a non-destructive snapshot. They are not
+ * in a later drain nor in the dump of the trace, and a drain made shortly
+ * after another one only holds what was written in between.
+ */
+int liblttd_set_drain_mode(struct liblttd_instance *instance, int drain);
+
+/**
+ * liblttd_set_single_reader - Is called to choose the read loop of an instance
+ * which has a single thread.
+ *
+ * @instance: The tracing session instance, before it is started.
+ * @single:   If this argument is set to 1, the thread reads the channels
+ *            without taking any lock, as nothing else reads them. It is the
+ *            default when the instance is created with one thread. If it is
+ *            set to 0, the locked multi-thread loop is used.
+ *
+ * Returns 0 if the function succeeds, -EINVAL if single is set and the
+ * instance has more than one thread.
+ */
+int liblttd_set_single_reader(struct liblttd_instance *instance, int single);
+
+/**
+ * liblttd_set_dump_mode - Is called to dump the channels of a trace which is
+ * being stopped.
+ *
+ * @instance: The tracing session instance, before it is started.
+ * @dump:     If this argument is set to 1, the channels are divided between
+ *            the threads of the instance, each thread reads all the available
+ *            sub-buffers of its channels and returns when all of them have hung
+ *            up. New channels are not looked for.
+ *
+ * Returns 0 if the function succeeds.
+ *
+ * This is meant to empty the flight recorder channels as fast as possible at
+ * trace teardown, with one thread per CPU.
+ */
+int liblttd_set_dump_mode(struct liblttd_instance *instance, int dump);
+
+/**
+ * liblttd_get_stats - Is called to read the counters of a running instance.
+ *
+ * @instance:     The tracing session instance, while liblttd_start_instance
+ *                runs or from on_trace_end.
+ * @stats:        Copy of the counters of the session.
+ * @thread_stats: Copy of the counters of each of the num_threads threads, or
+ *                NULL.
+ *
+ * Returns 0 if the function succeeds.
+ *
+ * The copy is not atomic, the counters keep moving while it is made. The CPU
+ * time of the threads still running is read from their clock, the total of
+ * stats only counts the threads which are done.
+ */
+int liblttd_get_stats(struct liblttd_instance *instance,
+		      struct liblttd_stats *stats,
+		      struct liblttd_thread_stats *thread_stats);
+
+/**
+ * liblttd_get_channel_stats - Is called to read the counters of the channels
+ * of a running instance.
+ *
+ * @instance: The tracing session instance, while liblttd_start_instance runs.
+ *            The channels are closed when on_trace_end is called.
+ * @channels: Set to an array with a copy of each channel, which the caller
+ *            frees.
+ *
+ * Returns the number of channels, or a negative errno.
+ *
+ * The reader threads are not stopped nor slowed down : the counters are
+ * copied while they move, and the copy is made again if channels are added or
+ * removed meanwhile. It must not be called from on_close_channel.
+ */
+int liblttd_get_channel_stats(struct liblttd_instance *instance,
+			      struct liblttd_channel_info **channels);
+
+/**
+ * liblttd_account_syscalls - Is called by on_read_subbuffer to account the
+ * system calls it made to the calling thread.
+ *
+ * @n: number of system calls
+ *
+ * Does nothing outside of the threads of an instance.
+ */
+void liblttd_account_syscalls(unsigned int n);
+
+/**
+ * liblttd_splice_retry - Is called by on_read_subbuffer when a splice of the
+ * sub-buffer failed, to know whether to try it again.
+ *
+ * @fd:      The file descriptor the splice waits for.
+ * @events:  POLLIN or POLLOUT, what the splice waits for on fd.
+ * @retries: The retries of the splice, set to 0 before its first try and after
+ *           each success.
+ *
+ * Returns 1 if the splice has to be tried again, 0 if it failed.
+ *
+ * A splice interrupted is always tried again. One which would block is tried
+ * again once fd is ready, or after LIBLTTD_SPLICE_WAIT ms, at most
+ * LIBLTTD_SPLICE_RETRIES times in a row. Any other error fails.
+ */
+#define LIBLTTD_SPLICE_RETRIES	32
+#define LIBLTTD_SPLICE_WAIT	10
+int liblttd_splice_retry(int fd, short events, int *retries);
+
+/**
+ * liblttd_set_log - Is called to write the self-log of an instance to a file.
+ *
+ * @instance: The tracing session instance, before it is started.
+ * @fd:       File descriptor the binary log is written to, or -1. The caller
+ *            closes it after liblttd_start_instance returns.
+ *
+ * Returns 0 if the function succeeds.
+ *
+ * The threads record what they do in the log without taking any lock, so it
+ * can stay on at full rate. lttd-logdump prints the file. Without a log file,
+ * verbose mode prints the same records as text from a background thread.
+ */
+int liblttd_set_log(struct liblttd_instance *instance, int fd);
+
+/**
+ * liblttd_set_callbacks_v2 - Is called to add the callbacks of struct
+ * liblttd_callbacks_v2 to an instance.
+ *
+ * @instance:     The tracing session instance, before it is started.
+ * @callbacks_v2: The callbacks, which must stay valid while the instance runs,
+ *                or NULL to only use the callbacks of liblttd_new_instance.
+ *
+ * Returns 0 if the function succeeds.
+ *
+ * An asynchronous on_read_subbuffer makes the instance use the locked
+ * multi-thread loop, even with a single thread. In drain and dump modes,
+ * the reader thread waits for each completion before reading on.
+ */
+int liblttd_set_callbacks_v2(struct liblttd_instance *instance,
+			     const struct liblttd_callbacks_v2 *callbacks_v2);
+
+/**
+ * liblttd_complete - Is called when the sub-buffer given to an asynchronous
+ * on_read_subbuffer has been consumed.
+ *
+ * @completion: token given to on_read_subbuffer
+ * @error:      0 if the sub-buffer was consumed, else not 0 and it is
+ *              counted as failed.
+ *
+ * Releases the sub-buffer to the kernel and lets its channel be read again.
+ * It can be called from any thread, but not from on_close_channel.
+ */
+void liblttd_complete(struct liblttd_completion *completion, int error);
+
 /**
  * liblttd_start - Is called to start a new tracing session.
  *
@@ -265,4 +684,8 @@ int liblttd_start_instance(struct liblttd_instance *instance);
  */
 int liblttd_stop_instance(struct liblttd_instance *instance);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /*_LIBLTTD_H */
@@ -0,0 +1,608 @@
+/*
+ * liblttd C++ header file
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LIBLTTD_HPP
+#define _LIBLTTD_HPP
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+
+#include "liblttd.h"
+#include "liblttdcrc.h"
+
+/*
+ * Compile-time sinks
+ *
+ * A pipeline is a struct liblttd_callbacks whose sinks are template
+ * parameters. Every sub-buffer is read once into memory and given to each sink
+ * in turn : the calls are resolved at compile time and inlined into the
+ * on_read_subbuffer of the pipeline, the only indirect call left per
+ * sub-buffer is the one liblttd makes. The callbacks are given to
+ * liblttd_new_instance, the rest of the C API is used as is.
+ *
+ * A sink is a class with a channel type, its state for each channel, and the
+ * members below. It derives from liblttd::sink for the ones it does not need.
+ * They return 0 on success, else not 0 as the callbacks of liblttd, and are
+ * called by the reader threads : a channel is used by one thread at a time,
+ * what the sink shares between channels has to be thread safe.
+ *
+ *   int folder(const char *path);
+ *	A folder of channels, "" for the root one, else starting with a '/'.
+ *   int open(channel &c, struct fd_pair *pair, const char *path);
+ *   int consume(channel &c, struct fd_pair *pair, const char *data,
+ *		 size_t len);
+ *	A sub-buffer of the channel.
+ *   void close(channel &c, struct fd_pair *pair);
+ *   void end(struct liblttd_instance *instance);
+ *	The trace is over, from on_trace_end.
+ *
+ * The sinks are copied into the pipeline, before the instance is started.
+ * There is no compression sink : the tree depends on no compression library.
+ * A sink can compress what it consumes and write it itself.
+ */
+
+namespace liblttd {
+
+/* The defaults of a sink, which does nothing */
+struct sink {
+	struct channel {};
+
+	int folder(const char *path) { return 0; }
+	template <class C>
+	int open(C &c, struct fd_pair *pair, const char *path) { return 0; }
+	template <class C>
+	int consume(C &c, struct fd_pair *pair, const char *data, size_t len)
+	{
+		return 0;
+	}
+	template <class C>
+	void close(C &c, struct fd_pair *pair) {}
+	void end(struct liblttd_instance *instance) {}
+};
+
+/*
+ * The sub-buffers are spliced from the channel to a pipe of the reader thread,
+ * then read into its buffer.
+ */
+struct reader_thread {
+	int pipe[2];
+	char *buf;
+	size_t size;
+};
+
+inline reader_thread &current_reader()
+{
+	static thread_local reader_thread thread = { { -1, -1 }, NULL, 0 };
+	return thread;
+}
+
+/*
+ * Read the reserved sub-buffer of pair, of len bytes. data is set to it, until
+ * the next call from the thread.
+ */
+inline int read_subbuffer(struct fd_pair *pair, unsigned int len,
+			  const char **data)
+{
+	reader_thread &thread = current_reader();
+	loff_t offset = 0;
+	size_t done = 0;
+	int retries = 0;
+	ssize_t ret;
+	char *buf;
+
+	if (thread.pipe[0] == -1 && pipe(thread.pipe) == -1) {
+		perror("Error creating the reader pipe");
+		return -1;
+	}
+	if (thread.size < len) {
+		buf = static_cast<char *>(realloc(thread.buf, len));
+		if (!buf) {
+			perror("Error allocating the sub-buffer");
+			return -1;
+		}
+		thread.buf = buf;
+		thread.size = len;
+	}
+
+	while (done < len) {
+		ret = splice(pair->channel, &offset, thread.pipe[1], NULL,
+			     len - done, SPLICE_F_MOVE | SPLICE_F_MORE);
+		liblttd_account_syscalls(1);
+		/* The pipe has no room */
+		if (ret < 0
+		    && liblttd_splice_retry(thread.pipe[1], POLLOUT, &retries))
+			continue;
+		if (ret <= 0) {
+			if (!ret)
+				errno = EIO;	/* sub-buffer shorter than len */
+			perror("Error in relay splice");
+			return -1;
+		}
+		while (ret > 0) {
+			ssize_t n = read(thread.pipe[0], thread.buf + done, ret);
+
+			liblttd_account_syscalls(1);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				perror("Error reading the reader pipe");
+				return -1;
+			}
+			done += n;
+			ret -= n;
+		}
+		retries = 0;
+	}
+	*data = thread.buf;
+	return 0;
+}
+
+inline void close_reader()
+{
+	reader_thread &thread = current_reader();
+
+	if (thread.pipe[0] != -1) {
+		::close(thread.pipe[0]);
+		::close(thread.pipe[1]);
+		thread.pipe[0] = thread.pipe[1] = -1;
+	}
+	free(thread.buf);
+	thread.buf = NULL;
+	thread.size = 0;
+}
+
+/*
+ * The sinks, called in order. The next sink is not called for a sub-buffer
+ * once one has failed.
+ */
+template <class... Sinks>
+class chain;
+
+template <>
+class chain<> {
+public:
+	struct channel {};
+
+	int folder(const char *path) { return 0; }
+	int open(channel &c, struct fd_pair *pair, const char *path)
+	{
+		return 0;
+	}
+	int consume(channel &c, struct fd_pair *pair, const char *data,
+		    size_t len)
+	{
+		return 0;
+	}
+	void close(channel &c, struct fd_pair *pair) {}
+	void end(struct liblttd_instance *instance) {}
+};
+
+template <class Head, class... Tail>
+class chain<Head, Tail...> {
+public:
+	struct channel {
+		typename Head::channel head;
+		typename chain<Tail...>::channel tail;
+	};
+
+	Head head;
+	chain<Tail...> tail;
+
+	chain(const Head &h, const Tail &... t) : head(h), tail(t...) {}
+
+	int folder(const char *path)
+	{
+		int ret = head.folder(path);
+
+		return ret ? ret : tail.folder(path);
+	}
+	int open(channel &c, struct fd_pair *pair, const char *path)
+	{
+		int ret = head.open(c.head, pair, path);
+
+		if (ret)
+			return ret;
+		ret = tail.open(c.tail, pair, path);
+		if (ret)
+			head.close(c.head, pair);
+		return ret;
+	}
+	int consume(channel &c, struct fd_pair *pair, const char *data,
+		    size_t len)
+	{
+		int ret = head.consume(c.head, pair, data, len);
+
+		return ret ? ret : tail.consume(c.tail, pair, data, len);
+	}
+	void close(channel &c, struct fd_pair *pair)
+	{
+		tail.close(c.tail, pair);
+		head.close(c.head, pair);
+	}
+	void end(struct liblttd_instance *instance)
+	{
+		tail.end(instance);
+		head.end(instance);
+	}
+};
+
+/*
+ * The callbacks of the sinks. callbacks() is given to liblttd_new_instance,
+ * the pipeline must outlive the instance.
+ */
+template <class... Sinks>
+class pipeline {
+public:
+	typedef chain<Sinks...> sinks_type;
+
+	sinks_type sinks;
+
+	pipeline(const Sinks &... s) : sinks(s...)
+	{
+		memset(&cb, 0, sizeof(cb));
+		cb.on_open_channel = on_open_channel;
+		cb.on_close_channel = on_close_channel;
+		cb.on_new_channels_folder = on_new_channels_folder;
+		cb.on_read_subbuffer = on_read_subbuffer;
+		cb.on_trace_end = on_trace_end;
+		cb.on_close_thread = on_close_thread;
+		cb.user_data = this;
+	}
+
+	struct liblttd_callbacks *callbacks() { return &cb; }
+
+private:
+	typedef typename sinks_type::channel channel;
+
+	struct liblttd_callbacks cb;
+
+	pipeline(const pipeline &);
+	pipeline &operator=(const pipeline &);
+
+	static pipeline *from(struct liblttd_callbacks *data)
+	{
+		return static_cast<pipeline *>(data->user_data);
+	}
+
+	static int on_open_channel(struct liblttd_callbacks *data,
+				   struct fd_pair *pair, char *path)
+	{
+		channel *c = new (std::nothrow) channel();
+
+		if (!c)
+			return -1;
+		if (from(data)->sinks.open(*c, pair, path)) {
+			delete c;
+			return -1;
+		}
+		pair->user_data = c;
+		return 0;
+	}
+
+	static int on_close_channel(struct liblttd_callbacks *data,
+				    struct fd_pair *pair)
+	{
+		channel *c = static_cast<channel *>(pair->user_data);
+
+		from(data)->sinks.close(*c, pair);
+		delete c;
+		return 0;
+	}
+
+	static int on_new_channels_folder(struct liblttd_callbacks *data,
+					  char *path)
+	{
+		return from(data)->sinks.folder(path);
+	}
+
+	static int on_read_subbuffer(struct liblttd_callbacks *data,
+				     struct fd_pair *pair, unsigned int len)
+	{
+		const char *buf;
+
+		if (read_subbuffer(pair, len, &buf))
+			return -1;
+		return from(data)->sinks.consume(
+			*static_cast<channel *>(pair->user_data), pair, buf,
+			len);
+	}
+
+	static int on_close_thread(struct liblttd_callbacks *data,
+				   unsigned long thread_num)
+	{
+		close_reader();
+		return 0;
+	}
+
+	static int on_trace_end(struct liblttd_instance *instance)
+	{
+		from(instance->callbacks)->sinks.end(instance);
+		return 0;
+	}
+};
+
+/*
+ * The folder of a trace, created as liblttdvfs does. Files are created in it
+ * with the path of their channel.
+ */
+class trace_folder : public sink {
+public:
+	explicit trace_folder(const char *trace_name)
+		: name(trace_name), dirfd(-1) {}
+	trace_folder(const trace_folder &f) : name(f.name), dirfd(-1) {}
+
+	int folder(const char *path)
+	{
+		int ret;
+
+		if (*path)
+			ret = mkdirat(dirfd, path + 1,
+				      S_IRWXU|S_IRWXG|S_IRWXO);
+		else
+			ret = mkdir(name.c_str(), S_IRWXU|S_IRWXG|S_IRWXO);
+		if (ret == -1 && errno != EEXIST) {
+			perror(*path ? path : name.c_str());
+			return -1;
+		}
+		if (!*path && dirfd == -1) {
+			dirfd = ::open(name.c_str(), O_RDONLY | O_DIRECTORY);
+			if (dirfd == -1) {
+				perror(name.c_str());
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	void end(struct liblttd_instance *instance)
+	{
+		if (dirfd != -1)
+			::close(dirfd);
+		dirfd = -1;
+	}
+
+protected:
+	/*
+	 * Create the file of the channel path, with suffix appended. The file
+	 * of the channel pair replaces is appended to.
+	 */
+	int create(struct fd_pair *pair, const char *path, const char *suffix)
+	{
+		std::string file = std::string(path + 1) + suffix;
+		int fd;
+
+		fd = openat(dirfd, file.c_str(), O_WRONLY|O_CREAT
+			    | (pair->replaced ? O_APPEND : O_EXCL),
+			    S_IRWXU|S_IRWXG|S_IRWXO);
+		if (fd == -1)
+			perror(file.c_str());
+		return fd;
+	}
+
+	/* The size of the trace file of the channel path */
+	off_t trace_size(const char *path)
+	{
+		struct stat stat_buf;
+
+		if (fstatat(dirfd, path + 1, &stat_buf, 0))
+			return 0;
+		return stat_buf.st_size;
+	}
+
+	static int write_all(int fd, const void *data, size_t len)
+	{
+		const char *p = static_cast<const char *>(data);
+		ssize_t ret;
+
+		while (len > 0) {
+			ret = write(fd, p, len);
+			liblttd_account_syscalls(1);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0) {
+				if (!ret)
+					errno = ENOSPC;
+				return -1;
+			}
+			p += ret;
+			len -= ret;
+		}
+		return 0;
+	}
+
+private:
+	std::string name;
+	int dirfd;
+};
+
+/* The trace files, as liblttdvfs writes them */
+class file_sink : public trace_folder {
+public:
+	struct channel {
+		int fd;
+	};
+
+	explicit file_sink(const char *trace_name) : trace_folder(trace_name) {}
+
+	int open(channel &c, struct fd_pair *pair, const char *path)
+	{
+		c.fd = create(pair, path, "");
+		return c.fd == -1 ? -1 : 0;
+	}
+	int consume(channel &c, struct fd_pair *pair, const char *data,
+		    size_t len)
+	{
+		if (write_all(c.fd, data, len)) {
+			perror("Error writing the trace file");
+			return -1;
+		}
+		return 0;
+	}
+	void close(channel &c, struct fd_pair *pair)
+	{
+		::close(c.fd);
+	}
+};
+
+/*
+ * Records written for each sub-buffer to a file next to the trace file, a few
+ * at a time.
+ */
+#define LIBLTTD_RECORD_BATCH	64
+
+template <class Record>
+class record_sink : public trace_folder {
+public:
+	struct channel {
+		int fd;
+		uint64_t offset;
+		unsigned int n;
+		Record record[LIBLTTD_RECORD_BATCH];
+	};
+
+	record_sink(const char *trace_name, const char *suffix)
+		: trace_folder(trace_name), suffix(suffix) {}
+
+	int open(channel &c, struct fd_pair *pair, const char *path)
+	{
+		c.fd = create(pair, path, suffix);
+		c.offset = pair->replaced ? trace_size(path) : 0;
+		c.n = 0;
+		return c.fd == -1 ? -1 : 0;
+	}
+	void close(channel &c, struct fd_pair *pair)
+	{
+		flush(c);
+		::close(c.fd);
+	}
+
+protected:
+	/* The next record, for the sub-buffer at c.offset */
+	Record &next(channel &c)
+	{
+		return c.record[c.n];
+	}
+	int add(channel &c, size_t len)
+	{
+		c.offset += len;
+		if (++c.n < LIBLTTD_RECORD_BATCH)
+			return 0;
+		return flush(c);
+	}
+	int flush(channel &c)
+	{
+		int ret = 0;
+
+		if (c.n && write_all(c.fd, c.record, c.n * sizeof(Record))) {
+			perror(suffix);
+			ret = -1;
+		}
+		c.n = 0;
+		return ret;
+	}
+
+private:
+	const char *suffix;
+};
+
+/**
+ * struct index_record - Sub-buffer of a trace file, in its .idx file.
+ * @offset: position in the trace file
+ * @len:    length
+ */
+struct index_record {
+	uint64_t offset;
+	uint64_t len;
+};
+
+/* Where each sub-buffer is in the trace file, in <channel>.idx */
+class index_sink : public record_sink<index_record> {
+public:
+	explicit index_sink(const char *trace_name)
+		: record_sink<index_record>(trace_name, ".idx") {}
+
+	int consume(channel &c, struct fd_pair *pair, const char *data,
+		    size_t len)
+	{
+		index_record &r = next(c);
+
+		r.offset = c.offset;
+		r.len = len;
+		return add(c, len);
+	}
+};
+
+/*
+ * The CRC32C of each sub-buffer, in <channel>.crc, the sidecar file of
+ * liblttdcrc.h that lttd-verify checks.
+ */
+class checksum_sink : public record_sink<liblttd_crc_record> {
+public:
+	explicit checksum_sink(const char *trace_name)
+		: record_sink<liblttd_crc_record>(trace_name,
+						  LIBLTTD_CRC_SUFFIX) {}
+
+	int open(channel &c, struct fd_pair *pair, const char *path)
+	{
+		struct liblttd_crc_header header;
+
+		if (record_sink<liblttd_crc_record>::open(c, pair, path))
+			return -1;
+		/* Appended to */
+		if (lseek(c.fd, 0, SEEK_END) > 0)
+			return 0;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.magic, LIBLTTD_CRC_MAGIC, sizeof(header.magic));
+		header.version = LIBLTTD_CRC_VERSION;
+		header.record_size = sizeof(liblttd_crc_record);
+		if (write_all(c.fd, &header, sizeof(header))) {
+			perror(LIBLTTD_CRC_SUFFIX);
+			::close(c.fd);
+			return -1;
+		}
+		return 0;
+	}
+	int consume(channel &c, struct fd_pair *pair, const char *data,
+		    size_t len)
+	{
+		liblttd_crc_record &r = next(c);
+
+		r.offset = c.offset;
+		r.len = len;
+		r.crc = liblttd_crc32c(0, data, len);
+		return add(c, len);
+	}
+};
+
+} /* namespace liblttd */
+
+#endif /*_LIBLTTD_HPP */
@@ -0,0 +1,239 @@
+/*
+ * liblttdcrc
+ *
+ * Linux Trace Toolkit library - CRC32C of the sub-buffers
+ *
+ * The CRC32 instruction of SSE 4.2 and ARMv8 takes 8 bytes at a time, but
+ * each one waits for the previous one. Three streams are computed side by
+ * side over blocks of 3 * CRC_STRIDE bytes, then joined : the CRC of the
+ * first stream is shifted over the bytes of the others with a table, which
+ * only depends on CRC_STRIDE. The table fallback reads 8 bytes at a time too,
+ * slicing-by-8.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32	(1 << 7)
+#endif
+#endif
+
+#include "liblttdcrc.h"
+
+/* CRC32C, reflected */
+#define CRC32C_POLY	0x82f63b78
+
+/* Bytes of each of the three streams, a multiple of 8 */
+#define CRC_STRIDE	4096
+
+/* CRC of byte i followed by k null bytes */
+static uint32_t crc32c_table[8][256];
+/* CRC register shifted over CRC_STRIDE, then 2 * CRC_STRIDE null bytes */
+static uint32_t shift_table[2][4][256];
+
+/* The functions work on the register, not inverted */
+static uint32_t (*crc32c_raw)(uint32_t crc, const unsigned char *p,
+	size_t len);
+static const char *crc32c_name;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_table_raw(uint32_t crc, const unsigned char *p,
+	size_t len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t v;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, 8);
+		v ^= crc;
+		crc = crc32c_table[7][v & 0xff]
+			^ crc32c_table[6][(v >> 8) & 0xff]
+			^ crc32c_table[5][(v >> 16) & 0xff]
+			^ crc32c_table[4][(v >> 24) & 0xff]
+			^ crc32c_table[3][(v >> 32) & 0xff]
+			^ crc32c_table[2][(v >> 40) & 0xff]
+			^ crc32c_table[1][(v >> 48) & 0xff]
+			^ crc32c_table[0][v >> 56];
+	}
+#endif
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static inline uint32_t crc32c_shift(int n, uint32_t crc)
+{
+	return shift_table[n][0][crc & 0xff]
+		^ shift_table[n][1][(crc >> 8) & 0xff]
+		^ shift_table[n][2][(crc >> 16) & 0xff]
+		^ shift_table[n][3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42_raw(uint32_t crc, const unsigned char *p,
+	size_t len)
+{
+	unsigned long long c0 = crc, c1, c2;
+	const unsigned long long *q;
+	size_t i;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		c0 = __builtin_ia32_crc32qi(c0, *p++);
+	for (; len >= 3 * CRC_STRIDE; len -= 3 * CRC_STRIDE) {
+		q = (const unsigned long long *)p;
+		c1 = c2 = 0;
+		for (i = 0; i < CRC_STRIDE / 8; i++) {
+			c0 = __builtin_ia32_crc32di(c0, q[i]);
+			c1 = __builtin_ia32_crc32di(c1, q[i + CRC_STRIDE / 8]);
+			c2 = __builtin_ia32_crc32di(c2,
+				q[i + 2 * CRC_STRIDE / 8]);
+		}
+		c0 = crc32c_shift(1, c0) ^ crc32c_shift(0, c1) ^ c2;
+		p += 3 * CRC_STRIDE;
+	}
+	for (; len >= 8; len -= 8, p += 8)
+		c0 = __builtin_ia32_crc32di(c0,
+			*(const unsigned long long *)p);
+	while (len--)
+		c0 = __builtin_ia32_crc32qi(c0, *p++);
+	return c0;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("+crc")
+#include <arm_acle.h>
+
+static uint32_t crc32c_armv8_raw(uint32_t crc, const unsigned char *p,
+	size_t len)
+{
+	uint32_t c0 = crc, c1, c2;
+	const uint64_t *q;
+	size_t i;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		c0 = __crc32cb(c0, *p++);
+	for (; len >= 3 * CRC_STRIDE; len -= 3 * CRC_STRIDE) {
+		q = (const uint64_t *)p;
+		c1 = c2 = 0;
+		for (i = 0; i < CRC_STRIDE / 8; i++) {
+			c0 = __crc32cd(c0, q[i]);
+			c1 = __crc32cd(c1, q[i + CRC_STRIDE / 8]);
+			c2 = __crc32cd(c2, q[i + 2 * CRC_STRIDE / 8]);
+		}
+		c0 = crc32c_shift(1, c0) ^ crc32c_shift(0, c1) ^ c2;
+		p += 3 * CRC_STRIDE;
+	}
+	for (; len >= 8; len -= 8, p += 8)
+		c0 = __crc32cd(c0, *(const uint64_t *)p);
+	while (len--)
+		c0 = __crc32cb(c0, *p++);
+	return c0;
+}
+#pragma GCC pop_options
+#define HAVE_CRC32C_ARMV8
+#endif
+
+/*
+ * The shift over null bytes is linear : it is the XOR of the shifts of the
+ * bits of the register.
+ */
+static void build_shift_table(uint32_t table[4][256], const uint32_t *bits)
+{
+	unsigned int byte, v, bit;
+
+	for (byte = 0; byte < 4; byte++) {
+		for (v = 0; v < 256; v++) {
+			table[byte][v] = 0;
+			for (bit = 0; bit < 8; bit++)
+				if (v & (1 << bit))
+					table[byte][v] ^= bits[8 * byte + bit];
+		}
+	}
+}
+
+static void crc32c_init(void)
+{
+	uint32_t bits[32];
+	uint32_t c;
+	unsigned int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_table[0][i] = c;
+	}
+	for (k = 1; k < 8; k++)
+		for (i = 0; i < 256; i++) {
+			c = crc32c_table[k - 1][i];
+			crc32c_table[k][i] = crc32c_table[0][c & 0xff] ^ (c >> 8);
+		}
+
+	for (i = 0; i < 32; i++) {
+		c = 1U << i;
+		for (k = 0; k < CRC_STRIDE; k++)
+			c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+		bits[i] = c;
+	}
+	build_shift_table(shift_table[0], bits);
+	for (i = 0; i < 32; i++)
+		bits[i] = crc32c_shift(0, bits[i]);
+	build_shift_table(shift_table[1], bits);
+
+	crc32c_raw = crc32c_table_raw;
+	crc32c_name = "table";
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_raw = crc32c_sse42_raw;
+		crc32c_name = "sse4.2";
+	}
+#elif defined(HAVE_CRC32C_ARMV8)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc32c_raw = crc32c_armv8_raw;
+		crc32c_name = "armv8";
+	}
+#endif
+}
+
+uint32_t liblttd_crc32c(uint32_t crc, const void *data, size_t len)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+	return ~crc32c_raw(~crc, data, len);
+}
+
+const char *liblttd_crc32c_impl(void)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_name;
+}
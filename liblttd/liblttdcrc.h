@@ -0,0 +1,97 @@
+/*
+ * liblttdcrc header file
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LIBLTTDCRC_H
+#define _LIBLTTDCRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sub-buffer checksums
+ *
+ * The CRC32C of each sub-buffer written to a trace file is kept in a sidecar
+ * file, the trace file name followed by LIBLTTD_CRC_SUFFIX. It is a struct
+ * liblttd_crc_header followed by a record for each sub-buffer, in the order
+ * they were written, in the byte order of the machine which wrote it.
+ * lttd-verify checks a trace against them.
+ *
+ * A record is written once its sub-buffer is in the trace file : after a
+ * crash, the end of the trace file may have no record.
+ */
+
+#define LIBLTTD_CRC_MAGIC	"LTTDCRC"
+#define LIBLTTD_CRC_VERSION	1
+#define LIBLTTD_CRC_SUFFIX	".crc"
+
+/**
+ * struct liblttd_crc_header - Start of a sidecar file.
+ * @magic:       LIBLTTD_CRC_MAGIC
+ * @version:     LIBLTTD_CRC_VERSION
+ * @record_size: size of struct liblttd_crc_record
+ */
+struct liblttd_crc_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+/**
+ * struct liblttd_crc_record - Checksum of a sub-buffer.
+ * @offset: position of the sub-buffer in the trace file
+ * @len:    length of the sub-buffer
+ * @crc:    CRC32C of the sub-buffer
+ */
+struct liblttd_crc_record {
+	uint64_t offset;
+	uint32_t len;
+	uint32_t crc;
+};
+
+/**
+ * liblttd_crc32c - Is called to compute a CRC32C (Castagnoli).
+ *
+ * @crc:  0, or the CRC32C of the data before, to continue it
+ * @data: the data
+ * @len:  length of data
+ *
+ * Returns the CRC32C.
+ *
+ * It uses the CRC32 instructions of SSE 4.2 or ARMv8 when the CPU has them, a
+ * table otherwise.
+ */
+uint32_t liblttd_crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * liblttd_crc32c_impl - Is called to know how liblttd_crc32c computes.
+ *
+ * Returns "sse4.2", "armv8" or "table".
+ */
+const char *liblttd_crc32c_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_LIBLTTDCRC_H */
@@ -0,0 +1,332 @@
+/*
+ * liblttdlog
+ *
+ * Linux Trace Toolkit library - Binary self-log
+ *
+ * Each logging thread owns a ring of records : it alone moves head, the
+ * flusher alone moves tail. A record is written before head is moved past it,
+ * and read before tail is, so neither side takes a lock. printf from every
+ * reader thread serialized them on the stdio lock.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _REENTRANT
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "liblttd.h"
+#include "liblttdlog.h"
+
+/* The rings are emptied this often, in milliseconds */
+#define LOG_FLUSH_INTERVAL	100
+
+#define LOG_CACHE_LINE		64
+
+struct liblttd_log_ring {
+	/* written by the logging thread */
+	volatile unsigned long head
+		__attribute__((aligned(LOG_CACHE_LINE)));
+	volatile unsigned long dropped;
+	/* written by the flusher */
+	volatile unsigned long tail
+		__attribute__((aligned(LOG_CACHE_LINE)));
+	unsigned long dropped_flushed;
+	unsigned int thread;
+	struct liblttd_log_record record[LIBLTTD_LOG_RING_SIZE]
+		__attribute__((aligned(LOG_CACHE_LINE)));
+};
+
+struct liblttd_log {
+	struct liblttd_log_ring *rings;
+	unsigned long num_rings;
+	int fd;				/* binary log, or -1 for text */
+	int quit_pipe[2];
+	pthread_t flusher;
+	unsigned long long cpu_time;	/* of the flusher, at its end */
+};
+
+static __thread struct liblttd_log_ring *log_ring;
+
+static const char *event_formats[LIBLTTD_LOG_NR_EVENTS] = {
+	[LIBLTTD_LOG_DROPPED] = "%lld records dropped",
+	[LIBLTTD_LOG_POLL] = "poll returned, %lld fds ready",
+	[LIBLTTD_LOG_WAKE] = "wake up fd ready",
+	[LIBLTTD_LOG_WAKE_ERROR] = "error %lld returned in polling wake up fd",
+	[LIBLTTD_LOG_POLL_ERR] = "error returned in polling",
+	[LIBLTTD_LOG_POLL_HUP] = "hung up",
+	[LIBLTTD_LOG_POLL_NVAL] = "fd is not open",
+	[LIBLTTD_LOG_READ_URGENT] = "urgent read",
+	[LIBLTTD_LOG_READ_NORMAL] = "normal read",
+	[LIBLTTD_LOG_GET_SB] = "sub-buffer reserved, cookie %lld",
+	[LIBLTTD_LOG_GET_SB_AGAIN] =
+		"reserving sub buffer failed (normal, due to concurrency)",
+	[LIBLTTD_LOG_PUT_SB] = "sub-buffer released, cookie %lld, error %lld",
+	[LIBLTTD_LOG_SPLICE_IN] = "splice chan to pipe offset %lld ret %lld",
+	[LIBLTTD_LOG_SPLICE_OUT] = "splice pipe to file len %lld ret %lld",
+	[LIBLTTD_LOG_SYNC_WAIT] =
+		"waiting for writeback, offset %lld len %lld",
+};
+
+static uint64_t log_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void liblttd_log_event(unsigned int event, int channel, int64_t arg0,
+		       int64_t arg1)
+{
+	struct liblttd_log_ring *ring = log_ring;
+	struct liblttd_log_record *record;
+	unsigned long head;
+
+	if (!ring)
+		return;
+	head = ring->head;
+	if (head - ring->tail >= LIBLTTD_LOG_RING_SIZE) {
+		ring->dropped++;
+		return;
+	}
+	record = &ring->record[head & (LIBLTTD_LOG_RING_SIZE - 1)];
+	record->timestamp = log_now();
+	record->thread = ring->thread;
+	record->channel = channel;
+	record->event = event;
+	record->arg[0] = arg0;
+	record->arg[1] = arg1;
+	/* The record is complete before the flusher can see it */
+	__sync_synchronize();
+	ring->head = head + 1;
+}
+
+int liblttd_log_format(const struct liblttd_log_record *record, char *buf,
+		       size_t len)
+{
+	char message[128], fd[16] = "";
+
+	if (record->event < LIBLTTD_LOG_NR_EVENTS)
+		snprintf(message, sizeof(message), event_formats[record->event],
+			(long long)record->arg[0], (long long)record->arg[1]);
+	else
+		snprintf(message, sizeof(message), "unknown event %u",
+			record->event);
+	if (record->channel >= 0)
+		snprintf(fd, sizeof(fd), "fd %d ", record->channel);
+
+	return snprintf(buf, len, "%llu.%09llu thread %u %s: %s\n",
+		(unsigned long long)(record->timestamp / 1000000000ULL),
+		(unsigned long long)(record->timestamp % 1000000000ULL),
+		record->thread, fd, message);
+}
+
+static int log_write(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		buf = (const char *)buf + ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static void log_emit(struct liblttd_log *log,
+	const struct liblttd_log_record *record, unsigned long n)
+{
+	char line[256];
+	unsigned long i;
+
+	if (log->fd >= 0) {
+		if (log_write(log->fd, record, n * sizeof(*record)))
+			perror("Error writing the log");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		liblttd_log_format(&record[i], line, sizeof(line));
+		fputs(line, stdout);
+	}
+}
+
+/*
+ * Write out what the rings hold. Returns the number of records written.
+ */
+static unsigned long log_flush(struct liblttd_log *log)
+{
+	struct liblttd_log_ring *ring;
+	struct liblttd_log_record dropped;
+	unsigned long i, head, tail, first, n, total = 0;
+
+	for (i = 0; i < log->num_rings; i++) {
+		ring = &log->rings[i];
+		head = ring->head;
+		/* Read the records after head */
+		__sync_synchronize();
+		for (tail = ring->tail; tail != head; tail += n) {
+			first = tail & (LIBLTTD_LOG_RING_SIZE - 1);
+			n = head - tail;
+			if (n > LIBLTTD_LOG_RING_SIZE - first)
+				n = LIBLTTD_LOG_RING_SIZE - first;
+			log_emit(log, &ring->record[first], n);
+			total += n;
+		}
+		/* Done with the records before the thread reuses them */
+		__sync_synchronize();
+		ring->tail = head;
+
+		n = ring->dropped;
+		if (n != ring->dropped_flushed) {
+			memset(&dropped, 0, sizeof(dropped));
+			dropped.timestamp = log_now();
+			dropped.thread = ring->thread;
+			dropped.channel = -1;
+			dropped.event = LIBLTTD_LOG_DROPPED;
+			dropped.arg[0] = n - ring->dropped_flushed;
+			log_emit(log, &dropped, 1);
+			ring->dropped_flushed = n;
+		}
+	}
+	if (total && log->fd < 0)
+		fflush(stdout);
+	return total;
+}
+
+static void *log_flusher(void *arg)
+{
+	struct liblttd_log *log = arg;
+	struct pollfd pollfd;
+	struct timespec ts;
+
+	pollfd.fd = log->quit_pipe[0];
+	pollfd.events = POLLIN;
+	for (;;) {
+		log_flush(log);
+		if (poll(&pollfd, 1, LOG_FLUSH_INTERVAL) > 0)
+			break;
+	}
+	/* The threads are done, get their last records */
+	log_flush(log);
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		log->cpu_time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	return NULL;
+}
+
+int liblttd_log_start(struct liblttd_instance *instance)
+{
+	struct liblttd_log_header header;
+	struct liblttd_log *log;
+	unsigned long i;
+	int ret;
+
+	if (instance->log_fd < 0 && !instance->verbose_mode)
+		return 0;
+
+	log = calloc(1, sizeof(struct liblttd_log));
+	if (!log)
+		return ENOMEM;
+	log->fd = instance->log_fd;
+	/* One ring for each reader, and one for the discovery thread */
+	log->num_rings = instance->num_threads + 1;
+	ret = posix_memalign((void **)&log->rings, LOG_CACHE_LINE,
+		log->num_rings * sizeof(struct liblttd_log_ring));
+	if (ret)
+		goto free_log;
+	memset(log->rings, 0, log->num_rings * sizeof(struct liblttd_log_ring));
+	for (i = 0; i < log->num_rings; i++)
+		log->rings[i].thread = i;
+
+	if (log->fd >= 0) {
+		memset(&header, 0, sizeof(header));
+		strcpy(header.magic, LIBLTTD_LOG_MAGIC);
+		header.version = LIBLTTD_LOG_VERSION;
+		header.record_size = sizeof(struct liblttd_log_record);
+		header.num_threads = instance->num_threads;
+		if (log_write(log->fd, &header, sizeof(header))) {
+			ret = errno;
+			perror("Error writing the log");
+			goto free_rings;
+		}
+	}
+
+	if (pipe(log->quit_pipe) == -1) {
+		ret = errno;
+		goto free_rings;
+	}
+	ret = pthread_create(&log->flusher, NULL, log_flusher, log);
+	if (ret)
+		goto close_pipe;
+	instance->log = log;
+	return 0;
+
+close_pipe:
+	close(log->quit_pipe[0]);
+	close(log->quit_pipe[1]);
+free_rings:
+	free(log->rings);
+free_log:
+	free(log);
+	return ret;
+}
+
+void liblttd_log_stop(struct liblttd_instance *instance)
+{
+	struct liblttd_log *log = instance->log;
+
+	if (!log)
+		return;
+	if (write(log->quit_pipe[1], "q", 1) == -1)
+		perror("Error stopping the log flusher");
+	pthread_join(log->flusher, NULL);
+	instance->stats.cpu_time += log->cpu_time;
+	close(log->quit_pipe[0]);
+	close(log->quit_pipe[1]);
+	free(log->rings);
+	free(log);
+	instance->log = NULL;
+}
+
+/*
+ * Make the calling thread log in the ring of thread_num, the discovery thread
+ * being num_threads.
+ */
+void liblttd_log_thread(struct liblttd_instance *instance,
+			unsigned long thread_num)
+{
+	if (!instance->log || thread_num >= instance->log->num_rings)
+		log_ring = NULL;
+	else
+		log_ring = &instance->log->rings[thread_num];
+}
@@ -0,0 +1,145 @@
+/*
+ * liblttdlog header file
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LIBLTTDLOG_H
+#define _LIBLTTDLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The self-log of liblttd
+ *
+ * The reader threads record what they do as fixed size binary records, in a
+ * ring of their own which only they write. A flusher thread empties the rings
+ * in the background, to the log file given to liblttd_set_log, or as text on
+ * the standard output in verbose mode. A thread whose ring is full drops its
+ * records and the flusher writes how many were dropped.
+ *
+ * The log file is a struct liblttd_log_header followed by records, in the
+ * byte order of the machine which wrote it. lttd-logdump prints it.
+ */
+
+#define LIBLTTD_LOG_MAGIC	"LTTDLOG"
+#define LIBLTTD_LOG_VERSION	1
+
+/* Records of each thread, a power of 2 */
+#define LIBLTTD_LOG_RING_SIZE	8192
+
+/**
+ * enum liblttd_log_event - What a record tells, with the meaning of its
+ * arguments.
+ */
+enum liblttd_log_event {
+	LIBLTTD_LOG_DROPPED,		/* records dropped by the thread */
+	LIBLTTD_LOG_POLL,		/* poll returned, fds ready */
+	LIBLTTD_LOG_WAKE,		/* wake up fd ready */
+	LIBLTTD_LOG_WAKE_ERROR,		/* wake up fd revents */
+	LIBLTTD_LOG_POLL_ERR,		/* channel fd returned an error */
+	LIBLTTD_LOG_POLL_HUP,		/* channel fd hung up */
+	LIBLTTD_LOG_POLL_NVAL,		/* channel fd not open */
+	LIBLTTD_LOG_READ_URGENT,	/* read of an almost full channel */
+	LIBLTTD_LOG_READ_NORMAL,	/* read of a channel */
+	LIBLTTD_LOG_GET_SB,		/* sub-buffer reserved, cookie */
+	LIBLTTD_LOG_GET_SB_AGAIN,	/* no sub-buffer to reserve */
+	LIBLTTD_LOG_PUT_SB,		/* sub-buffer released, cookie, errno */
+	LIBLTTD_LOG_SPLICE_IN,		/* channel to pipe, offset, result */
+	LIBLTTD_LOG_SPLICE_OUT,		/* pipe to file, length, result */
+	LIBLTTD_LOG_SYNC_WAIT,		/* waiting for writeback, offset, len */
+	LIBLTTD_LOG_NR_EVENTS,
+};
+
+/**
+ * struct liblttd_log_header - Start of a log file.
+ * @magic:       LIBLTTD_LOG_MAGIC
+ * @version:     LIBLTTD_LOG_VERSION
+ * @record_size: size of struct liblttd_log_record
+ * @num_threads: reader threads of the instance. The records of the discovery
+ *               thread have num_threads as thread number.
+ */
+struct liblttd_log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t num_threads;
+	uint32_t pad;
+};
+
+/**
+ * struct liblttd_log_record - A logged event.
+ * @timestamp: CLOCK_MONOTONIC time, in nanoseconds
+ * @thread:    number of the thread which logged it
+ * @channel:   channel file descriptor, or -1
+ * @event:     enum liblttd_log_event
+ * @arg:       arguments of the event
+ */
+struct liblttd_log_record {
+	uint64_t timestamp;
+	uint32_t thread;
+	int32_t channel;
+	uint32_t event;
+	uint32_t pad;
+	int64_t arg[2];
+};
+
+struct liblttd_instance;
+
+/**
+ * liblttd_log_event - Is called to log an event from a thread of the library,
+ * a callback for instance.
+ *
+ * @event:   enum liblttd_log_event
+ * @channel: channel file descriptor, or -1
+ * @arg0:    first argument
+ * @arg1:    second argument
+ *
+ * Does nothing in threads which do not log. It does not block and takes no
+ * lock.
+ */
+void liblttd_log_event(unsigned int event, int channel, int64_t arg0,
+		       int64_t arg1);
+
+/**
+ * liblttd_log_format - Is called to print a record as a line of text.
+ *
+ * @record: the record
+ * @buf:    where to print it, with its end of line
+ * @len:    size of buf
+ *
+ * Returns the length of the text, as snprintf.
+ */
+int liblttd_log_format(const struct liblttd_log_record *record, char *buf,
+		       size_t len);
+
+/* Used by liblttd to run the log of an instance */
+int liblttd_log_start(struct liblttd_instance *instance);
+void liblttd_log_stop(struct liblttd_instance *instance);
+void liblttd_log_thread(struct liblttd_instance *instance,
+			unsigned long thread_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_LIBLTTDLOG_H */
@@ -0,0 +1,487 @@
+/*
+ * liblttdmetrics
+ *
+ * Linux Trace Toolkit library - Metrics exporter
+ *
+ * Serve the counters of the session, of each channel and of each reader thread
+ * on a local UNIX socket, in the Prometheus text format. A client gets the
+ * metrics once per connection, as an HTTP response if it sent a GET request,
+ * as plain text otherwise.
+ *
+ * The counters are copied while the reader threads update them, they never
+ * wait for the exporter.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _REENTRANT
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "liblttd.h"
+#include "liblttdmetrics.h"
+
+/* Longest wait for the request of a client, in ms */
+#define METRICS_REQUEST_TIMEOUT	1000
+/* Longest wait for a client to read, in ms, before it is dropped */
+#define METRICS_SEND_TIMEOUT	1000
+
+struct liblttd_metrics {
+	struct liblttd_instance *instance;
+	struct sockaddr_un addr;
+	int listen_fd;
+	int quit_pipe[2];
+	pthread_t tid;
+};
+
+static const char *phase_names[LIBLTTD_NR_PHASES] = {
+	[LIBLTTD_PHASE_POLL] = "poll",
+	[LIBLTTD_PHASE_RESERVE] = "reserve",
+	[LIBLTTD_PHASE_CALLBACK] = "callback",
+	[LIBLTTD_PHASE_RELEASE] = "release",
+};
+
+static void metric_header(FILE *out, const char *name, const char *type,
+	const char *help)
+{
+	fprintf(out, "# HELP %s %s\n", name, help);
+	fprintf(out, "# TYPE %s %s\n", name, type);
+}
+
+/* Label values escape backslash, double quote and line feed */
+static void label_value(FILE *out, const char *value)
+{
+	for (; *value; value++) {
+		if (*value == '\\' || *value == '"')
+			fputc('\\', out);
+		if (*value == '\n')
+			fputs("\\n", out);
+		else
+			fputc(*value, out);
+	}
+}
+
+static void channel_metric(FILE *out, const char *name,
+	struct liblttd_channel_info *channels, int num, size_t offset)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		fprintf(out, "%s{channel=\"", name);
+		label_value(out, channels[i].path);
+		fprintf(out, "\"} %llu\n", *(unsigned long long *)
+			((char *)&channels[i].stats + offset));
+	}
+}
+
+#define CHANNEL_METRIC(out, name, type, help, channels, num, field)	\
+	do {								\
+		metric_header(out, name, type, help);			\
+		channel_metric(out, name, channels, num,		\
+			offsetof(struct liblttd_channel_stats, field));	\
+	} while (0)
+
+static void thread_metric(FILE *out, const char *name,
+	struct liblttd_thread_stats *threads, unsigned long num, size_t offset,
+	double scale)
+{
+	unsigned long i;
+
+	for (i = 0; i < num; i++)
+		fprintf(out, "%s{thread=\"%lu\"} %.9g\n", name, i,
+			*(unsigned long long *)((char *)&threads[i] + offset)
+				* scale);
+}
+
+#define THREAD_METRIC(out, name, type, help, threads, num, field, scale) \
+	do {								\
+		metric_header(out, name, type, help);			\
+		thread_metric(out, name, threads, num,			\
+			offsetof(struct liblttd_thread_stats, field), scale); \
+	} while (0)
+
+static void channel_metrics(struct liblttd_instance *instance, FILE *out,
+	unsigned long long now)
+{
+	struct liblttd_channel_info *channels, *chan;
+	unsigned long long count;
+	int num, i, j;
+
+	num = liblttd_get_channel_stats(instance, &channels);
+	if (num < 0)
+		return;
+
+	CHANNEL_METRIC(out, "lttd_channel_subbuffers_total", "counter",
+		"Sub-buffers read from the channel.", channels, num, subbufs);
+	CHANNEL_METRIC(out, "lttd_channel_bytes_total", "counter",
+		"Bytes read from the channel.", channels, num, bytes);
+	CHANNEL_METRIC(out, "lttd_channel_lost_subbuffers_total", "counter",
+		"Sub-buffers corrupted because the writer pushed the reader.",
+		channels, num, lost);
+	CHANNEL_METRIC(out, "lttd_channel_failed_subbuffers_total", "counter",
+		"Sub-buffers released without being written.",
+		channels, num, failed);
+	CHANNEL_METRIC(out, "lttd_channel_urgent_subbuffers_total", "counter",
+		"Sub-buffers read while the channel was almost full.",
+		channels, num, urgent);
+
+	metric_header(out, "lttd_channel_lag_seconds", "gauge",
+		"Time since the last sub-buffer read from the channel.");
+	for (i = 0; i < num; i++) {
+		chan = &channels[i];
+		if (!chan->stats.last_read)
+			continue;
+		fprintf(out, "lttd_channel_lag_seconds{channel=\"");
+		label_value(out, chan->path);
+		fprintf(out, "\"} %.3f\n",
+			now > chan->stats.last_read ?
+				(now - chan->stats.last_read) / 1e9 : 0);
+	}
+
+	metric_header(out, "lttd_channel_fill_ratio", "histogram",
+		"Fill level of the sub-buffers read from the channel.");
+	for (i = 0; i < num; i++) {
+		chan = &channels[i];
+		count = 0;
+		for (j = 0; j < LIBLTTD_FILL_BUCKETS; j++) {
+			count += chan->stats.fill[j];
+			fprintf(out, "lttd_channel_fill_ratio_bucket{channel=\"");
+			label_value(out, chan->path);
+			fprintf(out, "\",le=\"%g\"} %llu\n",
+				(double)(j + 1) / LIBLTTD_FILL_BUCKETS, count);
+		}
+		fprintf(out, "lttd_channel_fill_ratio_bucket{channel=\"");
+		label_value(out, chan->path);
+		fprintf(out, "\",le=\"+Inf\"} %llu\n", count);
+		fprintf(out, "lttd_channel_fill_ratio_sum{channel=\"");
+		label_value(out, chan->path);
+		fprintf(out, "\"} %.6g\n", chan->max_sb_size ?
+			(double)chan->stats.bytes / chan->max_sb_size : 0);
+		fprintf(out, "lttd_channel_fill_ratio_count{channel=\"");
+		label_value(out, chan->path);
+		fprintf(out, "\"} %llu\n", count);
+	}
+
+	free(channels);
+}
+
+static void thread_metrics(FILE *out, struct liblttd_thread_stats *threads,
+	unsigned long num)
+{
+	unsigned long i;
+	int phase;
+
+	THREAD_METRIC(out, "lttd_thread_polls_total", "counter",
+		"Poll calls of the reader thread which returned.",
+		threads, num, polls, 1);
+	THREAD_METRIC(out, "lttd_thread_reads_total", "counter",
+		"Ready channels the reader thread went to read.",
+		threads, num, reads, 1);
+	THREAD_METRIC(out, "lttd_thread_subbuffers_total", "counter",
+		"Sub-buffers read by the reader thread.",
+		threads, num, subbufs, 1);
+	THREAD_METRIC(out, "lttd_thread_trylocks_total", "counter",
+		"Attempts to take the lock of a ready channel.",
+		threads, num, trylocks, 1);
+	THREAD_METRIC(out, "lttd_thread_trylock_failures_total", "counter",
+		"Attempts which found the channel taken by another thread.",
+		threads, num, trylock_failed, 1);
+	THREAD_METRIC(out, "lttd_thread_lock_wait_seconds_total", "counter",
+		"Time spent waiting for the lock of the channel list.",
+		threads, num, rwlock_wait, 1e-9);
+	THREAD_METRIC(out, "lttd_thread_cpu_seconds_total", "counter",
+		"CPU time of the reader thread.",
+		threads, num, cpu_time, 1e-9);
+
+	metric_header(out, "lttd_thread_syscalls_total", "counter",
+		"System calls of the reader thread, by phase of the reads.");
+	for (i = 0; i < num; i++)
+		for (phase = 0; phase < LIBLTTD_NR_PHASES; phase++)
+			fprintf(out, "lttd_thread_syscalls_total{thread=\"%lu\","
+				"phase=\"%s\"} %llu\n", i, phase_names[phase],
+				threads[i].syscalls[phase]);
+}
+
+/*
+ * Bytes the process sent to the storage layer, from /proc/self/io. Returns 0
+ * on success, -1 if the kernel does not account them.
+ */
+static int disk_write_bytes(unsigned long long *bytes)
+{
+	char line[64];
+	FILE *io;
+	int ret = -1;
+
+	io = fopen("/proc/self/io", "r");
+	if (!io)
+		return -1;
+	while (fgets(line, sizeof(line), io))
+		if (sscanf(line, "write_bytes: %llu", bytes) == 1) {
+			ret = 0;
+			break;
+		}
+	fclose(io);
+	return ret;
+}
+
+/*
+ * Write the metrics of the instance to out.
+ *
+ * returns 0 on success, -1 on error.
+ */
+static int metrics_write(struct liblttd_instance *instance, FILE *out)
+{
+	struct liblttd_thread_stats *threads;
+	struct liblttd_stats stats;
+	struct timespec ts;
+	unsigned long long now, cpu_time = 0, disk_bytes;
+	unsigned long i;
+	double uptime = 0;
+
+	threads = calloc(instance->num_threads, sizeof(*threads));
+	if (!threads)
+		return -1;
+	liblttd_get_stats(instance, &stats, threads);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	if (stats.start.tv_sec || stats.start.tv_nsec)
+		uptime = (ts.tv_sec - stats.start.tv_sec)
+			+ (ts.tv_nsec - stats.start.tv_nsec) / 1e9;
+	for (i = 0; i < instance->num_threads; i++)
+		cpu_time += threads[i].cpu_time;
+
+	metric_header(out, "lttd_subbuffers_total", "counter",
+		"Sub-buffers read from every channel.");
+	fprintf(out, "lttd_subbuffers_total %llu\n", stats.subbufs);
+	metric_header(out, "lttd_bytes_total", "counter",
+		"Bytes read from every channel.");
+	fprintf(out, "lttd_bytes_total %llu\n", stats.bytes);
+	metric_header(out, "lttd_lost_subbuffers_total", "counter",
+		"Sub-buffers corrupted because the writer pushed the reader.");
+	fprintf(out, "lttd_lost_subbuffers_total %llu\n", stats.lost);
+	metric_header(out, "lttd_failed_subbuffers_total", "counter",
+		"Sub-buffers released without being written.");
+	fprintf(out, "lttd_failed_subbuffers_total %llu\n", stats.failed);
+	metric_header(out, "lttd_uptime_seconds", "gauge",
+		"Time since the channels were open.");
+	fprintf(out, "lttd_uptime_seconds %.3f\n", uptime);
+	metric_header(out, "lttd_throughput_bytes_per_second", "gauge",
+		"Average throughput since the channels were open.");
+	fprintf(out, "lttd_throughput_bytes_per_second %.0f\n",
+		uptime > 0 ? stats.bytes / uptime : 0);
+	metric_header(out, "lttd_cpu_seconds_total", "counter",
+		"CPU time of the reader threads.");
+	fprintf(out, "lttd_cpu_seconds_total %.9g\n", cpu_time / 1e9);
+	if (!disk_write_bytes(&disk_bytes)) {
+		metric_header(out, "lttd_disk_write_bytes_total", "counter",
+			"Bytes the consumer process sent to the disks.");
+		fprintf(out, "lttd_disk_write_bytes_total %llu\n", disk_bytes);
+	}
+
+	channel_metrics(instance, out, now);
+	thread_metrics(out, threads, instance->num_threads);
+
+	free(threads);
+	return ferror(out) ? -1 : 0;
+}
+
+/*
+ * Send buf without blocking the exporter : a client which does not read for
+ * METRICS_SEND_TIMEOUT is dropped, and liblttd_metrics_stop does not wait
+ * for it.
+ */
+static int send_all(struct liblttd_metrics *metrics, int fd, const char *buf,
+	size_t len)
+{
+	struct pollfd pollfd[2];
+	ssize_t ret;
+
+	pollfd[0].fd = fd;
+	pollfd[0].events = POLLOUT;
+	pollfd[1].fd = metrics->quit_pipe[0];
+	pollfd[1].events = POLLIN;
+
+	while (len > 0) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EAGAIN) {
+			ret = poll(pollfd, 2, METRICS_SEND_TIMEOUT);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0 || pollfd[1].revents)
+				return -1;
+			continue;
+		}
+		if (ret < 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static void metrics_serve(struct liblttd_metrics *metrics, int fd)
+{
+	static const char http_header[] =
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n"
+		"\r\n";
+	char request[512], header[256];
+	struct pollfd pollfd;
+	ssize_t len = 0;
+	size_t size;
+	char *text;
+	FILE *out;
+
+	/* Tell an HTTP client from a plain one, which may send nothing */
+	pollfd.fd = fd;
+	pollfd.events = POLLIN;
+	if (poll(&pollfd, 1, METRICS_REQUEST_TIMEOUT) > 0)
+		len = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+
+	out = open_memstream(&text, &size);
+	if (!out)
+		return;
+	if (metrics_write(metrics->instance, out)) {
+		fclose(out);
+		free(text);
+		return;
+	}
+	fclose(out);
+
+	if (len >= 4 && !strncmp(request, "GET ", 4)) {
+		snprintf(header, sizeof(header), http_header, size);
+		if (send_all(metrics, fd, header, strlen(header)))
+			goto end;
+	}
+	send_all(metrics, fd, text, size);
+end:
+	free(text);
+}
+
+static void *metrics_main(void *arg)
+{
+	struct liblttd_metrics *metrics = arg;
+	struct pollfd pollfd[2];
+	int fd;
+
+	pollfd[0].fd = metrics->listen_fd;
+	pollfd[0].events = POLLIN;
+	pollfd[1].fd = metrics->quit_pipe[0];
+	pollfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pollfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("Poll error in the metrics exporter");
+			break;
+		}
+		if (pollfd[1].revents)
+			break;
+		if (!(pollfd[0].revents & POLLIN))
+			continue;
+		fd = accept(metrics->listen_fd, NULL, NULL);
+		if (fd == -1)
+			continue;
+		metrics_serve(metrics, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+struct liblttd_metrics *liblttd_metrics_start(
+	struct liblttd_instance *instance, const char *path)
+{
+	struct liblttd_metrics *metrics;
+	int ret;
+
+	if (strlen(path) >= sizeof(metrics->addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	metrics = calloc(1, sizeof(struct liblttd_metrics));
+	if (!metrics)
+		return NULL;
+	metrics->instance = instance;
+	metrics->addr.sun_family = AF_UNIX;
+	strcpy(metrics->addr.sun_path, path);
+
+	metrics->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (metrics->listen_fd == -1) {
+		ret = errno;
+		goto free_metrics;
+	}
+	/* A socket left by a previous consumer */
+	unlink(path);
+	if (bind(metrics->listen_fd, (struct sockaddr *)&metrics->addr,
+		 sizeof(metrics->addr)) == -1
+	    || listen(metrics->listen_fd, 16) == -1) {
+		ret = errno;
+		goto close_socket;
+	}
+	if (pipe(metrics->quit_pipe) == -1) {
+		ret = errno;
+		goto unlink_socket;
+	}
+	ret = pthread_create(&metrics->tid, NULL, metrics_main, metrics);
+	if (ret)
+		goto close_pipe;
+	return metrics;
+
+close_pipe:
+	close(metrics->quit_pipe[0]);
+	close(metrics->quit_pipe[1]);
+unlink_socket:
+	unlink(path);
+close_socket:
+	close(metrics->listen_fd);
+free_metrics:
+	free(metrics);
+	errno = ret;
+	return NULL;
+}
+
+void liblttd_metrics_stop(struct liblttd_metrics *metrics)
+{
+	if (!metrics)
+		return;
+	if (write(metrics->quit_pipe[1], "q", 1) == -1)
+		perror("Error stopping the metrics exporter");
+	pthread_join(metrics->tid, NULL);
+	close(metrics->quit_pipe[0]);
+	close(metrics->quit_pipe[1]);
+	close(metrics->listen_fd);
+	unlink(metrics->addr.sun_path);
+	free(metrics);
+}
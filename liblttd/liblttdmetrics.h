@@ -0,0 +1,66 @@
+/*
+ * liblttdmetrics header file
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LIBLTTDMETRICS_H
+#define _LIBLTTDMETRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The metrics exporter of liblttd
+ *
+ * A thread serves the counters of the session, of each channel and of each
+ * reader thread on a UNIX socket, in the Prometheus text format. Each
+ * connection gets the metrics once, as an HTTP response if it sent a GET
+ * request, as plain text otherwise.
+ */
+
+struct liblttd_instance;
+struct liblttd_metrics;
+
+/**
+ * liblttd_metrics_start - Is called to serve the metrics of an instance.
+ *
+ * @instance: The tracing session instance.
+ * @path:     Path of the UNIX socket. A file already there is replaced.
+ *
+ * Returns the exporter, or NULL with errno set.
+ *
+ * The exporter reads the counters while the reader threads update them, it
+ * never makes them wait. It must be stopped before the instance is deleted,
+ * from on_trace_end at the latest.
+ */
+struct liblttd_metrics *liblttd_metrics_start(
+	struct liblttd_instance *instance, const char *path);
+
+/**
+ * liblttd_metrics_stop - Is called to stop the exporter and remove its socket.
+ *
+ * @metrics: The exporter, or NULL.
+ */
+void liblttd_metrics_stop(struct liblttd_metrics *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_LIBLTTDMETRICS_H */
@@ -8,6 +8,11 @@
  *
  * CPU hot-plugging is supported using inotify.
  *
+ * The sub-buffers can also be sent to streams, the sinks : tee() duplicates
+ * the pages of the thread pipe into a pipe of the sink, without copying them.
+ * A sink which does not keep up drops sub-buffers, it never holds up the
+ * trace files. A thread sends what the streams could not take right away.
+ *
  * Copyright 2005-2010 -
  * 	Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
  * Copyright 2010 -
@@ -42,24 +47,88 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <poll.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "liblttdvfs.h"
+#include "liblttd-probes.h"
+#include "liblttdlog.h"
+#include "liblttdcrc.h"
 
 struct liblttdvfs_channel_data {
 	int trace;
+	int crc;		/* the checksums of the trace file, or -1 */
 };
 
+/*
+ * A stream the sub-buffers are sent to. Its pipe holds the frames the stream
+ * did not take yet, pending bytes of it. The lock keeps the frames of the
+ * reader threads whole, it is only held for non-blocking calls.
+ */
+struct liblttdvfs_sink {
+	char *name;
+	int fd;
+	int pipe[2];
+	long capacity;
+	long pending;
+	int failed;
+	int too_small;
+	int woken;		/* the sink thread knows about pending */
+	pthread_mutex_t lock;
+	struct liblttdvfs_sink_stats stats;
+};
+
+/*
+ * The frame of the current sub-buffer for a sink, built in a pipe of the
+ * reader thread before it is moved to the sink as a whole.
+ */
+struct liblttdvfs_thread_sink {
+	int pipe[2];
+	long capacity;
+	long frame;
+	int active;
+};
+
+/*
+ * The trace files are open relative to the trace folder, created with the
+ * root folder of the channels.
+ */
 struct liblttdvfs_data {
-	char path_trace[PATH_MAX];
-	char *end_path_trace;
-	int path_trace_len;
+	char *trace_name;
+	int trace_dir;
 	int append_mode;
 	int verbose_mode;
+	int crc_mode;
+	struct liblttdvfs_sink *sinks;
+	unsigned int nr_sinks;
+	int null_fd;
+	int sink_wake[2];
+	int sink_quit;
+	pthread_t sink_thread;
+	int sink_thread_running;
 };
 
 static __thread int thread_pipe[2];
+static __thread struct liblttdvfs_thread_sink *thread_sinks;
+/* The sub-buffers are read back from the trace file to be checksummed */
+static __thread char *thread_crc_buf;
+
+static int liblttdvfs_sink_thread_start(struct liblttdvfs_data *data);
+
+/*
+ * Room of the pipe of a sink, less without CAP_SYS_RESOURCE. It grows to hold
+ * one sub-buffer larger than half of it, and the sink drops sub-buffers which
+ * would fill it more.
+ */
+#define SINK_PIPE_SIZE		(4 * 1024 * 1024)
+/* Longest wait for a sink to take its last frames, in ms */
+#define SINK_CLOSE_TIMEOUT	1000
+
+/* Read back a sub-buffer this much at a time, to checksum it from the cache */
+#define CRC_CHUNK		(64 * 1024)
 
 #define printf_verbose(fmt, args...) \
   do {                               \
@@ -67,6 +136,43 @@ static __thread int thread_pipe[2];
       printf(fmt, ##args);           \
   } while (0)
 
+/*
+ * Open the checksums of a trace file, to append to them. The header is
+ * written when the file is new.
+ */
+static int liblttdvfs_open_crc(struct liblttdvfs_data *callbacks_data,
+	const char *path_trace, int append)
+{
+	struct liblttd_crc_header header;
+	char *path;
+	int fd;
+
+	if (asprintf(&path, "%s%s", path_trace, LIBLTTD_CRC_SUFFIX) == -1)
+		return -1;
+	fd = openat(callbacks_data->trace_dir, path,
+		O_WRONLY | O_CREAT | O_APPEND
+		| (append ? 0 : O_EXCL),
+		S_IRWXU|S_IRWXG|S_IRWXO);
+	if (fd == -1) {
+		perror(path);
+		goto end;
+	}
+	if (lseek(fd, 0, SEEK_END) == 0) {
+		memset(&header, 0, sizeof(header));
+		strcpy(header.magic, LIBLTTD_CRC_MAGIC);
+		header.version = LIBLTTD_CRC_VERSION;
+		header.record_size = sizeof(struct liblttd_crc_record);
+		if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+			perror(path);
+			close(fd);
+			fd = -1;
+		}
+	}
+end:
+	free(path);
+	return fd;
+}
+
 int liblttdvfs_on_open_channel(struct liblttd_callbacks *data, struct fd_pair *pair, char *relative_channel_path)
 {
 	int open_ret = 0;
@@ -79,40 +185,48 @@ int liblttdvfs_on_open_channel(struct liblttd_callbacks *data, struct fd_pair *p
 	channel_data = pair->user_data;
 
 	struct liblttdvfs_data* callbacks_data = data->user_data;
+	/* The relative path starts with a '/' */
+	char *path_trace = relative_channel_path + 1;
+	/* The checksums read the sub-buffers back */
+	int flags = callbacks_data->crc_mode ? O_RDWR : O_WRONLY;
+	/* The channel replaces an earlier one, like on CPU hot-plug */
+	int append = callbacks_data->append_mode || pair->replaced;
 
-	strncpy(callbacks_data->end_path_trace, relative_channel_path, PATH_MAX - callbacks_data->path_trace_len);
-	printf_verbose("Creating trace file %s\n", callbacks_data->path_trace);
+	printf_verbose("Creating trace file %s%s\n", callbacks_data->trace_name,
+		relative_channel_path);
 
-	ret = stat(callbacks_data->path_trace, &stat_buf);
+	ret = fstatat(callbacks_data->trace_dir, path_trace, &stat_buf, 0);
 	if (ret == 0) {
-		if (callbacks_data->append_mode) {
-			printf_verbose("Appending to file %s as requested\n",
-				callbacks_data->path_trace);
+		if (append) {
+			printf_verbose("Appending to file %s%s\n",
+				callbacks_data->trace_name,
+				relative_channel_path);
 
-			channel_data->trace = open(callbacks_data->path_trace, O_WRONLY, S_IRWXU|S_IRWXG|S_IRWXO);
+			channel_data->trace = openat(callbacks_data->trace_dir, path_trace, flags, S_IRWXU|S_IRWXG|S_IRWXO);
 			if (channel_data->trace == -1) {
-				perror(callbacks_data->path_trace);
+				perror(path_trace);
 				open_ret = -1;
 				goto end;
 			}
 			offset = lseek(channel_data->trace, 0, SEEK_END);
 			if (offset < 0) {
-				perror(callbacks_data->path_trace);
+				perror(path_trace);
 				open_ret = -1;
 				close(channel_data->trace);
 				goto end;
 			}
 		} else {
-			printf("File %s exists, cannot open. Try append mode.\n", callbacks_data->path_trace);
+			printf("File %s%s exists, cannot open. Try append mode.\n",
+				callbacks_data->trace_name, relative_channel_path);
 			open_ret = -1;
 			goto end;
 		}
 	} else {
 		if (errno == ENOENT) {
 			channel_data->trace =
-				open(callbacks_data->path_trace, O_WRONLY|O_CREAT|O_EXCL, S_IRWXU|S_IRWXG|S_IRWXO);
+				openat(callbacks_data->trace_dir, path_trace, flags|O_CREAT|O_EXCL, S_IRWXU|S_IRWXG|S_IRWXO);
 			if (channel_data->trace == -1) {
-				perror(callbacks_data->path_trace);
+				perror(path_trace);
 				open_ret = -1;
 				goto end;
 			}
@@ -123,6 +237,17 @@ int liblttdvfs_on_open_channel(struct liblttd_callbacks *data, struct fd_pair *p
 			goto end;
 		}
 	}
+	/* The sub-buffers are checksummed where they are written */
+	pair->offset = offset;
+	channel_data->crc = -1;
+	if (callbacks_data->crc_mode) {
+		channel_data->crc = liblttdvfs_open_crc(callbacks_data,
+							path_trace, append);
+		if (channel_data->crc == -1) {
+			close(channel_data->trace);
+			open_ret = -1;
+		}
+	}
 end:
 	return open_ret;
 
@@ -130,8 +255,12 @@ end:
 
 int liblttdvfs_on_close_channel(struct liblttd_callbacks *data, struct fd_pair *pair)
 {
+	struct liblttdvfs_channel_data *channel_data = pair->user_data;
 	int ret;
-	ret = close(((struct liblttdvfs_channel_data *)(pair->user_data))->trace);
+
+	ret = close(channel_data->trace);
+	if (channel_data->crc != -1 && close(channel_data->crc))
+		ret = -1;
 	free(pair->user_data);
 	return ret;
 }
@@ -142,13 +271,35 @@ int liblttdvfs_on_new_channels_folder(struct liblttd_callbacks *data, char *rela
 	int open_ret = 0;
 	struct liblttdvfs_data* callbacks_data = data->user_data;
 
-	strncpy(callbacks_data->end_path_trace, relative_folder_path, PATH_MAX - callbacks_data->path_trace_len);
-	printf_verbose("Creating trace subdirectory %s\n", callbacks_data->path_trace);
+	printf_verbose("Creating trace subdirectory %s%s\n",
+		callbacks_data->trace_name, relative_folder_path);
 
-	ret = mkdir(callbacks_data->path_trace, S_IRWXU|S_IRWXG|S_IRWXO);
+	/* The root folder of the channels comes first, as "" */
+	if (*relative_folder_path)
+		ret = mkdirat(callbacks_data->trace_dir,
+			relative_folder_path + 1, S_IRWXU|S_IRWXG|S_IRWXO);
+	else
+		ret = mkdir(callbacks_data->trace_name,
+			S_IRWXU|S_IRWXG|S_IRWXO);
 	if (ret == -1) {
 		if (errno != EEXIST) {
-			perror(callbacks_data->path_trace);
+			perror(relative_folder_path);
+			open_ret = -1;
+			goto end;
+		}
+	}
+
+	if (!*relative_folder_path && callbacks_data->trace_dir == -1) {
+		callbacks_data->trace_dir = open(callbacks_data->trace_name,
+			O_RDONLY | O_DIRECTORY);
+		if (callbacks_data->trace_dir == -1) {
+			perror(callbacks_data->trace_name);
+			open_ret = -1;
+			goto end;
+		}
+		/* Before the reader threads, which wake it up */
+		if (callbacks_data->nr_sinks
+		    && liblttdvfs_sink_thread_start(callbacks_data)) {
 			open_ret = -1;
 			goto end;
 		}
@@ -158,39 +309,470 @@ end:
 	return open_ret;
 }
 
-int liblttdvfs_on_read_subbuffer(struct liblttd_callbacks *data, struct fd_pair *pair, unsigned int len)
+/*
+ * Throw away what a failed write left in the thread pipe, so it does not end
+ * up in the trace file of the next sub-buffer.
+ */
+static void liblttdvfs_drain_pipe(long len)
 {
+	char buf[4096];
 	long ret;
+
+	while (len > 0) {
+		ret = read(thread_pipe[0], buf,
+			   len < sizeof(buf) ? len : sizeof(buf));
+		liblttd_account_syscalls(1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			perror("Error draining pipe");
+			return;
+		}
+		len -= ret;
+	}
+}
+
+static void liblttdvfs_sink_fail(struct liblttdvfs_sink *sink, const char *what)
+{
+	fprintf(stderr, "Sink %s: %s: %s, its sub-buffers are dropped\n",
+		sink->name, what, strerror(errno));
+	sink->failed = 1;
+	sink->stats.errors++;
+}
+
+/*
+ * Send what the stream takes without blocking. Called with the sink lock held.
+ */
+static void liblttdvfs_sink_flush(struct liblttdvfs_sink *sink)
+{
+	long ret;
+
+	while (sink->pending > 0 && !sink->failed) {
+		ret = splice(sink->pipe[0], NULL, sink->fd, NULL, sink->pending,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		liblttd_account_syscalls(1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EAGAIN)
+			return;
+		if (ret <= 0) {
+			if (!ret)
+				errno = EPIPE;
+			liblttdvfs_sink_fail(sink, "Error in sink splice");
+			return;
+		}
+		sink->pending -= ret;
+	}
+}
+
+/*
+ * Grow a pipe so it holds len bytes in pages of their own. Returns its size,
+ * or -1 if it cannot grow that much.
+ */
+static long liblttdvfs_pipe_room(int fd, long capacity, long len)
+{
+	long ret;
+
+	len = 2 * len + 2 * sysconf(_SC_PAGESIZE);
+	if (capacity >= len)
+		return capacity;
+	ret = fcntl(fd, F_SETPIPE_SZ, len);
+	liblttd_account_syscalls(1);
+	return ret;
+}
+
+/* Throw away the frame built in the thread pipe of a sink */
+static void liblttdvfs_sink_discard(struct liblttdvfs_data *data,
+	struct liblttdvfs_thread_sink *tsink)
+{
+	char buf[4096];
+	long ret;
+
+	while (tsink->frame > 0) {
+		ret = splice(tsink->pipe[0], NULL, data->null_fd, NULL,
+			     tsink->frame, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0 && errno == EINVAL)
+			ret = read(tsink->pipe[0], buf,
+				   tsink->frame < sizeof(buf) ?
+					tsink->frame : sizeof(buf));
+		liblttd_account_syscalls(1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			perror("Error draining sink pipe");
+			break;
+		}
+		tsink->frame -= ret;
+	}
+	tsink->frame = 0;
+	tsink->active = 0;
+}
+
+/*
+ * Send the pending frames as the streams take them, until on_trace_end.
+ */
+static void *liblttdvfs_sink_main(void *arg)
+{
+	struct liblttdvfs_data *data = arg;
+	struct liblttdvfs_sink *sink;
+	struct pollfd *pollfd;
+	unsigned int *polled;
+	unsigned int i, n;
+	char buf[64];
+
+	pollfd = calloc(data->nr_sinks + 1, sizeof(*pollfd));
+	polled = calloc(data->nr_sinks, sizeof(*polled));
+	if (!pollfd || !polled) {
+		perror("Error allocating the sink thread");
+		goto end;
+	}
+
+	while (!data->sink_quit) {
+		pollfd[0].fd = data->sink_wake[0];
+		pollfd[0].events = POLLIN;
+		for (i = 0, n = 1; i < data->nr_sinks; i++) {
+			sink = &data->sinks[i];
+			pthread_mutex_lock(&sink->lock);
+			sink->woken = 0;
+			if (sink->pending && !sink->failed) {
+				pollfd[n].fd = sink->fd;
+				pollfd[n].events = POLLOUT;
+				polled[n - 1] = i;
+				n++;
+			}
+			pthread_mutex_unlock(&sink->lock);
+		}
+		if (poll(pollfd, n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("Poll error in the sink thread");
+			break;
+		}
+		if (pollfd[0].revents)
+			while (read(data->sink_wake[0], buf, sizeof(buf)) > 0)
+				;
+		for (i = 1; i < n; i++) {
+			if (!pollfd[i].revents)
+				continue;
+			sink = &data->sinks[polled[i - 1]];
+			pthread_mutex_lock(&sink->lock);
+			liblttdvfs_sink_flush(sink);
+			pthread_mutex_unlock(&sink->lock);
+		}
+	}
+end:
+	free(pollfd);
+	free(polled);
+	return NULL;
+}
+
+static int liblttdvfs_sink_thread_start(struct liblttdvfs_data *data)
+{
+	int ret;
+
+	if (pipe(data->sink_wake) == -1) {
+		perror("Error creating the sink thread pipe");
+		return -1;
+	}
+	/* The readers never wait for the sink thread */
+	fcntl(data->sink_wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(data->sink_wake[1], F_SETFL, O_NONBLOCK);
+	ret = pthread_create(&data->sink_thread, NULL, liblttdvfs_sink_main,
+			     data);
+	if (ret) {
+		errno = ret;
+		perror("Error creating the sink thread");
+		close(data->sink_wake[0]);
+		close(data->sink_wake[1]);
+		return -1;
+	}
+	data->sink_thread_running = 1;
+	return 0;
+}
+
+static void liblttdvfs_sink_thread_stop(struct liblttdvfs_data *data)
+{
+	if (!data->sink_thread_running)
+		return;
+	data->sink_quit = 1;
+	if (write(data->sink_wake[1], "q", 1) == -1)
+		perror("Error stopping the sink thread");
+	pthread_join(data->sink_thread, NULL);
+	close(data->sink_wake[0]);
+	close(data->sink_wake[1]);
+	data->sink_thread_running = 0;
+}
+
+/*
+ * Start the frames of a sub-buffer of len bytes : the header and the path of
+ * the channel, in the thread pipe of each sink which is still up.
+ */
+static void liblttdvfs_sinks_begin(struct liblttdvfs_data *data,
+	struct fd_pair *pair, unsigned int len)
+{
+	struct liblttdvfs_sink_header header;
+	struct liblttdvfs_thread_sink *tsink;
+	struct liblttdvfs_sink *sink;
+	struct iovec iov[2];
+	unsigned int i;
+	long ret;
+
+	header.magic = LIBLTTDVFS_SINK_MAGIC;
+	header.path_len = strlen(pair->path);
+	header.len = len;
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = (void *)pair->path;
+	iov[1].iov_len = header.path_len;
+
+	for (i = 0; i < data->nr_sinks; i++) {
+		sink = &data->sinks[i];
+		tsink = &thread_sinks[i];
+		tsink->active = 0;
+		if (sink->failed) {
+			__sync_fetch_and_add(&sink->stats.dropped, 1);
+			continue;
+		}
+		ret = liblttdvfs_pipe_room(tsink->pipe[1], tsink->capacity,
+			sizeof(header) + header.path_len + len);
+		if (ret < 0) {
+			if (!sink->too_small) {
+				sink->too_small = 1;
+				fprintf(stderr, "Sink %s: no pipe can hold "
+					"sub-buffers of %u bytes, they are "
+					"dropped\n", sink->name, len);
+			}
+			__sync_fetch_and_add(&sink->stats.dropped, 1);
+			continue;
+		}
+		tsink->capacity = ret;
+		ret = writev(tsink->pipe[1], iov, 2);
+		liblttd_account_syscalls(1);
+		if (ret != sizeof(header) + header.path_len) {
+			perror("Error writing sink header");
+			tsink->frame = ret > 0 ? ret : 0;
+			liblttdvfs_sink_discard(data, tsink);
+			__sync_fetch_and_add(&sink->stats.dropped, 1);
+			continue;
+		}
+		tsink->frame = ret;
+		tsink->active = 1;
+	}
+}
+
+/* Duplicate the len bytes of the thread pipe in the frame of each sink */
+static void liblttdvfs_sinks_tee(struct liblttdvfs_data *data, long len)
+{
+	struct liblttdvfs_thread_sink *tsink;
+	unsigned int i;
+	long ret;
+
+	for (i = 0; i < data->nr_sinks; i++) {
+		tsink = &thread_sinks[i];
+		if (!tsink->active)
+			continue;
+		do {
+			ret = tee(thread_pipe[0], tsink->pipe[1], len,
+				  SPLICE_F_NONBLOCK);
+			liblttd_account_syscalls(1);
+		} while (ret < 0 && errno == EINTR);
+		if (ret > 0)
+			tsink->frame += ret;
+		/* The rest cannot be tee'd apart, the frame is lost */
+		if (ret != len) {
+			liblttdvfs_sink_discard(data, tsink);
+			__sync_fetch_and_add(&data->sinks[i].stats.dropped, 1);
+		}
+	}
+}
+
+/*
+ * Move the complete frames to their sinks, or drop them when a sink is too far
+ * behind to take them.
+ */
+static void liblttdvfs_sinks_end(struct liblttdvfs_data *data,
+	unsigned int len, int complete)
+{
+	struct liblttdvfs_thread_sink *tsink;
+	struct liblttdvfs_sink *sink;
+	unsigned int i;
+	long ret, room;
+
+	for (i = 0; i < data->nr_sinks; i++) {
+		sink = &data->sinks[i];
+		tsink = &thread_sinks[i];
+		if (!tsink->active)
+			continue;
+		if (!complete) {
+			liblttdvfs_sink_discard(data, tsink);
+			__sync_fetch_and_add(&sink->stats.dropped, 1);
+			continue;
+		}
+
+		pthread_mutex_lock(&sink->lock);
+		liblttdvfs_sink_flush(sink);
+		if (!sink->pending)
+			room = liblttdvfs_pipe_room(sink->pipe[1],
+				sink->capacity, tsink->frame);
+		else if (2 * (sink->pending + tsink->frame) <= sink->capacity)
+			room = sink->capacity;
+		else
+			room = -1;	/* the stream is behind */
+		if (room > 0)
+			sink->capacity = room;
+		if (sink->failed || room < 0) {
+			__sync_fetch_and_add(&sink->stats.dropped, 1);
+			pthread_mutex_unlock(&sink->lock);
+			liblttdvfs_sink_discard(data, tsink);
+			continue;
+		}
+		while (tsink->frame > 0) {
+			ret = splice(tsink->pipe[0], NULL, sink->pipe[1], NULL,
+				     tsink->frame,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			liblttd_account_syscalls(1);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0) {
+				/* A part of the frame is in, the stream is cut */
+				if (!ret)
+					errno = EAGAIN;
+				liblttdvfs_sink_fail(sink, "Error in sink splice");
+				break;
+			}
+			tsink->frame -= ret;
+			sink->pending += ret;
+		}
+		if (!tsink->frame) {
+			sink->stats.subbufs++;
+			sink->stats.bytes += len;
+		}
+		liblttdvfs_sink_flush(sink);
+		if (sink->pending && !sink->woken) {
+			sink->woken = 1;
+			if (write(data->sink_wake[1], "w", 1) == -1
+			    && errno != EAGAIN)
+				perror("Error waking the sink thread");
+			liblttd_account_syscalls(1);
+		}
+		pthread_mutex_unlock(&sink->lock);
+		liblttdvfs_sink_discard(data, tsink);
+	}
+}
+
+/*
+ * Record the CRC32C of the sub-buffer just written at offset of the trace
+ * file, read back from the page cache. A sub-buffer which cannot be read back
+ * is left without checksum.
+ */
+static void liblttdvfs_write_crc(struct liblttdvfs_channel_data *channel_data,
+	off_t offset, unsigned int len)
+{
+	struct liblttd_crc_record record;
+	unsigned int done, chunk;
+	uint32_t crc = 0;
+	ssize_t ret;
+
+	for (done = 0; done < len; done += ret) {
+		chunk = len - done < CRC_CHUNK ? len - done : CRC_CHUNK;
+		ret = pread(channel_data->trace, thread_crc_buf, chunk,
+			offset + done);
+		liblttd_account_syscalls(1);
+		if (ret <= 0) {
+			perror("Error reading back the trace file");
+			return;
+		}
+		crc = liblttd_crc32c(crc, thread_crc_buf, ret);
+	}
+
+	record.offset = offset;
+	record.len = len;
+	record.crc = crc;
+	if (write(channel_data->crc, &record, sizeof(record))
+	    != sizeof(record))
+		perror("Error writing the checksum");
+	liblttd_account_syscalls(1);
+}
+
+int liblttdvfs_on_read_subbuffer(struct liblttd_callbacks *data, struct fd_pair *pair, unsigned int len)
+{
+	long ret = 0;
+	long in_pipe = 0;
+	int retries = 0;
 	off_t offset = 0;
 	off_t orig_offset = pair->offset;
-	int outfd = ((struct liblttdvfs_channel_data *)(pair->user_data))->trace;
+	struct liblttdvfs_channel_data *channel_data = pair->user_data;
+	int outfd = channel_data->trace;
+	unsigned int sb_len = len;
 
 	struct liblttdvfs_data* callbacks_data = data->user_data;
 
+	if (callbacks_data->nr_sinks)
+		liblttdvfs_sinks_begin(callbacks_data, pair, len);
+
 	while (len > 0) {
-		printf_verbose("splice chan to pipe offset %lu\n",
-			(unsigned long)offset);
 		ret = splice(pair->channel, &offset, thread_pipe[1], NULL,
 			len, SPLICE_F_MOVE | SPLICE_F_MORE);
-		printf_verbose("splice chan to pipe ret %ld\n", ret);
-		if (ret < 0) {
+		LTTD_PROBE3(liblttdvfs, splice_in, pair->channel, len, ret);
+		liblttd_account_syscalls(1);
+		liblttd_log_event(LIBLTTD_LOG_SPLICE_IN, pair->channel,
+			ret > 0 ? offset - ret : offset, ret);
+		/* The pipe has no room */
+		if (ret < 0
+		    && liblttd_splice_retry(thread_pipe[1], POLLOUT, &retries))
+			continue;
+		if (ret <= 0) {
+			if (!ret)
+				errno = EIO;	/* sub-buffer shorter than len */
 			perror("Error in relay splice");
+			ret = -1;
 			goto write_end;
 		}
-		ret = splice(thread_pipe[0], NULL, outfd,
-			NULL, ret, SPLICE_F_MOVE | SPLICE_F_MORE);
-		printf_verbose("splice pipe to file %ld\n", ret);
-		if (ret < 0) {
-			perror("Error in file splice");
-			goto write_end;
+		in_pipe = ret;
+		retries = 0;
+		if (callbacks_data->nr_sinks)
+			liblttdvfs_sinks_tee(callbacks_data, in_pipe);
+		/* The file may take less than the pipe holds */
+		while (in_pipe > 0) {
+			ret = splice(thread_pipe[0], NULL, outfd,
+				NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+			LTTD_PROBE3(liblttdvfs, splice_out, outfd, in_pipe, ret);
+			liblttd_account_syscalls(1);
+			liblttd_log_event(LIBLTTD_LOG_SPLICE_OUT, outfd,
+				in_pipe, ret);
+			if (ret < 0
+			    && liblttd_splice_retry(outfd, POLLOUT, &retries))
+				continue;
+			if (ret <= 0) {
+				if (!ret)
+					errno = ENOSPC;
+				perror("Error in file splice");
+				ret = -1;
+				liblttdvfs_drain_pipe(in_pipe);
+				goto write_end;
+			}
+			in_pipe -= ret;
+			len -= ret;
+			retries = 0;
+			/* This won't block, but will start writeout asynchronously */
+			sync_file_range(outfd, pair->offset, ret,
+					SYNC_FILE_RANGE_WRITE);
+			liblttd_account_syscalls(1);
+			pair->offset += ret;
 		}
-		len -= ret;
-		/* This won't block, but will start writeout asynchronously */
-		sync_file_range(outfd, pair->offset, ret,
-				SYNC_FILE_RANGE_WRITE);
-		pair->offset += ret;
 	}
 write_end:
+	if (callbacks_data->nr_sinks)
+		liblttdvfs_sinks_end(callbacks_data, sb_len, ret >= 0);
+	if (ret >= 0 && channel_data->crc != -1)
+		liblttdvfs_write_crc(channel_data, orig_offset, sb_len);
+	/* Drop a partly written sub-buffer, the trace file stays readable */
+	if (ret < 0 && pair->offset != orig_offset) {
+		liblttd_account_syscalls(2);
+		if (!ftruncate(outfd, orig_offset)
+		    && lseek(outfd, orig_offset, SEEK_SET) == orig_offset)
+			pair->offset = orig_offset;
+	}
 	/*
 	 * This does a blocking write-and-wait on any page that belongs to the
 	 * subbuffer prior to the one we just wrote.
@@ -198,11 +780,16 @@ write_end:
 	 * limit the amount of page cache used.
 	 */
 	if (orig_offset >= pair->max_sb_size) {
+		LTTD_PROBE3(liblttdvfs, sync_wait_start, outfd,
+			orig_offset - pair->max_sb_size, pair->max_sb_size);
+		liblttd_log_event(LIBLTTD_LOG_SYNC_WAIT, outfd,
+			orig_offset - pair->max_sb_size, pair->max_sb_size);
 		sync_file_range(outfd, orig_offset - pair->max_sb_size,
 				pair->max_sb_size,
 				SYNC_FILE_RANGE_WAIT_BEFORE
 				| SYNC_FILE_RANGE_WRITE
 				| SYNC_FILE_RANGE_WAIT_AFTER);
+		LTTD_PROBE1(liblttdvfs, sync_wait_end, outfd);
 		/*
 		 * Give hints to the kernel about how we access the file:
 		 * POSIX_FADV_DONTNEED : we won't re-access data in a near
@@ -217,36 +804,127 @@ write_end:
 		 */
 		posix_fadvise(outfd, orig_offset - pair->max_sb_size,
 			      pair->max_sb_size, POSIX_FADV_DONTNEED);
+		liblttd_account_syscalls(2);
 	}
 
-	return ret;
+	return ret < 0 ? -1 : 0;
 }
 
 int liblttdvfs_on_new_thread(struct liblttd_callbacks *data, unsigned long thread_num)
 {
+	struct liblttdvfs_data *callbacks_data = data->user_data;
+	unsigned int i;
 	int ret;
+
 	ret = pipe(thread_pipe);
 	if (ret < 0) {
 		perror("Error creating pipe");
 		return ret;
 	}
+	if (callbacks_data->crc_mode) {
+		thread_crc_buf = malloc(CRC_CHUNK);
+		if (!thread_crc_buf) {
+			perror("Error allocating the checksum buffer");
+			goto close_thread_pipe;
+		}
+	}
+	if (!callbacks_data->nr_sinks)
+		return 0;
+
+	thread_sinks = calloc(callbacks_data->nr_sinks,
+			      sizeof(struct liblttdvfs_thread_sink));
+	if (!thread_sinks) {
+		perror("Error allocating sink pipes");
+		goto close_thread_pipe;
+	}
+	for (i = 0; i < callbacks_data->nr_sinks; i++) {
+		ret = pipe(thread_sinks[i].pipe);
+		if (ret < 0) {
+			perror("Error creating sink pipe");
+			goto close_sink_pipes;
+		}
+		/* A stalled sink makes tee fail instead of waiting */
+		fcntl(thread_sinks[i].pipe[1], F_SETFL, O_NONBLOCK);
+		thread_sinks[i].capacity = fcntl(thread_sinks[i].pipe[1],
+						 F_GETPIPE_SZ);
+	}
 	return 0;
+
+close_sink_pipes:
+	while (i-- > 0) {
+		close(thread_sinks[i].pipe[0]);
+		close(thread_sinks[i].pipe[1]);
+	}
+	free(thread_sinks);
+	thread_sinks = NULL;
+	free(thread_crc_buf);
+	thread_crc_buf = NULL;
+close_thread_pipe:
+	close(thread_pipe[0]);
+	close(thread_pipe[1]);
+	return -1;
 }
 
 int liblttdvfs_on_close_thread(struct liblttd_callbacks *data, unsigned long thread_num)
 {
+	struct liblttdvfs_data *callbacks_data = data->user_data;
+	unsigned int i;
+
 	close(thread_pipe[0]);	/* close read end */
 	close(thread_pipe[1]);	/* close write end */
+	free(thread_crc_buf);
+	thread_crc_buf = NULL;
+	if (thread_sinks) {
+		for (i = 0; i < callbacks_data->nr_sinks; i++) {
+			close(thread_sinks[i].pipe[0]);
+			close(thread_sinks[i].pipe[1]);
+		}
+		free(thread_sinks);
+		thread_sinks = NULL;
+	}
 	return 0;
 }
 
+/* Give the stream a little time to take the last frames */
+static void liblttdvfs_sink_close(struct liblttdvfs_sink *sink)
+{
+	struct pollfd pollfd;
+
+	pollfd.fd = sink->fd;
+	pollfd.events = POLLOUT;
+	liblttdvfs_sink_flush(sink);
+	while (sink->pending > 0 && !sink->failed
+	       && poll(&pollfd, 1, SINK_CLOSE_TIMEOUT) > 0)
+		liblttdvfs_sink_flush(sink);
+	if (sink->pending > 0)
+		fprintf(stderr, "Sink %s: %ld bytes not sent\n", sink->name,
+			sink->pending);
+	close(sink->pipe[0]);
+	close(sink->pipe[1]);
+	close(sink->fd);
+	pthread_mutex_destroy(&sink->lock);
+	free(sink->name);
+}
+
 int liblttdvfs_on_trace_end(struct liblttd_instance *instance)
 {
 	struct liblttd_callbacks *callbacks = instance->callbacks;
 	struct liblttdvfs_data *data = callbacks->user_data;
+	unsigned int i;
 
+	liblttdvfs_sink_thread_stop(data);
+	for (i = 0; i < data->nr_sinks; i++)
+		liblttdvfs_sink_close(&data->sinks[i]);
+	free(data->sinks);
+	if (data->null_fd != -1)
+		close(data->null_fd);
+	if (data->trace_dir != -1)
+		close(data->trace_dir);
+	free(data->trace_name);
 	free(data);
 	free(callbacks);
+
+	return 0;
 }
 
 struct liblttd_callbacks* liblttdvfs_new_callbacks(char* trace_name,
@@ -262,11 +940,18 @@ struct liblttd_callbacks* liblttdvfs_new_callbacks(char* trace_name,
 	if (!data)
 		goto error;
 
-	strncpy(data->path_trace, trace_name, PATH_MAX-1);
-	data->path_trace_len = strlen(data->path_trace);
-	data->end_path_trace = data->path_trace + data->path_trace_len;
+	data->trace_name = strdup(trace_name);
+	if (!data->trace_name)
+		goto alloc_cb_error;
+	data->trace_dir = -1;
 	data->append_mode = append_mode;
 	data->verbose_mode = verbose_mode;
+	data->crc_mode = 0;
+	data->sinks = NULL;
+	data->nr_sinks = 0;
+	data->null_fd = -1;
+	data->sink_quit = 0;
+	data->sink_thread_running = 0;
 
 	callbacks = malloc(sizeof(struct liblttd_callbacks));
 	if (!callbacks)
@@ -285,7 +970,77 @@ struct liblttd_callbacks* liblttdvfs_new_callbacks(char* trace_name,
 
 	/* Error handling */
 alloc_cb_error:
+	free(data->trace_name);
 	free(data);
 error:
 	return NULL;
 }
+
+int liblttdvfs_add_sink(struct liblttd_callbacks *callbacks, const char *name,
+	int fd)
+{
+	struct liblttdvfs_data *data = callbacks->user_data;
+	struct liblttdvfs_sink *sinks, *sink;
+	long size;
+	int flags;
+
+	if (data->null_fd == -1) {
+		data->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		if (data->null_fd == -1)
+			return -1;
+	}
+	sinks = realloc(data->sinks,
+			(data->nr_sinks + 1) * sizeof(struct liblttdvfs_sink));
+	if (!sinks)
+		return -1;
+	data->sinks = sinks;
+	sink = &sinks[data->nr_sinks];
+	memset(sink, 0, sizeof(*sink));
+
+	sink->name = strdup(name);
+	if (!sink->name)
+		return -1;
+	if (pipe(sink->pipe) == -1)
+		goto free_name;
+	for (size = SINK_PIPE_SIZE; size > 65536; size /= 2) {
+		sink->capacity = fcntl(sink->pipe[1], F_SETPIPE_SZ, size);
+		if (sink->capacity > 0)
+			break;
+	}
+	if (sink->capacity <= 0)
+		sink->capacity = fcntl(sink->pipe[1], F_GETPIPE_SZ);
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		goto close_pipe;
+	sink->fd = fd;
+	pthread_mutex_init(&sink->lock, NULL);
+	data->nr_sinks++;
+	return 0;
+
+close_pipe:
+	close(sink->pipe[0]);
+	close(sink->pipe[1]);
+free_name:
+	free(sink->name);
+	return -1;
+}
+
+int liblttdvfs_get_sink_stats(struct liblttd_callbacks *callbacks,
+	unsigned int i, const char **name, struct liblttdvfs_sink_stats *stats)
+{
+	struct liblttdvfs_data *data = callbacks->user_data;
+
+	if (i >= data->nr_sinks)
+		return -1;
+	*name = data->sinks[i].name;
+	*stats = data->sinks[i].stats;
+	return 0;
+}
+
+int liblttdvfs_set_crc(struct liblttd_callbacks *callbacks, int crc)
+{
+	struct liblttdvfs_data *data = callbacks->user_data;
+
+	data->crc_mode = crc;
+	return 0;
+}
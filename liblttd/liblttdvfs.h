@@ -23,8 +23,14 @@
 #ifndef _LIBLTTDVFS_H
 #define _LIBLTTDVFS_H
 
+#include <stdint.h>
+
 #include "liblttd.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * liblttdvfs_new_callbacks - Is a utility function called to create a new
  * callbacks struct used by liblttd to write trace data to the virtual file
@@ -39,4 +45,93 @@
 struct liblttd_callbacks*
 liblttdvfs_new_callbacks(char* trace_name, int append_mode, int verbose_mode);
 
+/*
+ * Sinks
+ *
+ * Besides the trace files, every sub-buffer can be sent to streams : sockets,
+ * pipes, FIFOs or files. Each sub-buffer is sent as a frame, a struct
+ * liblttdvfs_sink_header followed by the path of the channel, relative to the
+ * root folder of the channels, and by the sub-buffer. The fields are in the
+ * byte order of the machine.
+ *
+ * A sink which does not keep up, or fails, drops whole frames and counts
+ * them. The trace files never wait for it.
+ */
+
+#define LIBLTTDVFS_SINK_MAGIC	0x4c545453	/* "LTTS" */
+
+/**
+ * struct liblttdvfs_sink_header - Start of a frame.
+ * @magic:    LIBLTTDVFS_SINK_MAGIC
+ * @path_len: length of the channel path which follows, without its null byte
+ * @len:      length of the sub-buffer which follows the path
+ */
+struct liblttdvfs_sink_header {
+	uint32_t magic;
+	uint32_t path_len;
+	uint64_t len;
+};
+
+/**
+ * struct liblttdvfs_sink_stats - Counters of a sink.
+ * @subbufs: sub-buffers queued to the stream
+ * @bytes:   bytes of these sub-buffers
+ * @dropped: sub-buffers dropped because the stream was behind or failed
+ * @errors:  errors of the stream, after which it drops everything
+ */
+struct liblttdvfs_sink_stats {
+	unsigned long long subbufs;
+	unsigned long long bytes;
+	unsigned long long dropped;
+	unsigned long long errors;
+};
+
+/**
+ * liblttdvfs_add_sink - Is called to also send the sub-buffers to a stream.
+ *
+ * @callbacks: The callbacks returned by liblttdvfs_new_callbacks, before the
+ *             instance is started.
+ * @name:      Name of the sink in messages.
+ * @fd:        Stream file descriptor. It is made non-blocking, and closed at
+ *             the end of the trace.
+ *
+ * Returns 0 if the function succeeds, else -1 with errno set.
+ *
+ * Writing to a closed socket or pipe raises SIGPIPE, which the caller ignores.
+ */
+int liblttdvfs_add_sink(struct liblttd_callbacks *callbacks, const char *name,
+	int fd);
+
+/**
+ * liblttdvfs_get_sink_stats - Is called to get the counters of a sink, until
+ * the end of on_trace_end.
+ *
+ * @callbacks: The callbacks returned by liblttdvfs_new_callbacks.
+ * @i:         Number of the sink, in the order they were added.
+ * @name:      Set to the name of the sink.
+ * @stats:     Filled with the counters.
+ *
+ * Returns 0 if the function succeeds, -1 if there is no such sink.
+ */
+int liblttdvfs_get_sink_stats(struct liblttd_callbacks *callbacks,
+	unsigned int i, const char **name, struct liblttdvfs_sink_stats *stats);
+
+/**
+ * liblttdvfs_set_crc - Is called to record the CRC32C of every sub-buffer
+ * next to its trace file, see liblttdcrc.h.
+ *
+ * @callbacks: The callbacks returned by liblttdvfs_new_callbacks, before the
+ *             instance is started.
+ * @crc:       If this argument is set to 1, each sub-buffer written is read
+ *             back from the page cache and its checksum appended to the
+ *             sidecar file of the trace file.
+ *
+ * Returns 0 if the function succeeds.
+ */
+int liblttdvfs_set_crc(struct liblttd_callbacks *callbacks, int crc);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /*_LIBLTTDVFS_H */
@@ -29,6 +29,9 @@
 #endif
 
 #include <liblttctl/lttctl.h>
+#include <liblttd/liblttd.h>
+#include <liblttd/liblttdvfs.h>
+#include <liblttd/liblttdmetrics.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,6 +39,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #define _GNU_SOURCE
 #include <getopt.h>
 
@@ -75,10 +85,140 @@ static const char *opt_transport;
 static const char *opt_write;
 static int opt_append;
 static unsigned int opt_dump_threads;
+static unsigned int opt_pool;
+static int opt_drain;
+static int opt_top;
+static unsigned int opt_autotune;
+static double opt_target_loss;
+static unsigned long long opt_mem_budget;
+static int opt_arm_markers;
+static int opt_disarm_markers;
+static struct lttctl_markers_filter opt_markers = {
+	.classes = LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_DEFAULT),
+};
+static const char **opt_arm_tap;
+static int opt_nr_arm_tap = -1;
+static const char **opt_disarm_tap;
+static int opt_nr_disarm_tap = -1;
 static char channel_root_default[PATH_MAX];
 static const char *opt_channel_root;
 static const char *opt_tracename;
 
+/*
+ * State of the in-process consumer used to dump the flight recorder channels
+ * while the trace is being destroyed.
+ */
+struct lttctl_consumer {
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int running;
+	int ready;
+	int done;
+	int ret;
+	struct liblttd_instance *instance;
+	int (*on_new_thread)(struct liblttd_callbacks *data,
+			     unsigned long thread_num);
+	int (*on_trace_end)(struct liblttd_instance *instance);
+};
+
+static struct lttctl_consumer flight_consumer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * The consumer of the normal channels serves its metrics on
+ * $LTT_RUNDIR/lttd-TRACENAME.sock, where --top reads them.
+ */
+#define METRICS_RUNDIR_DEFAULT	"/var/run"
+
+static struct liblttd_metrics *normal_metrics;
+static int (*normal_on_trace_end)(struct liblttd_instance *instance);
+
+/* The child consuming the normal channels of -C -w, until the trace ends */
+static pid_t normal_consumer_pid;
+
+/* Refresh interval of --top, in seconds */
+#define TOP_INTERVAL		(1)
+
+/*
+ * A channel of the view of --top: counters of the last refresh, and of the one
+ * before for the rates.
+ */
+struct lttctl_top_chan {
+	char *path;
+	int present;
+	double bytes, subbufs, lost, urgent, lag;
+	double prev_bytes, prev_subbufs, prev_lost, prev_urgent;
+};
+
+static struct lttctl_top_chan *top_chans;
+static int nr_top_chans;
+
+/*
+ * Pool of traces which are created and allocated ahead of time, so starting
+ * one of them is a single write to its enabled file.
+ * ready is a ring of nr_ready trace names, starting at first.
+ */
+struct lttctl_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char (*ready)[NAME_MAX];
+	unsigned int first;
+	unsigned int nr_ready;
+	unsigned int seq;
+	int quit;
+};
+
+static struct lttctl_pool trace_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Limits of the sub-buffer settings chosen by the auto-tune mode */
+#define AUTOTUNE_MIN_SUBBUF_SIZE	(4096)
+#define AUTOTUNE_MAX_SUBBUF_SIZE	(4 * 1024 * 1024)
+#define AUTOTUNE_MIN_SUBBUF_NUM		(2)
+#define AUTOTUNE_MAX_SUBBUF_NUM		(256)
+/* Sub-buffers filled per second by a channel at its measured rate */
+#define AUTOTUNE_SUBBUF_PER_SEC		(10)
+/* Seconds of data a channel must hold without consumer */
+#define AUTOTUNE_HEADROOM		(0.5)
+/*
+ * Below this median fill level, sub-buffers are flushed mostly empty and the
+ * switch timer is raised so they fill up to AUTOTUNE_FILL_TARGET, within the
+ * limits, in ms.
+ */
+#define AUTOTUNE_MIN_FILL		(0.5)
+#define AUTOTUNE_FILL_TARGET		(0.75)
+#define AUTOTUNE_MIN_SWITCH_TIMER	(10)
+#define AUTOTUNE_MAX_SWITCH_TIMER	(10000)
+
+/*
+ * Measurements of a channel during the auto-tune calibration run, and the
+ * sub-buffer settings chosen for it. The per-CPU files of a channel are
+ * accounted together, with the rate of the busiest one.
+ */
+struct lttctl_tune_chan {
+	char name[OPT_NAMELEN];
+	unsigned int nr_cpus;
+	unsigned int n_sb;
+	unsigned int max_sb_size;
+	unsigned long long max_bytes;
+	unsigned long long subbufs;
+	unsigned long long lost;
+	unsigned long long urgent;
+	unsigned long long fill[LIBLTTD_FILL_BUCKETS];
+	unsigned long long interval[LIBLTTD_INTERVAL_BUCKETS];
+	unsigned int new_n_sb;
+	unsigned int new_sb_size;
+	int new_switch_timer;		/* -1 to keep it */
+};
+
+static struct lttctl_tune_chan *tune_chans;
+static int nr_tune_chans, max_tune_chans;
+
 /* Args :
  *
  */
@@ -104,7 +244,7 @@ static void show_arguments(void)
 		"                                   "
 		"# /tmp/trace1, debugfs must be mounted for\n"
 		"                                   "
-		"# auto-find\n");
+		"# auto-find. Runs until trace1 is destroyed\n");
 	printf("  lttctl -D -w /tmp/trace1 trace1  "
 		"# Pause and destroy a trace named trace1 and\n"
 		"                                   "
@@ -113,6 +253,20 @@ static void show_arguments(void)
 		"# /tmp/trace1, debugfs must be mounted for\n"
 		"                                   "
 		"# auto-find\n");
+	printf("  lttctl --drain -w /tmp/drain trace1\n"
+		"                                   "
+		"# Move the current content of trace1's\n"
+		"                                   "
+		"# overwrite channels to a timestamped\n"
+		"                                   "
+		"# directory in /tmp/drain, keep tracing.\n"
+		"                                   "
+		"# The channels are emptied\n");
+	printf("  lttctl --pool 2 -w /tmp/pool trace1\n"
+		"                                   "
+		"# Keep traces trace1-<n> ready to be started\n"
+		"                                   "
+		"# by SIGUSR1, written to /tmp/pool/trace1-<n>\n");
 	printf("\n");
 	printf(" Basic options:\n");
 	printf("  -c, --create\n");
@@ -147,19 +301,82 @@ static void show_arguments(void)
 	printf("        Pause and destroy a trace.\n");
 	printf("  -w, --write PATH\n");
 	printf("        Path for write trace datas.\n");
-	printf("        For -c, -C, -d, -D options\n");
+	printf("        For -c, -C, -d, -D options. With -c and -C, lttctl\n"
+	       "        consumes the trace until it is destroyed, and\n"
+	       "        returns the status of the consumer\n");
 	printf("  -a, --append\n");
 	printf("        Append to trace, For -w option\n");
 	printf("  -n, --dump_threads NUMBER\n");
-	printf("        Number of lttd threads, For -w option\n");
+	printf("        Number of lttd threads, For -w option. Defaults to\n"
+	       "        the number of CPUs when dumping overwrite channels,\n"
+	       "        1 otherwise\n");
 	printf("  --channel_root PATH\n");
 	printf("        Set channels root path, For -w option."
 		" (ex. /mnt/debugfs/ltt)\n");
+	printf("  --drain\n");
+	printf("        Move the current content of the overwrite channels\n"
+	       "        to PATH/TRACENAME-<date>-<time>, without stopping\n"
+	       "        the trace. The data written is consumed: it is not\n"
+	       "        in a later drain nor in the dump of -D. Needs -w\n"
+	       "        PATH. -n defaults to the number of CPUs.\n");
+	printf("  --autotune SECONDS\n");
+	printf("        For -c and -C: trace for SECONDS with the given\n"
+	       "        options first, then create the trace with the\n"
+	       "        bufnum and bufsize computed from the measured\n"
+	       "        throughput, losses and consumer lag of each channel.\n"
+	       "        The switch_timer of channels whose sub-buffers are\n"
+	       "        mostly flushed less than half full is raised. The\n"
+	       "        fill level and interval histograms are printed.\n"
+	       "        Options explicitly set for a channel are kept.\n");
+	printf("  --target_loss RATE\n");
+	printf("        Acceptable fraction of lost sub-buffers for\n"
+	       "        --autotune (ex. 0.001), default 0\n");
+	printf("  --mem_budget SIZE[K|M|G]\n");
+	printf("        Total buffer memory --autotune can use, default\n"
+	       "        unlimited\n");
+	printf("  --arm_markers\n");
+	printf("        Connect markers, as ltt-armall. TRACENAME is\n"
+	       "        optional when no other operation is given.\n");
+	printf("  --disarm_markers\n");
+	printf("        Disconnect markers, as ltt-disarmall (all classes\n"
+	       "        unless --markers_class is given).\n");
+	printf("  --markers_class CLASS[,CLASS]...\n");
+	printf("        Also select markers of these classes: locking (high\n"
+	       "        traffic), network (large size), input (records\n"
+	       "        keyboard inputs)\n");
+	printf("  --markers_include PATTERN\n");
+	printf("        Only select markers matching PATTERN, as\n"
+	       "        <channel>/<marker> (ex. 'kernel/*'). Repeatable.\n");
+	printf("  --markers_exclude PATTERN\n");
+	printf("        Leave markers matching PATTERN. Repeatable.\n");
+	printf("  --arm_tap EVENT[,EVENT]...\n");
+	printf("        Start system wide function tracing at these\n"
+	       "        markers and stop it at every other normal rate\n"
+	       "        marker, as ltt-armtap.\n");
+	printf("  --disarm_tap EVENT[,EVENT]...\n");
+	printf("        Disconnect the tap armed with these markers, as\n"
+	       "        ltt-disarmtap. Combined with --arm_tap, only the\n"
+	       "        markers which change role are switched.\n");
+	printf("  --top\n");
+	printf("        Show the throughput, lag and losses of each channel\n"
+	       "        of the trace, refreshed every second, as served by\n"
+	       "        the consumer started with -w.\n");
+	printf("  --pool NUMBER\n");
+	printf("        Keep NUMBER traces named TRACENAME-<n> created and\n"
+	       "        allocated. SIGUSR1 starts the next one and a new one\n"
+	       "        is created in the background. SIGINT or SIGTERM\n"
+	       "        destroys the traces which were not started.\n"
+	       "        With -w, trace TRACENAME-<n> is written to\n"
+	       "        PATH/TRACENAME-<n>\n");
 	printf("\n");
 	printf(" Environment variables:\n");
 	printf("  LTT_DAEMON\n");
-	printf("       Complete path to the lttd binary (needs to be\n");
-	printf("       specified if different than package build prefix).\n");
+	printf("       Complete path to an external lttd binary. When set,\n");
+	printf("       lttctl forks and executes it instead of consuming the\n");
+	printf("       channels itself through liblttd.\n");
+	printf("  LTT_RUNDIR\n");
+	printf("       Directory of the metrics sockets of the consumers,\n");
+	printf("       default " METRICS_RUNDIR_DEFAULT "\n");
 	printf("\n");
 }
 
@@ -390,6 +607,73 @@ static int parst_opt(const char *optarg)
 	return 0;
 }
 
+static int parse_markers_class(const char *optarg)
+{
+	char classes[OPT_VALSTRINGLEN];
+	char *class, *saveptr;
+
+	if (strlen(optarg) >= OPT_VALSTRINGLEN) {
+		fprintf(stderr, "Markers class too long: %s\n", optarg);
+		return -EINVAL;
+	}
+	strcpy(classes, optarg);
+
+	for (class = strtok_r(classes, ",", &saveptr); class;
+	     class = strtok_r(NULL, ",", &saveptr)) {
+		if (!strcmp(class, "locking"))
+			opt_markers.classes |=
+				LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_LOCKING);
+		else if (!strcmp(class, "network"))
+			opt_markers.classes |=
+				LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_NETWORK);
+		else if (!strcmp(class, "input"))
+			opt_markers.classes |=
+				LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_INPUT);
+		else {
+			fprintf(stderr, "Unknown markers class: %s\n", class);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/* Split a comma separated list of events, an empty list is allowed */
+static int parse_tap_events(const char ***events, int *nr_events,
+			    const char *optarg)
+{
+	char *list, *event, *saveptr;
+
+	list = strdup(optarg);
+	if (!list)
+		return -ENOMEM;
+
+	*events = malloc(sizeof(char *) * (strlen(optarg) / 2 + 1));
+	if (!*events) {
+		free(list);
+		return -ENOMEM;
+	}
+	*nr_events = 0;
+	for (event = strtok_r(list, ",", &saveptr); event;
+	     event = strtok_r(NULL, ",", &saveptr))
+		(*events)[(*nr_events)++] = event;
+
+	return 0;
+}
+
+static int add_markers_pattern(const char ***patterns, int *nr_patterns,
+			       const char *pattern)
+{
+	const char **new_patterns;
+
+	new_patterns = realloc(*patterns, sizeof(char *) * (*nr_patterns + 1));
+	if (!new_patterns)
+		return -ENOMEM;
+	new_patterns[(*nr_patterns)++] = pattern;
+	*patterns = new_patterns;
+	return 0;
+}
+
 /* parse_arguments
  *
  * Parses the command line arguments.
@@ -415,6 +699,19 @@ static int parse_arguments(int argc, char **argv)
 		{"append",		no_argument,		NULL,	'a'},
 		{"dump_threads",	required_argument,	NULL,	'n'},
 		{"channel_root",	required_argument,	NULL,	3},
+		{"pool",		required_argument,	NULL,	4},
+		{"drain",		no_argument,		NULL,	5},
+		{"autotune",		required_argument,	NULL,	6},
+		{"target_loss",		required_argument,	NULL,	7},
+		{"mem_budget",		required_argument,	NULL,	8},
+		{"arm_markers",		no_argument,		NULL,	9},
+		{"disarm_markers",	no_argument,		NULL,	10},
+		{"markers_class",	required_argument,	NULL,	11},
+		{"markers_include",	required_argument,	NULL,	12},
+		{"markers_exclude",	required_argument,	NULL,	13},
+		{"arm_tap",		required_argument,	NULL,	14},
+		{"disarm_tap",		required_argument,	NULL,	15},
+		{"top",			no_argument,		NULL,	16},
 		{ NULL,			0,			NULL,	0 },
 	};
 
@@ -505,6 +802,103 @@ static int parse_arguments(int argc, char **argv)
 				return -EINVAL;
 			}
 			break;
+		case 4:
+			if (opt_pool) {
+				fprintf(stderr,
+					"Please specify only 1 pool size\n");
+				return -EINVAL;
+			}
+
+			ret = sscanf(optarg, "%u", &opt_pool);
+			if (ret != 1 || opt_pool == 0) {
+				fprintf(stderr,
+					"Pool size not positive number\n");
+				return -EINVAL;
+			}
+			break;
+		case 5:
+			opt_drain = 1;
+			break;
+		case 6:
+			ret = sscanf(optarg, "%u", &opt_autotune);
+			if (ret != 1 || opt_autotune == 0) {
+				fprintf(stderr,
+					"Autotune time not positive number\n");
+				return -EINVAL;
+			}
+			break;
+		case 7:
+			ret = sscanf(optarg, "%lf", &opt_target_loss);
+			if (ret != 1 || opt_target_loss < 0
+			    || opt_target_loss >= 1) {
+				fprintf(stderr,
+					"Target loss must be between 0 and 1\n");
+				return -EINVAL;
+			}
+			break;
+		case 8:
+		{
+			char *end;
+
+			opt_mem_budget = strtoull(optarg, &end, 0);
+			switch (*end) {
+			case 'G':
+				opt_mem_budget *= 1024;
+				/* fall through */
+			case 'M':
+				opt_mem_budget *= 1024;
+				/* fall through */
+			case 'K':
+				opt_mem_budget *= 1024;
+				end++;
+			}
+			if (end == optarg || *end || !opt_mem_budget) {
+				fprintf(stderr,
+					"Memory budget not positive size\n");
+				return -EINVAL;
+			}
+			break;
+		}
+		case 9:
+			opt_arm_markers = 1;
+			break;
+		case 10:
+			opt_disarm_markers = 1;
+			break;
+		case 11:
+			ret = parse_markers_class(optarg);
+			if (ret)
+				return ret;
+			break;
+		case 12:
+			ret = add_markers_pattern(&opt_markers.include,
+						  &opt_markers.nr_include,
+						  optarg);
+			if (ret)
+				return ret;
+			break;
+		case 13:
+			ret = add_markers_pattern(&opt_markers.exclude,
+						  &opt_markers.nr_exclude,
+						  optarg);
+			if (ret)
+				return ret;
+			break;
+		case 14:
+			ret = parse_tap_events(&opt_arm_tap, &opt_nr_arm_tap,
+					       optarg);
+			if (ret)
+				return ret;
+			break;
+		case 15:
+			ret = parse_tap_events(&opt_disarm_tap,
+					       &opt_nr_disarm_tap, optarg);
+			if (ret)
+				return ret;
+			break;
+		case 16:
+			opt_top = 1;
+			break;
 		case '?':
 			return -EINVAL;
 		default:
@@ -516,6 +910,35 @@ static int parse_arguments(int argc, char **argv)
 	if (opt_help)
 		return 0;
 
+	if (opt_arm_markers && opt_disarm_markers) {
+		fprintf(stderr,
+			"Arm_markers conflicts with disarm_markers\n");
+		return -EINVAL;
+	}
+
+	if ((opt_markers.classes != LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_DEFAULT)
+	     || opt_markers.nr_include || opt_markers.nr_exclude)
+	    && !opt_arm_markers && !opt_disarm_markers) {
+		fprintf(stderr,
+			"Markers_class, markers_include and markers_exclude"
+			" options must be combine with arm_markers or"
+			" disarm_markers option\n");
+		return -EINVAL;
+	}
+
+	/* ltt-disarmall disconnects every class */
+	if (opt_disarm_markers
+	    && opt_markers.classes == LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_DEFAULT))
+		opt_markers.classes = LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_NR_CLASSES)
+			- 1;
+
+	/* Only markers operations */
+	if ((opt_arm_markers || opt_disarm_markers || opt_nr_arm_tap >= 0
+	     || opt_nr_disarm_tap >= 0) && optind == argc
+	    && !opt_create && !opt_start && !opt_destroy && !opt_pause
+	    && !opt_pool && !opt_drain)
+		return 0;
+
 	/* Get tracename */
 	if (optind < argc - 1) {
 		fprintf(stderr, "Please specify only 1 trace name\n");
@@ -530,10 +953,46 @@ static int parse_arguments(int argc, char **argv)
 	/*
 	 * Check arguments
 	 */
-	if (!opt_create && !opt_start && !opt_destroy && !opt_pause) {
+	if (opt_top) {
+		if (opt_create || opt_start || opt_destroy || opt_pause
+		    || opt_pool || opt_drain || opt_write) {
+			fprintf(stderr,
+				"Top conflicts with create, start, destroy,"
+				" pause, pool, drain and write\n");
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	if (!opt_create && !opt_start && !opt_destroy && !opt_pause
+	    && !opt_pool && !opt_drain && !opt_arm_markers
+	    && !opt_disarm_markers && opt_nr_arm_tap < 0
+	    && opt_nr_disarm_tap < 0) {
+		fprintf(stderr,
+			"Please specify a option of create, destroy, start,"
+			" pause, pool, drain, top, arm_markers,"
+			" disarm_markers, arm_tap or disarm_tap\n");
+		return -EINVAL;
+	}
+
+	if (opt_drain && (opt_create || opt_start || opt_destroy
+			  || opt_pause || opt_pool)) {
+		fprintf(stderr,
+			"Drain conflicts with create, start, destroy, pause"
+			" and pool\n");
+		return -EINVAL;
+	}
+
+	if (opt_drain && !opt_write) {
+		fprintf(stderr,
+			"Drain option must be combine with write option\n");
+		return -EINVAL;
+	}
+
+	if (opt_pool && (opt_create || opt_start || opt_destroy || opt_pause)) {
 		fprintf(stderr,
-			"Please specify a option of "
-			"create, destroy, start, or pause\n");
+			"Pool conflicts with create, start, destroy and"
+			" pause\n");
 		return -EINVAL;
 	}
 
@@ -543,13 +1002,13 @@ static int parse_arguments(int argc, char **argv)
 		return -EINVAL;
 	}
 
-	if (opt_create) {
+	if (opt_create || opt_pool) {
 		if (!opt_transport)
 			opt_transport = "relay";
 	}
 
 	if (opt_transport) {
-		if (!opt_create) {
+		if (!opt_create && !opt_pool) {
 			fprintf(stderr,
 				"Transport option must be combine with create"
 				" option\n");
@@ -558,27 +1017,46 @@ static int parse_arguments(int argc, char **argv)
 	}
 
 	if (opt_write) {
-		if (!opt_create && !opt_destroy) {
+		if (!opt_create && !opt_destroy && !opt_pool && !opt_drain) {
 			fprintf(stderr,
-				"Write option must be combine with create or"
-				" destroy option\n");
+				"Write option must be combine with create,"
+				" destroy, pool or drain option\n");
 			return -EINVAL;
 		}
+	}
+
+	if (opt_autotune) {
+		if (!opt_create) {
+			fprintf(stderr,
+				"Autotune option must be combine with create"
+				" option\n");
+			return -EINVAL;
+		}
+	} else if (opt_target_loss || opt_mem_budget) {
+		fprintf(stderr,
+			"Target_loss and mem_budget options must be combine"
+			" with autotune option\n");
+		return -EINVAL;
+	}
 
+	if (opt_write || opt_autotune) {
 		if (!opt_channel_root)
 			if (getdebugfsmntdir(channel_root_default) == 0) {
 				strcat(channel_root_default, "/ltt");
 				opt_channel_root = channel_root_default;
 			} else {
 				fprintf(stderr,
-					"Channel_root is necessary for -w"
-					" option, but neither --channel_root"
+					"Channel_root is necessary for -w and"
+					" --autotune, but neither --channel_root"
 					" option\n"
 					"specified, nor debugfs's mount dir"
 					" found, mount debugfs also failed\n");
 				return -EINVAL;
 			}
 
+		/* Dump flight recorder channels with one thread per CPU */
+		if (opt_dump_threads == 0 && (opt_drain || opt_destroy))
+			opt_dump_threads = sysconf(_SC_NPROCESSORS_ONLN);
 		if (opt_dump_threads == 0)
 			opt_dump_threads = 1;
 	}
@@ -593,19 +1071,19 @@ static int parse_arguments(int argc, char **argv)
 	}
 
 	if (opt_dump_threads) {
-		if (!opt_write) {
+		if (!opt_write && !opt_autotune) {
 			fprintf(stderr,
 				"Dump_threads option must be combine with write"
-				" option\n");
+				" or autotune option\n");
 			return -EINVAL;
 		}
 	}
 
 	if (opt_channel_root) {
-		if (!opt_write) {
+		if (!opt_write && !opt_autotune) {
 			fprintf(stderr,
 				"Channel_root option must be combine with write"
-				" option\n");
+				" or autotune option\n");
 			return -EINVAL;
 		}
 	}
@@ -623,66 +1101,100 @@ static void show_info(void)
 	}
 }
 
-static int lttctl_channel_setup(struct channel_option *opt)
+static int lttctl_channel_attr_add(struct lttctl_channel_attr *attrs,
+				   int nr_attrs, const char *chan_name,
+				   enum lttctl_channel_attr_type type, int value)
+{
+	if (value == -1)
+		return nr_attrs;
+
+	attrs[nr_attrs].channel = chan_name;
+	attrs[nr_attrs].type = type;
+	attrs[nr_attrs].value = value;
+	attrs[nr_attrs].result = 0;
+	return nr_attrs + 1;
+}
+
+/*
+ * Apply every channel option in one liblttctl batch, so the channel directories
+ * of the trace are only looked up once.
+ */
+static int lttctl_channel_setup(const char *tracename)
 {
+	struct lttctl_channel_attr *attrs;
+	struct lttctl_option *opt;
+	struct channel_option *chan_opt;
+	int nr_attrs = 0;
+	int i;
 	int ret;
 
-	if (opt->enable != -1) {
-		if ((ret = lttctl_set_channel_enable(opt_tracename,
-						     opt->chan_name,
-						     opt->enable)) != 0)
-			return ret;
-	} 
-	if (opt->overwrite != -1) {
-		if ((ret = lttctl_set_channel_overwrite(opt_tracename,
-							opt->chan_name,
-							opt->overwrite)) != 0)
-			return ret;
-	}
-	if (opt->bufnum != -1) {
-		if ((ret = lttctl_set_channel_subbuf_num(opt_tracename,
-							 opt->chan_name,
-							 opt->bufnum)) != 0)
-			return ret;
-	}
-	if (opt->bufsize != -1) {
-		if ((ret = lttctl_set_channel_subbuf_size(opt_tracename,
-							  opt->chan_name,
-							  opt->bufsize)) != 0)
-			return ret;
+	for (opt = opt_head; opt; opt = opt->next)
+		if (opt->type == CHANNEL)
+			nr_attrs += 5;
+
+	attrs = malloc(sizeof(*attrs) * (nr_attrs ? nr_attrs : 1));
+	if (!attrs)
+		return -ENOMEM;
+
+	nr_attrs = 0;
+	for (opt = opt_head; opt; opt = opt->next) {
+		if (opt->type != CHANNEL)
+			continue;
+		chan_opt = &opt->opt_mode.chan_opt;
+		nr_attrs = lttctl_channel_attr_add(attrs, nr_attrs,
+			chan_opt->chan_name, LTTCTL_CHANNEL_ENABLE,
+			chan_opt->enable);
+		nr_attrs = lttctl_channel_attr_add(attrs, nr_attrs,
+			chan_opt->chan_name, LTTCTL_CHANNEL_OVERWRITE,
+			chan_opt->overwrite);
+		nr_attrs = lttctl_channel_attr_add(attrs, nr_attrs,
+			chan_opt->chan_name, LTTCTL_CHANNEL_SUBBUF_NUM,
+			chan_opt->bufnum);
+		nr_attrs = lttctl_channel_attr_add(attrs, nr_attrs,
+			chan_opt->chan_name, LTTCTL_CHANNEL_SUBBUF_SIZE,
+			chan_opt->bufsize);
+		nr_attrs = lttctl_channel_attr_add(attrs, nr_attrs,
+			chan_opt->chan_name, LTTCTL_CHANNEL_SWITCH_TIMER,
+			chan_opt->switch_timer);
 	}
-	if (opt->switch_timer != -1) {
-		if ((ret = lttctl_set_channel_switch_timer(opt_tracename,
-				opt->chan_name, opt->switch_timer)) != 0)
-			return ret;
+
+	ret = lttctl_set_channel_attrs(tracename, attrs, nr_attrs);
+	for (i = 0; i < nr_attrs; i++) {
+		static const char *attr_names[] = {
+			[LTTCTL_CHANNEL_ENABLE] = "enable",
+			[LTTCTL_CHANNEL_OVERWRITE] = "overwrite",
+			[LTTCTL_CHANNEL_SUBBUF_NUM] = "bufnum",
+			[LTTCTL_CHANNEL_SUBBUF_SIZE] = "bufsize",
+			[LTTCTL_CHANNEL_SWITCH_TIMER] = "switch_timer",
+		};
+
+		if (attrs[i].result)
+			fprintf(stderr, "Set channel.%s.%s=%u failed\n",
+				attrs[i].channel, attr_names[attrs[i].type],
+				attrs[i].value);
 	}
 
-	return 0;
+	free(attrs);
+	return ret;
 }
 
-static int lttctl_create_trace(void)
+static int lttctl_create_trace(const char *tracename)
 {
 	int ret;
-	int i;
-	struct lttctl_option *opt;
 
-	ret = lttctl_setup_trace(opt_tracename);
+	ret = lttctl_setup_trace(tracename);
 	if (ret)
 		goto setup_trace_fail;
 
-	for (opt = opt_head; opt; opt = opt->next) {
-		if (opt->type != CHANNEL)
-			continue;
-		ret = lttctl_channel_setup(&opt->opt_mode.chan_opt);
-		if (ret)
-			goto set_option_fail;;
-	}
+	ret = lttctl_channel_setup(tracename);
+	if (ret)
+		goto set_option_fail;
 
-	ret = lttctl_set_trans(opt_tracename, opt_transport);
+	ret = lttctl_set_trans(tracename, opt_transport);
 	if (ret)
 		goto set_option_fail;
 
-	ret = lttctl_alloc_trace(opt_tracename);
+	ret = lttctl_alloc_trace(tracename);
 	if (ret)
 		goto alloc_trace_fail;
 
@@ -690,13 +1202,21 @@ static int lttctl_create_trace(void)
 
 alloc_trace_fail:
 set_option_fail:
-	lttctl_destroy_trace(opt_tracename);
+	lttctl_destroy_trace(tracename);
 setup_trace_fail:
 	return ret;
 }
 
+static void lttctl_metrics_path(char *path, const char *tracename)
+{
+	const char *rundir = getenv("LTT_RUNDIR");
+
+	snprintf(path, PATH_MAX, "%s/lttd-%s.sock",
+		 rundir ? rundir : METRICS_RUNDIR_DEFAULT, tracename);
+}
+
 /*
- * Start a lttd daemon to write trace data
+ * Start an external lttd daemon to write trace data
  * Dump overwrite channels on overwrite!=0
  * Dump normal(non-overwrite) channels on overwrite=0
  *
@@ -706,7 +1226,7 @@ setup_trace_fail:
  * ret: 0 on success
  *      !0 on fail
  */
-static int lttctl_daemon(int overwrite)
+static int lttctl_exec_daemon(int overwrite)
 {
 	pid_t pid;
 	int status;
@@ -722,12 +1242,11 @@ static int lttctl_daemon(int overwrite)
 		char *argv[16];
 		int argc = 0;
 		char channel_path[PATH_MAX];
+		char metrics_path[PATH_MAX];
 		char thread_num[16];
 
 		/* prog path */
 		argv[argc] = getenv("LTT_DAEMON");
-		if (argv[argc] == NULL)
-			argv[argc] = PACKAGE_BIN_DIR "/lttd";
 		argc++;
 
 		/* -t option */
@@ -766,13 +1285,18 @@ static int lttctl_daemon(int overwrite)
 		argv[argc] = "-d";
 		argc++;
 
-		/* overwrite option */
+		/* overwrite option, the normal channels serve the metrics */
 		if (overwrite) {
 			argv[argc] = "-f";
 			argc++;
 		} else {
 			argv[argc] = "-n";
 			argc++;
+			lttctl_metrics_path(metrics_path, opt_tracename);
+			argv[argc] = "-m";
+			argc++;
+			argv[argc] = metrics_path;
+			argc++;
 		}
 
 		argv[argc] = NULL;
@@ -810,70 +1334,1376 @@ static int lttctl_daemon(int overwrite)
 	return WEXITSTATUS(status);
 }
 
-int main(int argc, char **argv)
+static struct liblttd_instance *lttctl_new_consumer(const char *tracename,
+		const char *write_path, int overwrite)
 {
-	int ret;
+	char channel_path[PATH_MAX];
+	struct liblttd_callbacks *callbacks;
+	struct liblttd_instance *instance;
 
-	ret = parse_arguments(argc, argv);
-	/* If user needs show help, we disregard other options */
-	if (opt_help) {
-		show_arguments();
-		return 0;
+	snprintf(channel_path, PATH_MAX, "%s/%s", opt_channel_root, tracename);
+
+	/*
+	 * we allow modify of write_path's content in liblttdvfs
+	 * for get rid of warning of assign char * to const char *
+	 */
+	callbacks = liblttdvfs_new_callbacks((char *)write_path, opt_append, 0);
+	if (!callbacks) {
+		fprintf(stderr, "Error in creating the liblttdvfs callbacks\n");
+		return NULL;
 	}
 
-	/* exit program if arguments wrong */
-	if (ret)
-		return 1;
+	instance = liblttd_new_instance(callbacks, channel_path,
+					opt_dump_threads, overwrite,
+					!overwrite, 0);
+	if (!instance) {
+		fprintf(stderr, "Error in creating the liblttd instance\n");
+		free(callbacks->user_data);
+		free(callbacks);
+		return NULL;
+	}
 
-	show_info();
+	return instance;
+}
 
-	ret = lttctl_init();
-	if (ret != 0)
-		return ret;
+/*
+ * Called by liblttd once every channel file is open, before the first
+ * sub-buffer is read. From then on, the trace can be destroyed without losing
+ * the flight recorder buffers.
+ */
+static int lttctl_flight_on_new_thread(struct liblttd_callbacks *data,
+				       unsigned long thread_num)
+{
+	int ret = 0;
 
-	if (opt_create) {
-		printf("lttctl: Creating trace\n");
-		ret = lttctl_create_trace();
-		if (ret)
-			goto op_fail;
+	if (flight_consumer.on_new_thread)
+		ret = flight_consumer.on_new_thread(data, thread_num);
 
-		if (opt_write) {
-			printf("lttctl: Forking lttd\n");
-			ret = lttctl_daemon(0);
-			if (ret)
-				goto op_fail;
-		}
-	}
+	pthread_mutex_lock(&flight_consumer.lock);
+	flight_consumer.ready = 1;
+	pthread_cond_signal(&flight_consumer.cond);
+	pthread_mutex_unlock(&flight_consumer.lock);
 
-	if (opt_start) {
-		printf("lttctl: Starting trace\n");
-		ret = lttctl_start(opt_tracename);
-		if (ret)
-			goto op_fail;
-	}
+	return ret;
+}
 
-	if (opt_pause) {
-		printf("lttctl: Pausing trace\n");
-		ret = lttctl_pause(opt_tracename);
-		if (ret)
-			goto op_fail;
-	}
+/* Report the dump, before liblttdvfs frees its data. */
+static int lttctl_flight_on_trace_end(struct liblttd_instance *instance)
+{
+	struct liblttd_stats *stats = &instance->stats;
+	double duration;
+
+	duration = (stats->end.tv_sec - stats->start.tv_sec)
+		+ (stats->end.tv_nsec - stats->start.tv_nsec) / 1e9;
+	printf("lttctl: Dumped %llu bytes in %.3f s (%.1f MB/s)\n",
+	       stats->bytes, duration,
+	       duration > 0 ? stats->bytes / duration / 1e6 : 0);
+	if (stats->lost)
+		printf("lttctl: %llu sub-buffers corrupted by the writer\n",
+		       stats->lost);
+	if (stats->failed)
+		printf("lttctl: %llu sub-buffers failed to be written\n",
+		       stats->failed);
+
+	return flight_consumer.on_trace_end(instance);
+}
 
-	if (opt_destroy) {
-		if (opt_write) {
-			printf("lttctl: Forking lttd\n");
-			ret = lttctl_daemon(1);
-			if (ret)
-				goto op_fail;
-		}
+static void *lttctl_flight_main(void *arg)
+{
+	int ret;
 
-		printf("lttctl: Destroying trace\n");
-		ret = lttctl_destroy_trace(opt_tracename);
-		if (ret)
-			goto op_fail;
-	}
+	ret = liblttd_start_instance(flight_consumer.instance);
+
+	pthread_mutex_lock(&flight_consumer.lock);
+	flight_consumer.ret = ret;
+	flight_consumer.done = 1;
+	pthread_cond_signal(&flight_consumer.cond);
+	pthread_mutex_unlock(&flight_consumer.lock);
+
+	return NULL;
+}
+
+/* Stop serving the metrics before the instance is deleted */
+static int lttctl_normal_on_trace_end(struct liblttd_instance *instance)
+{
+	liblttd_metrics_stop(normal_metrics);
+	return normal_on_trace_end(instance);
+}
+
+/*
+ * Report how a consumer child ended.
+ *
+ * ret: 0 if it consumed the trace
+ *      !0 on fail
+ */
+static int lttctl_consumer_status(int status)
+{
+	if (!WIFEXITED(status)) {
+		fprintf(stderr, "lttd consumer interrupted\n");
+		return status;
+	}
+
+	if (WEXITSTATUS(status))
+		fprintf(stderr, "lttd consumer running failed\n");
+
+	return WEXITSTATUS(status);
+}
+
+/*
+ * Consume the normal channels in a forked child, without executing lttd.
+ *
+ * The child is not detached: it runs until the trace is destroyed, and the
+ * caller must wait for *pid to get its status.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_normal_consumer(const char *tracename, const char *write_path,
+				  pid_t *pid)
+{
+	struct liblttd_instance *instance;
+	char metrics_path[PATH_MAX];
+	sigset_t sigset;
+
+	/* The child must not write what the parent has buffered again */
+	fflush(stdout);
+	fflush(stderr);
+	*pid = fork();
+	if (*pid < 0) {
+		perror("Error in forking for lttd consumer");
+		return errno;
+	}
+
+	if (*pid == 0) {
+		/* child */
+		/* The trace pool blocks the signals it waits for */
+		sigemptyset(&sigset);
+		sigprocmask(SIG_SETMASK, &sigset, NULL);
+
+		instance = lttctl_new_consumer(tracename, write_path, 0);
+		if (!instance)
+			exit(ENOMEM);
+
+		/* Tracing goes on without metrics */
+		lttctl_metrics_path(metrics_path, tracename);
+		normal_metrics = liblttd_metrics_start(instance, metrics_path);
+		if (normal_metrics) {
+			normal_on_trace_end = instance->callbacks->on_trace_end;
+			instance->callbacks->on_trace_end =
+				lttctl_normal_on_trace_end;
+		}
+
+		exit(liblttd_start_instance(instance) ? 1 : 0);
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for the consumer started by lttctl_normal_consumer(), which ends with
+ * the trace.
+ *
+ * ret: 0 on success
+ *      !0 if the consumer failed
+ */
+static int lttctl_normal_consumer_wait(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) == -1) {
+		perror("Error in waitpid");
+		return errno;
+	}
+
+	return lttctl_consumer_status(status);
+}
+
+/*
+ * Start dumping the flight recorder channels from a thread of this process.
+ *
+ * Returns once every flight recorder channel is open, so the caller can destroy
+ * the trace right away. lttctl_flight_consumer_wait() must then be called to
+ * wait for the end of the dump.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_flight_consumer(void)
+{
+	struct liblttd_callbacks *callbacks;
+	int ret;
+
+	flight_consumer.instance = lttctl_new_consumer(opt_tracename,
+						       opt_write, 1);
+	if (!flight_consumer.instance)
+		return ENOMEM;
+
+	liblttd_set_dump_mode(flight_consumer.instance, 1);
+	callbacks = flight_consumer.instance->callbacks;
+	flight_consumer.on_new_thread = callbacks->on_new_thread;
+	callbacks->on_new_thread = lttctl_flight_on_new_thread;
+	flight_consumer.on_trace_end = callbacks->on_trace_end;
+	callbacks->on_trace_end = lttctl_flight_on_trace_end;
+
+	ret = pthread_create(&flight_consumer.tid, NULL, lttctl_flight_main,
+			     NULL);
+	if (ret) {
+		fprintf(stderr, "Error in creating lttd consumer thread: %s\n",
+			strerror(ret));
+		return ret;
+	}
+	flight_consumer.running = 1;
+
+	pthread_mutex_lock(&flight_consumer.lock);
+	while (!flight_consumer.ready && !flight_consumer.done)
+		pthread_cond_wait(&flight_consumer.cond, &flight_consumer.lock);
+	pthread_mutex_unlock(&flight_consumer.lock);
+
+	/*
+	 * Having no flight recorder channel to dump is not an error, the trace
+	 * still has to be destroyed.
+	 */
+	if (!flight_consumer.ready)
+		fprintf(stderr, "lttd consumer did not dump flight recorder"
+			" channels\n");
+
+	return 0;
+}
+
+/*
+ * Wait for the end of the dump started by lttctl_flight_consumer().
+ *
+ * ret: 0 on success
+ *      !0 if the dump failed
+ */
+static int lttctl_flight_consumer_wait(void)
+{
+	if (!flight_consumer.running)
+		return 0;
+
+	pthread_join(flight_consumer.tid, NULL);
+	flight_consumer.running = 0;
+
+	if (flight_consumer.ret)
+		fprintf(stderr, "lttd consumer failed to dump flight recorder"
+			" channels\n");
+	return flight_consumer.ret;
+}
+
+/*
+ * Consume trace data, either through an external lttd when LTT_DAEMON is set,
+ * or directly through liblttd.
+ * Dump overwrite channels on overwrite!=0
+ * Dump normal(non-overwrite) channels on overwrite=0
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_daemon(int overwrite)
+{
+	if (getenv("LTT_DAEMON"))
+		return lttctl_exec_daemon(overwrite);
+
+	if (overwrite)
+		return lttctl_flight_consumer();
+	else
+		return lttctl_normal_consumer(opt_tracename, opt_write,
+					      &normal_consumer_pid);
+}
+
+/*
+ * Move the current content of the overwrite channels to a new timestamped
+ * directory in opt_write. The trace keeps running, but the sub-buffers written
+ * are consumed : the next drain, or the dump of lttctl -D, only holds what
+ * was written after this one.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_drain(void)
+{
+	char write_path[PATH_MAX];
+	char timestamp[32];
+	struct liblttd_instance *instance;
+	struct timeval tv;
+	struct tm tm;
+	int ret;
+
+	if (mkdir(opt_write, S_IRWXU|S_IRWXG|S_IRWXO) == -1
+	    && errno != EEXIST) {
+		perror(opt_write);
+		return errno;
+	}
+
+	gettimeofday(&tv, NULL);
+	localtime_r(&tv.tv_sec, &tm);
+	strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(write_path, PATH_MAX, "%s/%s-%s.%03ld", opt_write,
+		 opt_tracename, timestamp, (long)tv.tv_usec / 1000);
+
+	instance = lttctl_new_consumer(opt_tracename, write_path, 1);
+	if (!instance)
+		return ENOMEM;
+	liblttd_set_drain_mode(instance, 1);
+
+	printf("lttctl: Draining channels to %s\n", write_path);
+	ret = liblttd_start_instance(instance);
+	if (ret)
+		fprintf(stderr, "Drain failed\n");
+
+	return ret;
+}
+
+/*
+ * Read the metrics served on path. Returns the text, to be freed, or NULL
+ * with errno set.
+ */
+static char *lttctl_top_fetch(const char *path)
+{
+	struct sockaddr_un addr;
+	size_t len = 0, size = 0;
+	char *text = NULL, *new_text;
+	ssize_t ret;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return NULL;
+	/* Any request other than GET gets the bare text */
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+	    || write(fd, "\n", 1) != 1)
+		goto error;
+
+	for (;;) {
+		if (size - len < 4096) {
+			size = size ? 2 * size : 65536;
+			new_text = realloc(text, size);
+			if (!new_text)
+				goto error;
+			text = new_text;
+		}
+		ret = read(fd, text + len, size - len - 1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			goto error;
+		if (ret == 0)
+			break;
+		len += ret;
+	}
+	close(fd);
+	if (!len) {
+		free(text);
+		errno = ENODATA;
+		return NULL;
+	}
+	text[len] = 0;
+	return text;
+
+error:
+	free(text);
+	close(fd);
+	return NULL;
+}
+
+static struct lttctl_top_chan *lttctl_top_chan(const char *path)
+{
+	struct lttctl_top_chan *new_chans;
+	int i;
+
+	for (i = 0; i < nr_top_chans; i++)
+		if (!strcmp(top_chans[i].path, path))
+			return &top_chans[i];
+
+	new_chans = realloc(top_chans, sizeof(*top_chans) * (nr_top_chans + 1));
+	if (!new_chans)
+		return NULL;
+	top_chans = new_chans;
+	memset(&top_chans[i], 0, sizeof(*top_chans));
+	top_chans[i].path = strdup(path);
+	if (!top_chans[i].path)
+		return NULL;
+	nr_top_chans++;
+	return &top_chans[i];
+}
+
+/*
+ * Parse a line of the metrics : name, channel label if any, and value.
+ * Returns 0 if the line is a sample.
+ */
+static int lttctl_top_sample(char *line, char **name, char *channel,
+			     double *value)
+{
+	char *p, *end;
+	int i;
+
+	if (*line == '#' || !*line)
+		return -1;
+	*name = line;
+	channel[0] = 0;
+	p = line + strcspn(line, "{ ");
+	if (*p == '{') {
+		*p++ = 0;
+		if (!strncmp(p, "channel=\"", 9)) {
+			p += 9;
+			for (i = 0; *p && *p != '"' && i < PATH_MAX - 1; i++) {
+				if (*p == '\\' && p[1]) {
+					p++;
+					channel[i] = *p == 'n' ? '\n' : *p;
+				} else {
+					channel[i] = *p;
+				}
+				p++;
+			}
+			channel[i] = 0;
+		}
+		p = strchr(p, '}');
+		if (!p)
+			return -1;
+		p++;
+	} else if (*p) {
+		*p++ = 0;
+	}
+	*value = strtod(p, &end);
+	return end == p ? -1 : 0;
+}
+
+/*
+ * Account the metrics of a refresh. Returns 0 on success.
+ */
+static int lttctl_top_parse(char *text, double *bytes, double *disk_bytes,
+			    double *cpu_time, double *uptime)
+{
+	char channel[PATH_MAX];
+	struct lttctl_top_chan *chan;
+	char *line, *saveptr, *name;
+	double value;
+	int i;
+
+	for (i = 0; i < nr_top_chans; i++) {
+		top_chans[i].prev_bytes = top_chans[i].bytes;
+		top_chans[i].prev_subbufs = top_chans[i].subbufs;
+		top_chans[i].prev_lost = top_chans[i].lost;
+		top_chans[i].prev_urgent = top_chans[i].urgent;
+		top_chans[i].present = 0;
+	}
+
+	for (line = strtok_r(text, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		if (lttctl_top_sample(line, &name, channel, &value))
+			continue;
+		if (!strcmp(name, "lttd_bytes_total"))
+			*bytes = value;
+		else if (!strcmp(name, "lttd_disk_write_bytes_total"))
+			*disk_bytes = value;
+		else if (!strcmp(name, "lttd_cpu_seconds_total"))
+			*cpu_time = value;
+		else if (!strcmp(name, "lttd_uptime_seconds"))
+			*uptime = value;
+		if (strncmp(name, "lttd_channel_", 13) || !channel[0])
+			continue;
+
+		chan = lttctl_top_chan(channel);
+		if (!chan)
+			return -ENOMEM;
+		chan->present = 1;
+		name += 13;
+		if (!strcmp(name, "bytes_total"))
+			chan->bytes = value;
+		else if (!strcmp(name, "subbuffers_total"))
+			chan->subbufs = value;
+		else if (!strcmp(name, "lost_subbuffers_total"))
+			chan->lost = value;
+		else if (!strcmp(name, "urgent_subbuffers_total"))
+			chan->urgent = value;
+		else if (!strcmp(name, "lag_seconds"))
+			chan->lag = value;
+	}
+	return 0;
+}
+
+static int lttctl_top_compare(const void *a, const void *b)
+{
+	const struct lttctl_top_chan *ca = a, *cb = b;
+
+	return strcmp(ca->path, cb->path);
+}
+
+/*
+ * Refreshing view of the channels of the running consumer of opt_tracename.
+ * A channel which reads urgently or loses sub-buffers is falling behind, it is
+ * marked with a '!'.
+ */
+static int lttctl_top(void)
+{
+	char path[PATH_MAX];
+	struct lttctl_top_chan *chan;
+	double bytes = 0, disk_bytes = -1, cpu_time = 0, uptime = 0;
+	double prev_bytes, prev_disk_bytes, prev_cpu_time, interval;
+	struct timespec now, prev = { 0, 0 };
+	char *text;
+	int refreshes, i, ret;
+
+	lttctl_metrics_path(path, opt_tracename);
+	for (refreshes = 0;; refreshes++) {
+		text = lttctl_top_fetch(path);
+		if (!text) {
+			if (!refreshes) {
+				ret = errno;
+				perror(path);
+				fprintf(stderr, "No consumer of trace %s serves"
+					" its metrics\n", opt_tracename);
+				return ret;
+			}
+			printf("lttctl: The consumer of trace %s exited\n",
+			       opt_tracename);
+			return 0;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		prev_bytes = bytes;
+		prev_disk_bytes = disk_bytes;
+		prev_cpu_time = cpu_time;
+		ret = lttctl_top_parse(text, &bytes, &disk_bytes, &cpu_time,
+				       &uptime);
+		free(text);
+		if (ret)
+			return -ret;
+
+		/* The first rates are averages since the start */
+		if (refreshes)
+			interval = (now.tv_sec - prev.tv_sec)
+				+ (now.tv_nsec - prev.tv_nsec) / 1e9;
+		else
+			interval = uptime;
+		if (interval <= 0)
+			interval = 1;
+		if (!refreshes)
+			prev_disk_bytes = disk_bytes;
+		prev = now;
+		qsort(top_chans, nr_top_chans, sizeof(*top_chans),
+		      lttctl_top_compare);
+
+		printf("\033[H\033[2J");
+		printf("Trace %s, consuming for %.0f s\n", opt_tracename,
+		       uptime);
+		printf("Read %.2f MB/s, CPU %.1f%%", (bytes - prev_bytes)
+		       / interval / 1e6,
+		       100 * (cpu_time - prev_cpu_time) / interval);
+		if (disk_bytes >= 0)
+			printf(", disk write %.2f MB/s",
+			       (disk_bytes - prev_disk_bytes) / interval / 1e6);
+		printf("\n\n");
+		printf("  %-32s %10s %10s %8s %10s %8s\n", "CHANNEL", "MB/s",
+		       "SUBBUF/s", "LAG s", "LOST", "URGENT/s");
+		for (i = 0; i < nr_top_chans; i++) {
+			chan = &top_chans[i];
+			if (!chan->present)
+				continue;
+			printf("%c %-32s %10.2f %10.1f %8.3f %10.0f %8.1f\n",
+			       chan->lost > chan->prev_lost
+			       || chan->urgent > chan->prev_urgent ? '!' : ' ',
+			       chan->path,
+			       (chan->bytes - chan->prev_bytes) / interval / 1e6,
+			       (chan->subbufs - chan->prev_subbufs) / interval,
+			       chan->lag, chan->lost,
+			       (chan->urgent - chan->prev_urgent) / interval);
+		}
+		fflush(stdout);
+		sleep(TOP_INTERVAL);
+	}
+}
+
+static unsigned int roundup_pow2(unsigned long long val)
+{
+	unsigned int pow2 = 1;
+
+	while (pow2 < val && pow2 < (1U << 31))
+		pow2 <<= 1;
+	return pow2;
+}
+
+/*
+ * Account the counters of a channel file of the calibration run to its
+ * channel. Channel files are named <channel>_<cpu>.
+ */
+static int lttctl_tune_on_close_channel(struct liblttd_callbacks *data,
+					struct fd_pair *pair)
+{
+	struct lttctl_tune_chan *chan, *new_chans;
+	char name[OPT_NAMELEN];
+	char *p;
+	int i, max;
+
+	p = strrchr(pair->path, '/');
+	strncpy(name, p ? p + 1 : pair->path, OPT_NAMELEN - 1);
+	name[OPT_NAMELEN - 1] = 0;
+	p = strrchr(name, '_');
+	if (p && p[1] && strspn(p + 1, "0123456789") == strlen(p + 1))
+		*p = 0;
+
+	for (i = 0; i < nr_tune_chans; i++)
+		if (!strcmp(tune_chans[i].name, name))
+			break;
+	if (i == nr_tune_chans) {
+		if (nr_tune_chans == max_tune_chans) {
+			max = max_tune_chans ? max_tune_chans * 2 : 16;
+			new_chans = realloc(tune_chans,
+					    sizeof(*tune_chans) * max);
+			if (!new_chans)
+				return -ENOMEM;
+			tune_chans = new_chans;
+			max_tune_chans = max;
+		}
+		memset(&tune_chans[i], 0, sizeof(*tune_chans));
+		strcpy(tune_chans[i].name, name);
+		tune_chans[i].n_sb = pair->n_sb;
+		tune_chans[i].max_sb_size = pair->max_sb_size;
+		nr_tune_chans++;
+	}
+	chan = &tune_chans[i];
+
+	chan->nr_cpus++;
+	if (pair->stats.bytes > chan->max_bytes)
+		chan->max_bytes = pair->stats.bytes;
+	chan->subbufs += pair->stats.subbufs;
+	chan->lost += pair->stats.lost;
+	chan->urgent += pair->stats.urgent;
+	for (i = 0; i < LIBLTTD_FILL_BUCKETS; i++)
+		chan->fill[i] += pair->stats.fill[i];
+	for (i = 0; i < LIBLTTD_INTERVAL_BUCKETS; i++)
+		chan->interval[i] += pair->stats.interval[i];
+
+	return 0;
+}
+
+static void *lttctl_tune_main(void *arg)
+{
+	liblttd_start_instance(arg);
+	return NULL;
+}
+
+/*
+ * Trace for opt_autotune seconds with the current options, and measure the
+ * throughput of every normal channel. The data is discarded, so only the lag
+ * of liblttd itself is measured, not the one of a disk.
+ *
+ * return the duration of the run in seconds on success
+ * return negative errno on fail
+ */
+static double lttctl_autotune_calibrate(void)
+{
+	static struct liblttd_callbacks callbacks = {
+		.on_close_channel = lttctl_tune_on_close_channel,
+	};
+	char tracename[NAME_MAX];
+	char channel_path[PATH_MAX];
+	struct liblttd_instance *instance;
+	struct timespec start, end;
+	pthread_t tid;
+	int ret;
+
+	snprintf(tracename, NAME_MAX, "%s-autotune", opt_tracename);
+	snprintf(channel_path, PATH_MAX, "%s/%s", opt_channel_root, tracename);
+
+	ret = lttctl_create_trace(tracename);
+	if (ret)
+		return ret > 0 ? -ret : ret;
+
+	instance = liblttd_new_instance(&callbacks, channel_path,
+					opt_dump_threads, 0, 1, 0);
+	if (!instance) {
+		fprintf(stderr, "Error in creating the liblttd instance\n");
+		ret = -ENOMEM;
+		goto destroy;
+	}
+
+	ret = pthread_create(&tid, NULL, lttctl_tune_main, instance);
+	if (ret) {
+		fprintf(stderr, "Error in creating the liblttd thread: %s\n",
+			strerror(ret));
+		liblttd_delete_instance(instance);
+		ret = -ret;
+		goto destroy;
+	}
+
+	printf("lttctl: Calibrating with trace %s for %u s\n", tracename,
+	       opt_autotune);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = lttctl_start(tracename);
+	if (!ret)
+		sleep(opt_autotune);
+	lttctl_pause(tracename);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	lttctl_destroy_trace(tracename);
+	pthread_join(tid, NULL);
+	if (ret)
+		return ret > 0 ? -ret : ret;
+
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+destroy:
+	lttctl_destroy_trace(tracename);
+	return ret;
+}
+
+/* Fill level below which half of the sub-buffers of a channel were read */
+static double lttctl_tune_median_fill(struct lttctl_tune_chan *chan)
+{
+	unsigned long long total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < LIBLTTD_FILL_BUCKETS; i++)
+		total += chan->fill[i];
+	if (!total)
+		return 1;
+	for (i = 0; i < LIBLTTD_FILL_BUCKETS; i++) {
+		sum += chan->fill[i];
+		if (2 * sum >= total)
+			break;
+	}
+	return (double)(i + 1) / LIBLTTD_FILL_BUCKETS;
+}
+
+/*
+ * Raise the switch timer of a channel whose sub-buffers were mostly flushed
+ * before being half full, to the time its busiest CPU takes to fill
+ * AUTOTUNE_FILL_TARGET of the new sub-buffer size.
+ */
+static void lttctl_tune_switch_timer(struct lttctl_tune_chan *chan,
+				     double rate)
+{
+	double timer;
+
+	chan->new_switch_timer = -1;
+	if (rate <= 0 || lttctl_tune_median_fill(chan) > AUTOTUNE_MIN_FILL)
+		return;
+	timer = 1000 * AUTOTUNE_FILL_TARGET * chan->new_sb_size / rate;
+	if (timer < AUTOTUNE_MIN_SWITCH_TIMER)
+		timer = AUTOTUNE_MIN_SWITCH_TIMER;
+	if (timer > AUTOTUNE_MAX_SWITCH_TIMER)
+		timer = AUTOTUNE_MAX_SWITCH_TIMER;
+	chan->new_switch_timer = timer;
+}
+
+static unsigned long long lttctl_tune_chan_mem(struct lttctl_tune_chan *chan)
+{
+	return (unsigned long long)chan->new_sb_size * chan->new_n_sb
+		* chan->nr_cpus;
+}
+
+/*
+ * Choose the sub-buffer size so that a channel fills AUTOTUNE_SUBBUF_PER_SEC
+ * sub-buffers per second, and enough sub-buffers to hold AUTOTUNE_HEADROOM
+ * seconds of data. The headroom grows when sub-buffers were lost beyond the
+ * target or read late. Then shrink the biggest channels until the memory
+ * budget is met.
+ */
+static unsigned long long lttctl_autotune_plan(double duration)
+{
+	struct lttctl_tune_chan *chan, *biggest;
+	unsigned long long mem = 0;
+	double rate, headroom, loss;
+	int i;
+
+	for (i = 0; i < nr_tune_chans; i++) {
+		chan = &tune_chans[i];
+
+		/* metadata is mostly written before tracing starts */
+		if (!strcmp(chan->name, "metadata")) {
+			chan->new_sb_size = chan->max_sb_size;
+			chan->new_n_sb = chan->n_sb;
+			chan->new_switch_timer = -1;
+			mem += lttctl_tune_chan_mem(chan);
+			continue;
+		}
+
+		rate = chan->max_bytes / duration;
+		chan->new_sb_size = roundup_pow2(rate / AUTOTUNE_SUBBUF_PER_SEC);
+		if (chan->new_sb_size < AUTOTUNE_MIN_SUBBUF_SIZE)
+			chan->new_sb_size = AUTOTUNE_MIN_SUBBUF_SIZE;
+		if (chan->new_sb_size > AUTOTUNE_MAX_SUBBUF_SIZE)
+			chan->new_sb_size = AUTOTUNE_MAX_SUBBUF_SIZE;
+
+		headroom = AUTOTUNE_HEADROOM;
+		loss = chan->subbufs ?
+			(double)chan->lost / (chan->subbufs + chan->lost) : 0;
+		if (loss > opt_target_loss)
+			headroom *= 4;
+		if (chan->subbufs && chan->urgent * 10 > chan->subbufs)
+			headroom *= 2;
+
+		chan->new_n_sb = roundup_pow2(rate * headroom
+					      / chan->new_sb_size + 1);
+		if (chan->new_n_sb < AUTOTUNE_MIN_SUBBUF_NUM)
+			chan->new_n_sb = AUTOTUNE_MIN_SUBBUF_NUM;
+		if (chan->new_n_sb > AUTOTUNE_MAX_SUBBUF_NUM)
+			chan->new_n_sb = AUTOTUNE_MAX_SUBBUF_NUM;
+
+		mem += lttctl_tune_chan_mem(chan);
+	}
+
+	while (opt_mem_budget && mem > opt_mem_budget) {
+		biggest = NULL;
+		for (i = 0; i < nr_tune_chans; i++) {
+			chan = &tune_chans[i];
+			if (!strcmp(chan->name, "metadata"))
+				continue;
+			if (chan->new_n_sb <= AUTOTUNE_MIN_SUBBUF_NUM
+			    && chan->new_sb_size <= AUTOTUNE_MIN_SUBBUF_SIZE)
+				continue;
+			if (!biggest || lttctl_tune_chan_mem(chan)
+					> lttctl_tune_chan_mem(biggest))
+				biggest = chan;
+		}
+		if (!biggest)
+			break;
+		mem -= lttctl_tune_chan_mem(biggest);
+		if (biggest->new_n_sb > AUTOTUNE_MIN_SUBBUF_NUM)
+			biggest->new_n_sb /= 2;
+		else
+			biggest->new_sb_size /= 2;
+		mem += lttctl_tune_chan_mem(biggest);
+	}
+
+	/* With the final sub-buffer sizes */
+	for (i = 0; i < nr_tune_chans; i++) {
+		chan = &tune_chans[i];
+		if (strcmp(chan->name, "metadata"))
+			lttctl_tune_switch_timer(chan,
+						 chan->max_bytes / duration);
+	}
+
+	return mem;
+}
+
+/*
+ * Print the fill level and interval histograms of the channels, in percent of
+ * their sub-buffers, leaving out the empty buckets.
+ */
+static void lttctl_autotune_histograms(void)
+{
+	struct lttctl_tune_chan *chan;
+	unsigned long long total;
+	int i, j;
+
+	printf("lttctl: Sub-buffer fill level and interval since the previous"
+	       " one, %% of sub-buffers\n");
+	for (i = 0; i < nr_tune_chans; i++) {
+		chan = &tune_chans[i];
+		total = 0;
+		for (j = 0; j < LIBLTTD_FILL_BUCKETS; j++)
+			total += chan->fill[j];
+		if (!total)
+			continue;
+		printf("  %-24s fill    ", chan->name);
+		for (j = 0; j < LIBLTTD_FILL_BUCKETS; j++)
+			if (chan->fill[j])
+				printf(" %d-%d%%:%.1f", 100 * j
+				       / LIBLTTD_FILL_BUCKETS, 100 * (j + 1)
+				       / LIBLTTD_FILL_BUCKETS,
+				       100.0 * chan->fill[j] / total);
+		printf("\n");
+
+		total = 0;
+		for (j = 0; j < LIBLTTD_INTERVAL_BUCKETS; j++)
+			total += chan->interval[j];
+		if (!total)
+			continue;
+		printf("  %-24s interval", "");
+		for (j = 0; j < LIBLTTD_INTERVAL_BUCKETS; j++) {
+			if (!chan->interval[j])
+				continue;
+			if (!j)
+				printf(" <1ms");
+			else if (j == LIBLTTD_INTERVAL_BUCKETS - 1)
+				printf(" >=%ums", 1U << (j - 1));
+			else
+				printf(" %u-%ums", 1U << (j - 1), 1U << j);
+			printf(":%.1f", 100.0 * chan->interval[j] / total);
+		}
+		printf("\n");
+	}
+}
+
+/*
+ * Calibrate, print the plan and add it to the channel options, unless the
+ * user set bufnum or bufsize for the channel explicitly.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_autotune(void)
+{
+	struct lttctl_tune_chan *chan;
+	struct lttctl_option *opt;
+	unsigned long long mem;
+	double duration;
+	int i;
+
+	duration = lttctl_autotune_calibrate();
+	if (duration <= 0) {
+		fprintf(stderr, "Auto-tune calibration failed\n");
+		return duration < 0 ? -duration : EINVAL;
+	}
+	if (!nr_tune_chans) {
+		fprintf(stderr, "Auto-tune found no channel to measure\n");
+		return ENOENT;
+	}
+
+	mem = lttctl_autotune_plan(duration);
+
+	printf("lttctl: Auto-tune plan, %.1f s calibration, target loss %g,"
+	       " %.1f MB of buffers", duration, opt_target_loss, mem / 1e6);
+	if (opt_mem_budget)
+		printf(" (budget %.1f MB)", opt_mem_budget / 1e6);
+	printf("\n");
+	printf("  %-24s %4s %10s %8s %7s %5s %16s %16s %8s\n", "channel",
+	       "cpus", "KB/s", "lost", "urgent", "fill", "current", "new",
+	       "timer_ms");
+	for (i = 0; i < nr_tune_chans; i++) {
+		chan = &tune_chans[i];
+		printf("  %-24s %4u %10.1f %8llu %6.1f%% %4.0f%% %6u x %7u"
+		       " %6u x %7u",
+		       chan->name, chan->nr_cpus,
+		       chan->max_bytes / duration / 1e3, chan->lost,
+		       chan->subbufs ? 100.0 * chan->urgent / chan->subbufs : 0,
+		       100 * lttctl_tune_median_fill(chan),
+		       chan->n_sb, chan->max_sb_size,
+		       chan->new_n_sb, chan->new_sb_size);
+		if (chan->new_switch_timer >= 0)
+			printf(" %8d\n", chan->new_switch_timer);
+		else
+			printf(" %8s\n", "-");
+
+		opt = find_insert_channel_opt(chan->name);
+		if (opt->opt_mode.chan_opt.bufnum == -1)
+			opt->opt_mode.chan_opt.bufnum = chan->new_n_sb;
+		if (opt->opt_mode.chan_opt.bufsize == -1)
+			opt->opt_mode.chan_opt.bufsize = chan->new_sb_size;
+		if (opt->opt_mode.chan_opt.switch_timer == -1
+		    && chan->new_switch_timer >= 0)
+			opt->opt_mode.chan_opt.switch_timer =
+				chan->new_switch_timer;
+	}
+	lttctl_autotune_histograms();
+
+	free(tune_chans);
+	tune_chans = NULL;
+	nr_tune_chans = 0;
+	max_tune_chans = 0;
+
+	return 0;
+}
+
+/*
+ * Connect or disconnect markers, and report the time taken by each class.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_markers(int enable)
+{
+	static const char *class_names[] = {
+		[LTTCTL_MARKERS_DEFAULT] = "default",
+		[LTTCTL_MARKERS_LOCKING] = "locking",
+		[LTTCTL_MARKERS_NETWORK] = "network",
+		[LTTCTL_MARKERS_INPUT] = "input",
+	};
+	struct lttctl_markers_stats stats;
+	long nr_threads;
+	int class;
+	int ret;
+
+	/* The markers of these classes are in their own modules */
+	if (enable && (opt_markers.classes
+		       & LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_LOCKING)))
+		system("modprobe lockdep-trace");
+	if (enable && (opt_markers.classes
+		       & LTTCTL_MARKERS_CLASS(LTTCTL_MARKERS_NETWORK)))
+		system("modprobe net-extended-trace");
+
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	ret = lttctl_set_markers(enable, &opt_markers,
+				 nr_threads > 0 ? nr_threads : 1, &stats);
+
+	printf("lttctl: Markers tree walked in %.3f ms\n",
+	       stats.walk_time / 1e6);
+	for (class = 0; class < LTTCTL_MARKERS_NR_CLASSES; class++) {
+		if (!stats.nr_markers[class])
+			continue;
+		printf("lttctl: %s %u %s markers in %.3f ms",
+		       enable ? "Connected" : "Disconnected",
+		       stats.nr_markers[class] - stats.nr_failed[class],
+		       class_names[class], stats.time[class] / 1e6);
+		if (stats.nr_failed[class])
+			printf(", %u failed", stats.nr_failed[class]);
+		printf("\n");
+	}
+
+	return ret;
+}
+
+/*
+ * Arm, disarm or switch the function tracing tap. /proc/ltt is read once for
+ * each tap and the connections are written in batches.
+ *
+ * ret: 0 on success
+ *      !0 on fail
+ */
+static int lttctl_tap(void)
+{
+	struct lttctl_tap arm, disarm;
+	struct timespec begin, end;
+	int ret;
+
+	if (opt_nr_arm_tap >= 0) {
+		ret = lttctl_tap_init(&arm, opt_arm_tap, opt_nr_arm_tap);
+		if (ret)
+			return ret;
+	}
+	if (opt_nr_disarm_tap >= 0) {
+		ret = lttctl_tap_init(&disarm, opt_disarm_tap,
+				      opt_nr_disarm_tap);
+		if (ret)
+			goto free_arm;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (opt_nr_arm_tap >= 0 && opt_nr_disarm_tap >= 0)
+		ret = lttctl_tap_switch(&disarm, &arm);
+	else if (opt_nr_arm_tap >= 0)
+		ret = lttctl_tap_connect(&arm, 1);
+	else
+		ret = lttctl_tap_connect(&disarm, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!ret)
+		printf("lttctl: Tap %s in %.3f ms\n",
+		       opt_nr_arm_tap < 0 ? "disarmed"
+		       : opt_nr_disarm_tap < 0 ? "armed" : "switched",
+		       (end.tv_sec - begin.tv_sec) * 1e3
+		       + (end.tv_nsec - begin.tv_nsec) / 1e6);
+
+	if (opt_nr_disarm_tap >= 0)
+		lttctl_tap_free(&disarm);
+free_arm:
+	if (opt_nr_arm_tap >= 0)
+		lttctl_tap_free(&arm);
+	return ret;
+}
+
+/*
+ * Create and allocate one trace of the pool, and start consuming its normal
+ * channels when -w is given. lttctl_pool_reap() waits for the consumer.
+ */
+static int lttctl_pool_create(const char *tracename)
+{
+	char write_path[PATH_MAX];
+	pid_t pid;
+	int ret;
+
+	ret = lttctl_create_trace(tracename);
+	if (ret)
+		return ret;
+
+	if (opt_write) {
+		snprintf(write_path, PATH_MAX, "%s/%s", opt_write, tracename);
+		ret = lttctl_normal_consumer(tracename, write_path, &pid);
+		if (ret) {
+			lttctl_destroy_trace(tracename);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Keep the pool full until asked to quit. */
+static void *lttctl_pool_fill(void *arg)
+{
+	char tracename[NAME_MAX];
+	unsigned int last;
+	int ret;
+
+	pthread_mutex_lock(&trace_pool.lock);
+	for (;;) {
+		while (trace_pool.nr_ready == opt_pool && !trace_pool.quit)
+			pthread_cond_wait(&trace_pool.cond, &trace_pool.lock);
+		if (trace_pool.quit)
+			break;
+		snprintf(tracename, NAME_MAX, "%s-%u", opt_tracename,
+			 trace_pool.seq++);
+		pthread_mutex_unlock(&trace_pool.lock);
+
+		ret = lttctl_pool_create(tracename);
+
+		pthread_mutex_lock(&trace_pool.lock);
+		if (ret) {
+			fprintf(stderr, "lttctl: Creating pool trace %s failed,"
+				" stop filling the pool\n", tracename);
+			break;
+		}
+		last = (trace_pool.first + trace_pool.nr_ready) % opt_pool;
+		strcpy(trace_pool.ready[last], tracename);
+		trace_pool.nr_ready++;
+		pthread_cond_broadcast(&trace_pool.cond);
+	}
+	trace_pool.quit = 1;
+	pthread_cond_broadcast(&trace_pool.cond);
+	pthread_mutex_unlock(&trace_pool.lock);
+
+	return NULL;
+}
+
+/*
+ * Report the consumers of the pool which ended, waiting for all of them if
+ * block is set.
+ */
+static void lttctl_pool_reap(int block)
+{
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, block ? 0 : WNOHANG)) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "lttctl: lttd consumer %d: ", pid);
+			lttctl_consumer_status(status);
+		}
+	}
+}
+
+/*
+ * Start the oldest trace of the pool, the fill thread replaces it. Returns
+ * -ENOENT once the pool is empty and no longer filled.
+ */
+static int lttctl_pool_start(void)
+{
+	char tracename[NAME_MAX];
+	int ret;
+
+	pthread_mutex_lock(&trace_pool.lock);
+	if (!trace_pool.nr_ready && !trace_pool.quit)
+		printf("lttctl: Pool empty, waiting for a trace\n");
+	while (!trace_pool.nr_ready && !trace_pool.quit)
+		pthread_cond_wait(&trace_pool.cond, &trace_pool.lock);
+	if (!trace_pool.nr_ready) {
+		pthread_mutex_unlock(&trace_pool.lock);
+		fprintf(stderr, "lttctl: Pool empty and no longer filled,"
+			" stopping\n");
+		return -ENOENT;
+	}
+	strcpy(tracename, trace_pool.ready[trace_pool.first]);
+	trace_pool.first = (trace_pool.first + 1) % opt_pool;
+	trace_pool.nr_ready--;
+	pthread_cond_broadcast(&trace_pool.cond);
+	pthread_mutex_unlock(&trace_pool.lock);
+
+	ret = lttctl_start(tracename);
+	if (ret) {
+		fprintf(stderr, "lttctl: Starting trace %s failed\n",
+			tracename);
+		lttctl_destroy_trace(tracename);
+		return ret;
+	}
+	printf("lttctl: Started trace %s\n", tracename);
+	fflush(stdout);
+
+	return 0;
+}
+
+/*
+ * Keep a pool of ready traces and start them on SIGUSR1. Returns after
+ * SIGINT, SIGTERM or SIGQUIT, once the traces which were not started are
+ * destroyed and the consumers of the others have ended with their traces.
+ */
+static int lttctl_pool(void)
+{
+	pthread_t fill_tid;
+	sigset_t sigset;
+	int signo;
+	int ret;
+
+	trace_pool.ready = malloc(sizeof(*trace_pool.ready) * opt_pool);
+	if (!trace_pool.ready)
+		return -ENOMEM;
+
+	/* Signals are only received through sigwait, in this thread */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGUSR1);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGQUIT);
+	sigaddset(&sigset, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	ret = pthread_create(&fill_tid, NULL, lttctl_pool_fill, NULL);
+	if (ret) {
+		fprintf(stderr, "Error in creating pool thread: %s\n",
+			strerror(ret));
+		goto free_ready;
+	}
+
+	printf("lttctl: Pool of %u traces, send SIGUSR1 to process %d to start"
+	       " the next one\n", opt_pool, getpid());
+	fflush(stdout);
+
+	for (;;) {
+		if (sigwait(&sigset, &signo))
+			continue;
+		if (signo == SIGCHLD) {
+			lttctl_pool_reap(0);
+			continue;
+		}
+		if (signo != SIGUSR1)
+			break;
+		if (lttctl_pool_start() == -ENOENT) {
+			ret = -ENOENT;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&trace_pool.lock);
+	trace_pool.quit = 1;
+	pthread_cond_broadcast(&trace_pool.cond);
+	pthread_mutex_unlock(&trace_pool.lock);
+	pthread_join(fill_tid, NULL);
+
+	for (; trace_pool.nr_ready; trace_pool.nr_ready--) {
+		printf("lttctl: Destroying pool trace %s\n",
+		       trace_pool.ready[trace_pool.first]);
+		lttctl_destroy_trace(trace_pool.ready[trace_pool.first]);
+		trace_pool.first = (trace_pool.first + 1) % opt_pool;
+	}
+
+	if (opt_write) {
+		printf("lttctl: Waiting for the consumers of the started"
+		       " traces\n");
+		fflush(stdout);
+		lttctl_pool_reap(1);
+	}
+
+free_ready:
+	free(trace_pool.ready);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret, dump_ret, consumer_ret;
+
+	ret = parse_arguments(argc, argv);
+	/* If user needs show help, we disregard other options */
+	if (opt_help) {
+		show_arguments();
+		return 0;
+	}
+
+	/* exit program if arguments wrong */
+	if (ret)
+		return 1;
+
+	if (opt_top)
+		return lttctl_top();
+
+	show_info();
+
+	ret = lttctl_init();
+	if (ret != 0)
+		return ret;
+
+	if (opt_arm_markers || opt_disarm_markers) {
+		ret = lttctl_markers(opt_arm_markers);
+		if (ret)
+			goto op_fail;
+	}
+
+	if (opt_nr_arm_tap >= 0 || opt_nr_disarm_tap >= 0) {
+		ret = lttctl_tap();
+		if (ret)
+			goto op_fail;
+	}
+
+	if (opt_pool) {
+		ret = lttctl_pool();
+		goto op_fail;
+	}
+
+	if (opt_drain) {
+		ret = lttctl_drain();
+		goto op_fail;
+	}
+
+	if (opt_autotune) {
+		ret = lttctl_autotune();
+		if (ret)
+			goto op_fail;
+	}
+
+	if (opt_create) {
+		printf("lttctl: Creating trace\n");
+		ret = lttctl_create_trace(opt_tracename);
+		if (ret)
+			goto op_fail;
+
+		if (opt_write) {
+			printf("lttctl: Starting lttd consumer\n");
+			ret = lttctl_daemon(0);
+			if (ret)
+				goto op_fail;
+		}
+	}
+
+	if (opt_start) {
+		printf("lttctl: Starting trace\n");
+		ret = lttctl_start(opt_tracename);
+		if (ret)
+			goto op_fail;
+	}
+
+	if (opt_pause) {
+		printf("lttctl: Pausing trace\n");
+		ret = lttctl_pause(opt_tracename);
+		if (ret)
+			goto op_fail;
+	}
+
+	if (opt_destroy) {
+		if (opt_write) {
+			printf("lttctl: Starting lttd consumer\n");
+			ret = lttctl_daemon(1);
+			if (ret)
+				goto op_fail;
+		}
+
+		printf("lttctl: Destroying trace\n");
+		ret = lttctl_destroy_trace(opt_tracename);
+		dump_ret = lttctl_flight_consumer_wait();
+		if (!ret)
+			ret = dump_ret;
+		if (ret)
+			goto op_fail;
+	}
+
+op_fail:
+	/* The trace is consumed until it is destroyed, even after an error */
+	if (normal_consumer_pid > 0) {
+		printf("lttctl: Consuming trace %s until it is destroyed\n",
+		       opt_tracename);
+		fflush(stdout);
+		consumer_ret = lttctl_normal_consumer_wait(normal_consumer_pid);
+		if (!ret)
+			ret = consumer_ret;
+	}
 
-op_fail:
 	lttctl_destroy();
 
 	return ret;
@@ -0,0 +1,151 @@
+/*
+ * lttd-logdump
+ *
+ * Linux Trace Toolkit Daemon log decoder
+ *
+ * Print the binary log written by lttd -l, one record per line. The flusher
+ * writes the records of each thread in bursts, -s merges the threads in time
+ * order.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <liblttd/liblttdlog.h>
+
+static void show_arguments(void)
+{
+	printf("Usage : lttd-logdump [-s] [-t thread] file\n");
+	printf("\n");
+	printf("-s            Sort the records of all threads by time.\n");
+	printf("-t thread     Only print the records of this thread.\n");
+	printf("\n");
+	printf("The file is read from the standard input if it is -.\n");
+}
+
+static int compare_records(const void *a, const void *b)
+{
+	const struct liblttd_log_record *ra = a, *rb = b;
+
+	if (ra->timestamp != rb->timestamp)
+		return ra->timestamp < rb->timestamp ? -1 : 1;
+	return ra->thread < rb->thread ? -1 : ra->thread > rb->thread;
+}
+
+static void print_record(const struct liblttd_log_record *record, long thread)
+{
+	char line[256];
+
+	if (thread >= 0 && record->thread != thread)
+		return;
+	liblttd_log_format(record, line, sizeof(line));
+	fputs(line, stdout);
+}
+
+int main(int argc, char **argv)
+{
+	struct liblttd_log_header header;
+	struct liblttd_log_record record, *records = NULL, *new_records;
+	size_t num = 0, max = 0, i;
+	long thread = -1;
+	int sort = 0;
+	FILE *file;
+	int c;
+
+	while ((c = getopt(argc, argv, "st:h")) != -1) {
+		switch (c) {
+		case 's':
+			sort = 1;
+			break;
+		case 't':
+			thread = strtol(optarg, NULL, 0);
+			break;
+		default:
+			show_arguments();
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		show_arguments();
+		return 1;
+	}
+
+	if (!strcmp(argv[optind], "-")) {
+		file = stdin;
+	} else {
+		file = fopen(argv[optind], "r");
+		if (!file) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1
+	    || strncmp(header.magic, LIBLTTD_LOG_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s is not an lttd log\n", argv[optind]);
+		return 1;
+	}
+	if (header.version != LIBLTTD_LOG_VERSION
+	    || header.record_size != sizeof(struct liblttd_log_record)) {
+		fprintf(stderr, "Unsupported log version %u, record size %u\n",
+			header.version, header.record_size);
+		return 1;
+	}
+	printf("# %u reader threads, thread %u is the discovery thread\n",
+		header.num_threads, header.num_threads);
+
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		if (!sort) {
+			print_record(&record, thread);
+			continue;
+		}
+		if (num == max) {
+			max = max ? 2 * max : 4096;
+			new_records = realloc(records,
+				max * sizeof(struct liblttd_log_record));
+			if (!new_records) {
+				perror("Error sorting the log");
+				return 1;
+			}
+			records = new_records;
+		}
+		records[num++] = record;
+	}
+	if (ferror(file)) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (sort) {
+		qsort(records, num, sizeof(struct liblttd_log_record),
+			compare_records);
+		for (i = 0; i < num; i++)
+			print_record(&records[i], thread);
+		free(records);
+	}
+	if (file != stdin)
+		fclose(file);
+	return 0;
+}
@@ -0,0 +1,371 @@
+/*
+ * lttd-verify
+ *
+ * Linux Trace Toolkit trace checker
+ *
+ * Check the trace files of a trace against the CRC32C of their sub-buffers,
+ * recorded by lttd -C in the .crc file next to each of them. The sub-buffers
+ * of all the files are split in batches, which the threads check in parallel,
+ * so that a large channel is not checked by one thread alone.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <liblttd/liblttdcrc.h>
+
+/* Sub-buffers checked by a thread at a time */
+#define VERIFY_BATCH	64
+/* Read the trace files this much at a time */
+#define VERIFY_CHUNK	(1024 * 1024)
+
+struct verify_file {
+	char *path;			/* of the trace file */
+	struct liblttd_crc_record *records;
+	unsigned long nr_records;
+	off_t size;
+	unsigned long bad;
+};
+
+struct verify_batch {
+	struct verify_file *file;
+	unsigned long first;
+	unsigned long n;
+};
+
+static struct verify_file *files;
+static unsigned long nr_files, max_files;
+static struct verify_batch *batches;
+static unsigned long nr_batches;
+static unsigned long next_batch;
+static int verbose;
+
+static unsigned long long checked_bytes, checked_subbufs, bad_subbufs;
+static int io_errors;
+
+static void show_arguments(void)
+{
+	printf("Usage : lttd-verify [-j threads] [-v] trace\n");
+	printf("\n");
+	printf("-j threads    Threads checking the trace, one per CPU by "
+		"default.\n");
+	printf("-v            Print every file checked.\n");
+	printf("\n");
+	printf("Returns 0 if the trace is good, 1 if sub-buffers are corrupted "
+		"or missing,\n2 on errors.\n");
+}
+
+/* Load the records of the .crc file path */
+static int load_file(const char *path, const struct stat *crc_stat)
+{
+	struct liblttd_crc_header header;
+	struct verify_file *file, *new_files;
+	struct stat stat_buf;
+	size_t len;
+	FILE *crc;
+	int ret = -1;
+
+	if (nr_files == max_files) {
+		max_files = max_files ? 2 * max_files : 64;
+		new_files = realloc(files, max_files * sizeof(*files));
+		if (!new_files) {
+			perror("Error loading the checksums");
+			return -1;
+		}
+		files = new_files;
+	}
+	file = &files[nr_files];
+	memset(file, 0, sizeof(*file));
+
+	len = strlen(path) - strlen(LIBLTTD_CRC_SUFFIX);
+	file->path = strndup(path, len);
+	if (!file->path)
+		return -1;
+	if (stat(file->path, &stat_buf)) {
+		perror(file->path);
+		goto free_path;
+	}
+	file->size = stat_buf.st_size;
+
+	crc = fopen(path, "r");
+	if (!crc) {
+		perror(path);
+		goto free_path;
+	}
+	if (fread(&header, sizeof(header), 1, crc) != 1
+	    || strncmp(header.magic, LIBLTTD_CRC_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s is not a checksum file\n", path);
+		goto close_crc;
+	}
+	if (header.version != LIBLTTD_CRC_VERSION
+	    || header.record_size != sizeof(struct liblttd_crc_record)) {
+		fprintf(stderr, "%s: unsupported version %u, record size %u\n",
+			path, header.version, header.record_size);
+		goto close_crc;
+	}
+	file->nr_records = (crc_stat->st_size - sizeof(header))
+		/ sizeof(struct liblttd_crc_record);
+	file->records = malloc(file->nr_records
+		* sizeof(struct liblttd_crc_record) + 1);
+	if (!file->records) {
+		perror(path);
+		goto close_crc;
+	}
+	file->nr_records = fread(file->records,
+		sizeof(struct liblttd_crc_record), file->nr_records, crc);
+	if (ferror(crc)) {
+		perror(path);
+		free(file->records);
+		goto close_crc;
+	}
+	nr_files++;
+	ret = 0;
+
+close_crc:
+	fclose(crc);
+free_path:
+	if (ret)
+		free(file->path);
+	return ret;
+}
+
+static int visit(const char *path, const struct stat *stat_buf, int type,
+		 struct FTW *ftw)
+{
+	size_t len = strlen(path), suffix = strlen(LIBLTTD_CRC_SUFFIX);
+
+	if (type != FTW_F || len <= suffix
+	    || strcmp(path + len - suffix, LIBLTTD_CRC_SUFFIX))
+		return 0;
+	if (load_file(path, stat_buf))
+		io_errors = 1;
+	return 0;
+}
+
+static int make_batches(void)
+{
+	unsigned long i, first;
+
+	for (i = 0; i < nr_files; i++)
+		nr_batches += (files[i].nr_records + VERIFY_BATCH - 1)
+			/ VERIFY_BATCH;
+	batches = malloc((nr_batches + 1) * sizeof(struct verify_batch));
+	if (!batches)
+		return -1;
+	nr_batches = 0;
+	for (i = 0; i < nr_files; i++) {
+		for (first = 0; first < files[i].nr_records;
+		     first += VERIFY_BATCH) {
+			batches[nr_batches].file = &files[i];
+			batches[nr_batches].first = first;
+			batches[nr_batches].n = files[i].nr_records - first;
+			if (batches[nr_batches].n > VERIFY_BATCH)
+				batches[nr_batches].n = VERIFY_BATCH;
+			nr_batches++;
+		}
+	}
+	return 0;
+}
+
+/* Returns 1 if the sub-buffer is good, 0 if not, -1 on error */
+static int check_record(int fd, const struct verify_file *file,
+	const struct liblttd_crc_record *record, char *buf)
+{
+	uint32_t crc = 0;
+	uint32_t done, chunk;
+	ssize_t ret;
+
+	if (record->offset + record->len > (uint64_t)file->size) {
+		printf("%s: sub-buffer at %llu, %u bytes: truncated\n",
+			file->path, (unsigned long long)record->offset,
+			record->len);
+		return 0;
+	}
+	for (done = 0; done < record->len; done += ret) {
+		chunk = record->len - done < VERIFY_CHUNK ?
+			record->len - done : VERIFY_CHUNK;
+		ret = pread(fd, buf, chunk, record->offset + done);
+		if (ret <= 0) {
+			if (!ret)
+				errno = EIO;
+			perror(file->path);
+			return -1;
+		}
+		crc = liblttd_crc32c(crc, buf, ret);
+	}
+	if (crc != record->crc) {
+		printf("%s: sub-buffer at %llu, %u bytes: bad CRC32C %08x, "
+			"expected %08x\n", file->path,
+			(unsigned long long)record->offset, record->len, crc,
+			record->crc);
+		return 0;
+	}
+	return 1;
+}
+
+static void *verify_thread(void *arg)
+{
+	struct verify_batch *batch;
+	unsigned long i, b;
+	char *buf;
+	int fd, ret;
+
+	buf = malloc(VERIFY_CHUNK);
+	if (!buf) {
+		perror("Error allocating the read buffer");
+		io_errors = 1;
+		return NULL;
+	}
+	while ((b = __sync_fetch_and_add(&next_batch, 1)) < nr_batches) {
+		batch = &batches[b];
+		fd = open(batch->file->path, O_RDONLY);
+		if (fd == -1) {
+			perror(batch->file->path);
+			io_errors = 1;
+			continue;
+		}
+		for (i = batch->first; i < batch->first + batch->n; i++) {
+			ret = check_record(fd, batch->file,
+				&batch->file->records[i], buf);
+			if (ret < 0) {
+				io_errors = 1;
+				break;
+			}
+			if (!ret) {
+				__sync_fetch_and_add(&batch->file->bad, 1);
+				__sync_fetch_and_add(&bad_subbufs, 1);
+			}
+			__sync_fetch_and_add(&checked_subbufs, 1);
+			__sync_fetch_and_add(&checked_bytes,
+				batch->file->records[i].len);
+		}
+		close(fd);
+	}
+	free(buf);
+	return NULL;
+}
+
+/*
+ * The records follow each other in the trace file. What is after the last
+ * one was written without its checksum, or before lttd -C was used.
+ */
+static unsigned long long unchecked_bytes(const struct verify_file *file)
+{
+	const struct liblttd_crc_record *last;
+	unsigned long long end;
+
+	if (!file->nr_records)
+		return file->size;
+	last = &file->records[file->nr_records - 1];
+	end = last->offset + last->len;
+	return (unsigned long long)file->size > end ? file->size - end : 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long num_threads = 0, i;
+	unsigned long long unchecked = 0, n;
+	pthread_t *tids;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "j:vh")) != -1) {
+		switch (c) {
+		case 'j':
+			num_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			show_arguments();
+			return c == 'h' ? 0 : 2;
+		}
+	}
+	if (optind != argc - 1) {
+		show_arguments();
+		return 2;
+	}
+	if (!num_threads)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!num_threads)
+		num_threads = 1;
+
+	if (nftw(argv[optind], visit, 64, FTW_PHYS)) {
+		perror(argv[optind]);
+		return 2;
+	}
+	if (!nr_files) {
+		fprintf(stderr, "No checksum file in %s, was it written with "
+			"lttd -C ?\n", argv[optind]);
+		return 2;
+	}
+	if (make_batches()) {
+		perror("Error splitting the trace");
+		return 2;
+	}
+	if (num_threads > nr_batches)
+		num_threads = nr_batches ? nr_batches : 1;
+
+	tids = calloc(num_threads, sizeof(pthread_t));
+	if (!tids) {
+		perror("Error creating the threads");
+		return 2;
+	}
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_create(&tids[i], NULL, verify_thread, NULL);
+		if (ret) {
+			fprintf(stderr, "Error creating thread : %s\n",
+				strerror(ret));
+			io_errors = 1;
+			break;
+		}
+	}
+	num_threads = i;
+	for (i = 0; i < num_threads; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+
+	for (i = 0; i < nr_files; i++) {
+		n = unchecked_bytes(&files[i]);
+		unchecked += n;
+		if (verbose)
+			printf("%s: %lu sub-buffers, %lu bad, %llu bytes "
+				"without checksum\n", files[i].path,
+				files[i].nr_records, files[i].bad, n);
+	}
+	printf("%lu files, %llu sub-buffers, %llu bytes checked with CRC32C "
+		"(%s) : %llu bad, %llu bytes without checksum\n", nr_files,
+		checked_subbufs, checked_bytes, liblttd_crc32c_impl(),
+		bad_subbufs, unchecked);
+
+	if (io_errors)
+		return 2;
+	return bad_subbufs ? 1 : 0;
+}
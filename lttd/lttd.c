@@ -38,9 +38,16 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <liblttd/liblttd.h>
 #include <liblttd/liblttdvfs.h>
+#include <liblttd/liblttdmetrics.h>
 
 struct liblttd_instance* instance;
 
@@ -48,10 +55,23 @@ static char		*trace_name = NULL;
 static char		*channel_name = NULL;
 static int		daemon_mode = 0;
 static int		append_mode = 0;
-static unsigned long	num_threads = 1;
+static unsigned long	num_threads = 0;
 static int		dump_flight_only = 0;
+static int		dump_mode = 0;
 static int		dump_normal_only = 0;
 static int		verbose_mode = 0;
+static int		stats_mode = 0;
+static int		locked_mode = 0;
+static int		crc_mode = 0;
+static char		*log_name = NULL;
+static char		*metrics_name = NULL;
+static struct liblttd_metrics *metrics;
+
+#define MAX_SINKS	8
+
+static char		*sink_names[MAX_SINKS];
+static int		sink_fds[MAX_SINKS];
+static unsigned int	nr_sinks = 0;
 
 
 /* Args :
@@ -60,7 +80,16 @@ static int		verbose_mode = 0;
  * -c directory		Root directory of the debugfs trace channels.
  * -d          		Run in background (daemon).
  * -a			Trace append mode.
+ * -F			Dump flight recorder channels of a trace being destroyed.
  * -s			Send SIGUSR1 to parent when ready for IO.
+ * -S			Print the consumer statistics at exit, and the lock
+ *			contention of each thread.
+ * -L			Lock the channels even with a single thread.
+ * -l file		Write the binary self-log of the threads to file.
+ * -m socket		Serve the metrics on a UNIX socket.
+ * -o sink		Also send the sub-buffers to tcp:HOST:PORT, unix:PATH or a
+ *			file. Repeatable.
+ * -C			Record the CRC32C of each sub-buffer next to its trace file.
  */
 void show_arguments(void)
 {
@@ -73,8 +102,25 @@ void show_arguments(void)
 	printf("-a            Append to an possibly existing trace.\n");
 	printf("-N            Number of threads to start.\n");
 	printf("-f            Dump only flight recorder channels.\n");
+	printf("-F            Dump the flight recorder channels of a trace\n"
+				 "              being destroyed, one thread per CPU unless\n"
+				 "              -N is given, and report the dump time.\n");
 	printf("-n            Dump only normal channels.\n");
 	printf("-v            Verbose mode.\n");
+	printf("-S            Print the consumer statistics at exit, and the\n"
+				 "              lock contention of each thread.\n");
+	printf("-L            Lock the channels even with a single thread, to\n"
+				 "              measure the cost of the multi-thread reader.\n");
+	printf("-l file       Write the binary log of the threads to file, see\n"
+				 "              lttd-logdump.\n");
+	printf("-m socket     Serve the metrics in the Prometheus text format\n"
+				 "              on this UNIX socket.\n");
+	printf("-o sink       Also send the sub-buffers to tcp:HOST:PORT,\n"
+				 "              unix:PATH, or a file or FIFO. Sinks which\n"
+				 "              do not keep up drop sub-buffers. Up to %d.\n",
+				 MAX_SINKS);
+	printf("-C            Record the CRC32C of each sub-buffer in a .crc\n"
+				 "              file next to its trace file, see lttd-verify.\n");
 	printf("\n");
 }
 
@@ -129,12 +175,46 @@ int parse_arguments(int argc, char **argv)
 					case 'f':
 						dump_flight_only = 1;
 						break;
+					case 'F':
+						dump_flight_only = 1;
+						dump_mode = 1;
+						break;
 					case 'n':
 						dump_normal_only = 1;
 						break;
 					case 'v':
 						verbose_mode = 1;
 						break;
+					case 'S':
+						stats_mode = 1;
+						break;
+					case 'L':
+						locked_mode = 1;
+						break;
+					case 'C':
+						crc_mode = 1;
+						break;
+					case 'l':
+						if(argn+1 < argc) {
+							log_name = argv[argn+1];
+							argn++;
+						}
+						break;
+					case 'm':
+						if(argn+1 < argc) {
+							metrics_name = argv[argn+1];
+							argn++;
+						}
+						break;
+					case 'o':
+						if(argn+1 < argc && nr_sinks < MAX_SINKS) {
+							sink_names[nr_sinks++] = argv[argn+1];
+							argn++;
+						} else {
+							printf("Too many sinks.\n");
+							ret = -1;
+						}
+						break;
 					default:
 						printf("Invalid argument '%s'.\n", argv[argn]);
 						printf("\n");
@@ -161,6 +241,13 @@ int parse_arguments(int argc, char **argv)
 		ret = -1;
 	}
 
+	if(num_threads == 0) {
+		if(dump_mode)
+			num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		else
+			num_threads = 1;
+	}
+
 	return ret;
 }
 
@@ -174,6 +261,154 @@ void show_info(void)
 }
 
 
+/*
+ * Report of the dump mode and of -S, called before liblttdvfs frees its data.
+ * The metrics exporter stops there, before the instance is deleted.
+ */
+
+static int (*vfs_on_trace_end)(struct liblttd_instance *instance);
+
+/*
+ * Contention of the reader threads on the channel locks, and their cost : CPU
+ * time and system calls per sub-buffer in each phase of a read.
+ */
+static void report_threads(struct liblttd_instance *instance)
+{
+	struct liblttd_thread_stats *tstats;
+	unsigned long i;
+	double subbufs;
+
+	for (i = 0; i < instance->num_threads; i++) {
+		tstats = &instance->thread_stats[i];
+		printf("Thread %lu : %llu polls, %llu reads, "
+			"%llu/%llu trylocks failed (%.1f%%), "
+			"%.3f ms waiting for fd_pairs_lock (max %.3f ms)\n",
+			i, tstats->polls, tstats->reads,
+			tstats->trylock_failed, tstats->trylocks,
+			tstats->trylocks ?
+				100.0 * tstats->trylock_failed / tstats->trylocks
+				: 0,
+			tstats->rwlock_wait / 1e6, tstats->rwlock_max / 1e6);
+		subbufs = tstats->subbufs ? tstats->subbufs : 1;
+		printf("Thread %lu : %.3f s CPU, %llu sub-buffers, syscalls "
+			"per sub-buffer : poll %.2f, reserve %.2f, "
+			"callback %.2f, release %.2f\n",
+			i, tstats->cpu_time / 1e9, tstats->subbufs,
+			tstats->syscalls[LIBLTTD_PHASE_POLL] / subbufs,
+			tstats->syscalls[LIBLTTD_PHASE_RESERVE] / subbufs,
+			tstats->syscalls[LIBLTTD_PHASE_CALLBACK] / subbufs,
+			tstats->syscalls[LIBLTTD_PHASE_RELEASE] / subbufs);
+	}
+}
+
+static void report(struct liblttd_instance *instance)
+{
+	struct liblttd_stats *stats = &instance->stats;
+	double duration;
+
+	duration = (stats->end.tv_sec - stats->start.tv_sec)
+		+ (stats->end.tv_nsec - stats->start.tv_nsec) / 1e9;
+	printf("%s %llu bytes in %llu sub-buffers in %.3f s (%.1f MB/s)\n",
+		dump_mode ? "Dumped" : "Consumed",
+		stats->bytes, stats->subbufs, duration,
+		duration > 0 ? stats->bytes / duration / 1e6 : 0);
+	if (stats->lost || stats_mode)
+		printf("%llu sub-buffers corrupted by the writer\n",
+			stats->lost);
+	if (stats->failed || stats_mode)
+		printf("%llu sub-buffers failed to be written\n",
+			stats->failed);
+	printf("%.3f s of CPU time (%.3f s per GB)\n", stats->cpu_time / 1e9,
+		stats->bytes ? stats->cpu_time / 1e9 / (stats->bytes / 1e9) : 0);
+	if (stats_mode)
+		report_threads(instance);
+}
+
+static void report_sinks(struct liblttd_instance *instance)
+{
+	struct liblttdvfs_sink_stats stats;
+	const char *name;
+	unsigned int i;
+
+	for (i = 0; !liblttdvfs_get_sink_stats(instance->callbacks, i, &name,
+					       &stats); i++)
+		printf("Sink %s : %llu sub-buffers (%llu bytes) sent, "
+			"%llu dropped, %llu errors\n", name, stats.subbufs,
+			stats.bytes, stats.dropped, stats.errors);
+}
+
+static int lttd_on_trace_end(struct liblttd_instance *instance)
+{
+	liblttd_metrics_stop(metrics);
+	if (nr_sinks)
+		report_sinks(instance);
+	if (dump_mode || stats_mode)
+		report(instance);
+	return vfs_on_trace_end(instance);
+}
+
+/*
+ * Connect to a sink : tcp:HOST:PORT, unix:PATH, or a file or FIFO.
+ *
+ * Returns the file descriptor, or -1.
+ */
+static int open_sink(const char *name)
+{
+	struct addrinfo hints, *res, *ai;
+	struct sockaddr_un addr;
+	char *host, *port;
+	int fd = -1, ret;
+
+	if (!strncmp(name, "tcp:", 4)) {
+		host = strdup(name + 4);
+		if (!host)
+			return -1;
+		port = strrchr(host, ':');
+		if (!port) {
+			fprintf(stderr, "%s : missing port\n", name);
+			free(host);
+			return -1;
+		}
+		*port++ = 0;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		ret = getaddrinfo(host, port, &hints, &res);
+		free(host);
+		if (ret) {
+			fprintf(stderr, "%s : %s\n", name, gai_strerror(ret));
+			return -1;
+		}
+		for (ai = res; ai; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype,
+				    ai->ai_protocol);
+			if (fd == -1)
+				continue;
+			if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+	} else if (!strncmp(name, "unix:", 5)) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, name + 5, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd != -1 && connect(fd, (struct sockaddr *)&addr,
+					sizeof(addr)) == -1) {
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		fd = open(name, O_WRONLY | O_CREAT
+			  | (append_mode ? O_APPEND : O_TRUNC), 0644);
+	}
+	if (fd == -1)
+		perror(name);
+	return fd;
+}
+
 /* signal handling */
 
 static void handler(int signo)
@@ -185,6 +420,9 @@ static void handler(int signo)
 int main(int argc, char ** argv)
 {
 	int ret = 0;
+	int log_fd = -1;
+	char *cwd;
+	unsigned int i;
 	struct sigaction act;
 
 	ret = parse_arguments(argc, argv);
@@ -206,6 +444,32 @@ int main(int argc, char ** argv)
 	sigaction(SIGQUIT, &act, NULL);
 	sigaction(SIGINT, &act, NULL);
 
+	/* Before the daemon leaves the current directory */
+	for(i = 0; i < nr_sinks; i++) {
+		sink_fds[i] = open_sink(sink_names[i]);
+		if(sink_fds[i] == -1)
+			return EINVAL;
+	}
+	/* A sink which goes away fails on its own, it does not kill lttd */
+	if(nr_sinks)
+		signal(SIGPIPE, SIG_IGN);
+	if(log_name) {
+		log_fd = open(log_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(log_fd == -1) {
+			perror(log_name);
+			return errno;
+		}
+	}
+	if(metrics_name && metrics_name[0] != '/') {
+		cwd = get_current_dir_name();
+		if(!cwd || asprintf(&metrics_name, "%s/%s", cwd,
+				    metrics_name) == -1) {
+			perror("Error getting the metrics socket path");
+			return ENOMEM;
+		}
+		free(cwd);
+	}
+
 	if(daemon_mode) {
 		ret = daemon(0, 0);
 
@@ -218,6 +482,16 @@ int main(int argc, char ** argv)
 	struct liblttd_callbacks* callbacks =
 		liblttdvfs_new_callbacks(trace_name, append_mode, verbose_mode);
 
+	for(i = 0; i < nr_sinks; i++) {
+		if(!callbacks
+		   || liblttdvfs_add_sink(callbacks, sink_names[i], sink_fds[i])) {
+			perror(sink_names[i]);
+			return errno;
+		}
+	}
+	if(callbacks && crc_mode)
+		liblttdvfs_set_crc(callbacks, 1);
+
 	instance = liblttd_new_instance(callbacks, channel_name, num_threads,
 					dump_flight_only, dump_normal_only,
 					verbose_mode);
@@ -227,7 +501,27 @@ int main(int argc, char ** argv)
 		return ret;
 	}
 
+	if(dump_mode)
+		liblttd_set_dump_mode(instance, 1);
+	if(locked_mode)
+		liblttd_set_single_reader(instance, 0);
+	if(log_fd >= 0)
+		liblttd_set_log(instance, log_fd);
+	if(dump_mode || stats_mode || metrics_name || nr_sinks) {
+		vfs_on_trace_end = callbacks->on_trace_end;
+		callbacks->on_trace_end = lttd_on_trace_end;
+	}
+	if(metrics_name) {
+		metrics = liblttd_metrics_start(instance, metrics_name);
+		if(!metrics) {
+			perror(metrics_name);
+			return errno;
+		}
+	}
+
 	liblttd_start_instance(instance);
+	if(log_fd >= 0)
+		close(log_fd);
 
 	return ret;
 }
@@ -0,0 +1,213 @@
+/*
+ * lttctl-bench
+ *
+ * Linux Trace Toolkit control benchmark
+ *
+ * Time each liblttctl operation of a tracing session : setup, channel
+ * configuration (batched, and one call per attribute as done before the
+ * batch), allocation, start, pause and destroy. Run it over the debugfs
+ * stand-in of liblttdsim, see lttctl-bench.sh.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <liblttctl/lttctl.h>
+
+#define TRACE_NAME	"lttctl-bench"
+
+enum bench_op {
+	OP_SETUP,
+	OP_TRANS,
+	OP_ATTRS,
+	OP_ATTRS_LEGACY,
+	OP_ALLOC,
+	OP_START,
+	OP_PAUSE,
+	OP_DESTROY,
+	NR_OPS,
+};
+
+static const char *op_names[NR_OPS] = {
+	[OP_SETUP] = "setup",
+	[OP_TRANS] = "set_trans",
+	[OP_ATTRS] = "channel_attrs",
+	[OP_ATTRS_LEGACY] = "channel_attrs_legacy",
+	[OP_ALLOC] = "alloc",
+	[OP_START] = "start",
+	[OP_PAUSE] = "pause",
+	[OP_DESTROY] = "destroy",
+};
+
+struct bench_time {
+	double sum;
+	double min;
+	double max;
+};
+
+static struct bench_time times[NR_OPS];
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void account(enum bench_op op, double begin)
+{
+	double t = now_us() - begin;
+
+	times[op].sum += t;
+	if (!times[op].min || t < times[op].min)
+		times[op].min = t;
+	if (t > times[op].max)
+		times[op].max = t;
+}
+
+/* The channel options lttctl sets by default, and a typical buffer setup */
+static int set_attrs(void)
+{
+	struct lttctl_channel_attr attrs[] = {
+		{ "all", LTTCTL_CHANNEL_ENABLE, 1 },
+		{ "all", LTTCTL_CHANNEL_OVERWRITE, 0 },
+		{ "all", LTTCTL_CHANNEL_SUBBUF_NUM, 4 },
+		{ "all", LTTCTL_CHANNEL_SUBBUF_SIZE, 262144 },
+		{ "all", LTTCTL_CHANNEL_SWITCH_TIMER, 100 },
+	};
+
+	return lttctl_set_channel_attrs(TRACE_NAME, attrs,
+					sizeof(attrs) / sizeof(attrs[0]));
+}
+
+static int set_attrs_legacy(void)
+{
+	return lttctl_set_channel_enable(TRACE_NAME, "all", 1)
+		|| lttctl_set_channel_overwrite(TRACE_NAME, "all", 0)
+		|| lttctl_set_channel_subbuf_num(TRACE_NAME, "all", 4)
+		|| lttctl_set_channel_subbuf_size(TRACE_NAME, "all", 262144)
+		|| lttctl_set_channel_switch_timer(TRACE_NAME, "all", 100);
+}
+
+static int run_session(void)
+{
+	double begin;
+
+	begin = now_us();
+	if (lttctl_setup_trace(TRACE_NAME))
+		return -1;
+	account(OP_SETUP, begin);
+
+	begin = now_us();
+	if (lttctl_set_trans(TRACE_NAME, "relay"))
+		return -1;
+	account(OP_TRANS, begin);
+
+	begin = now_us();
+	if (set_attrs_legacy())
+		return -1;
+	account(OP_ATTRS_LEGACY, begin);
+
+	begin = now_us();
+	if (set_attrs())
+		return -1;
+	account(OP_ATTRS, begin);
+
+	begin = now_us();
+	if (lttctl_alloc_trace(TRACE_NAME))
+		return -1;
+	account(OP_ALLOC, begin);
+
+	begin = now_us();
+	if (lttctl_start(TRACE_NAME))
+		return -1;
+	account(OP_START, begin);
+
+	begin = now_us();
+	if (lttctl_pause(TRACE_NAME))
+		return -1;
+	account(OP_PAUSE, begin);
+
+	begin = now_us();
+	if (lttctl_destroy_trace(TRACE_NAME))
+		return -1;
+	account(OP_DESTROY, begin);
+
+	return 0;
+}
+
+static void show_arguments(void)
+{
+	printf("Usage : lttctl-bench [-r REPEAT]\n");
+	printf("\n");
+	printf("-r REPEAT     Number of sessions timed, default 100.\n");
+	printf("\n");
+	printf("The debugfs root is taken from LTT_DEBUGFS.\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long repeat = 100;
+	unsigned long i;
+	int op;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:h")) != -1) {
+		switch (c) {
+		case 'r':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			show_arguments();
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!repeat) {
+		show_arguments();
+		return 1;
+	}
+
+	if (lttctl_init())
+		return 1;
+
+	for (i = 0; i < repeat; i++) {
+		if (run_session()) {
+			fprintf(stderr, "Session %lu failed\n", i);
+			lttctl_destroy_trace(TRACE_NAME);
+			return 1;
+		}
+	}
+
+	printf("%-22s %12s %12s %12s\n", "operation", "avg_us", "min_us",
+	       "max_us");
+	for (op = 0; op < NR_OPS; op++)
+		printf("%-22s %12.1f %12.1f %12.1f\n", op_names[op],
+		       times[op].sum / repeat, times[op].min, times[op].max);
+
+	lttctl_destroy();
+	return 0;
+}
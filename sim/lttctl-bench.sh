@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# lttctl-bench
+#
+# Time the liblttctl session operations over the debugfs stand-in of
+# liblttdsim, for several channel counts.
+#
+# Usage : lttctl-bench.sh liblttdsim.so lttctl-bench
+#
+# Set with these variables :
+#   BENCH_CHANNELS	channels per trace (default "8 64 256")
+#   BENCH_REPEAT	sessions timed per channel count (default 100)
+#   BENCH_DEBUGFS	parent directory of the stand-in (default ${TMPDIR:-/tmp})
+#
+# Copyright 2026 - The LTTng developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+SIM=$1
+BENCH=$2
+
+if [ -z "$SIM" ] || [ -z "$BENCH" ]; then
+	echo "Usage : $0 liblttdsim.so lttctl-bench" >&2
+	exit 1
+fi
+
+: ${BENCH_CHANNELS:="8 64 256"}
+: ${BENCH_REPEAT:=100}
+: ${BENCH_DEBUGFS:=${TMPDIR:-/tmp}}
+
+DEBUGFS=$BENCH_DEBUGFS/lttdsim-debugfs.$$
+STATUS=0
+
+for CHANNELS in $BENCH_CHANNELS; do
+	echo "$CHANNELS channels :"
+	env LD_PRELOAD=$SIM LTTDSIM_DEBUGFS=$DEBUGFS LTT_DEBUGFS=$DEBUGFS \
+		LTTDSIM_DEBUGFS_CHANNELS=$CHANNELS \
+		$BENCH -r $BENCH_REPEAT || STATUS=1
+	echo
+done
+
+exit $STATUS
@@ -0,0 +1,267 @@
+/*
+ * lttd-sinkbench
+ *
+ * Read the channels with the same sinks, composed at compile time by
+ * liblttd::pipeline or called through a chain of function pointers built at
+ * run time, the way C callbacks would be. Run over the relay channel
+ * simulator by lttdsim-sinkbench.sh.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <liblttd/liblttd.hpp>
+
+static struct liblttd_stats stats;
+
+/* Keeps the counters of the instance, before it is deleted */
+struct stats_sink : liblttd::sink {
+	void end(struct liblttd_instance *instance)
+	{
+		liblttd_get_stats(instance, &stats, NULL);
+	}
+};
+
+/*
+ * The run time chain. Each sink is called through its entry, with its state
+ * of the channel allocated apart.
+ */
+struct dynamic_entry {
+	void *sink;
+	int (*folder)(void *sink, const char *path);
+	void *(*open)(void *sink, struct fd_pair *pair, const char *path);
+	int (*consume)(void *sink, void *c, struct fd_pair *pair,
+		       const char *data, size_t len);
+	void (*close)(void *sink, void *c, struct fd_pair *pair);
+	void (*end)(void *sink, struct liblttd_instance *instance);
+};
+
+template <class S>
+struct dynamic_ops {
+	typedef typename S::channel channel;
+
+	static int folder(void *sink, const char *path)
+	{
+		return static_cast<S *>(sink)->folder(path);
+	}
+	static void *open(void *sink, struct fd_pair *pair, const char *path)
+	{
+		channel *c = new channel();
+
+		if (static_cast<S *>(sink)->open(*c, pair, path)) {
+			delete c;
+			return NULL;
+		}
+		return c;
+	}
+	static int consume(void *sink, void *c, struct fd_pair *pair,
+			   const char *data, size_t len)
+	{
+		return static_cast<S *>(sink)->consume(
+			*static_cast<channel *>(c), pair, data, len);
+	}
+	static void close(void *sink, void *c, struct fd_pair *pair)
+	{
+		static_cast<S *>(sink)->close(*static_cast<channel *>(c), pair);
+		delete static_cast<channel *>(c);
+	}
+	static void end(void *sink, struct liblttd_instance *instance)
+	{
+		static_cast<S *>(sink)->end(instance);
+	}
+
+	static struct dynamic_entry entry(S *sink)
+	{
+		struct dynamic_entry e = {
+			sink, folder, open, consume, close, end
+		};
+		return e;
+	}
+};
+
+#define MAX_DYNAMIC	8
+
+static struct dynamic_entry dynamic[MAX_DYNAMIC];
+static unsigned int nr_dynamic;
+
+static int dynamic_open_channel(struct liblttd_callbacks *data,
+	struct fd_pair *pair, char *path)
+{
+	void **c = (void **)calloc(nr_dynamic, sizeof(void *));
+	unsigned int i;
+
+	if (!c)
+		return -1;
+	for (i = 0; i < nr_dynamic; i++) {
+		c[i] = dynamic[i].open(dynamic[i].sink, pair, path);
+		if (!c[i])
+			goto error;
+	}
+	pair->user_data = c;
+	return 0;
+
+error:
+	while (i-- > 0)
+		dynamic[i].close(dynamic[i].sink, c[i], pair);
+	free(c);
+	return -1;
+}
+
+static int dynamic_close_channel(struct liblttd_callbacks *data,
+	struct fd_pair *pair)
+{
+	void **c = (void **)pair->user_data;
+	unsigned int i;
+
+	for (i = nr_dynamic; i-- > 0;)
+		dynamic[i].close(dynamic[i].sink, c[i], pair);
+	free(c);
+	return 0;
+}
+
+static int dynamic_new_channels_folder(struct liblttd_callbacks *data,
+	char *path)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_dynamic; i++)
+		if (dynamic[i].folder(dynamic[i].sink, path))
+			return -1;
+	return 0;
+}
+
+static int dynamic_read_subbuffer(struct liblttd_callbacks *data,
+	struct fd_pair *pair, unsigned int len)
+{
+	void **c = (void **)pair->user_data;
+	const char *buf;
+	unsigned int i;
+
+	if (liblttd::read_subbuffer(pair, len, &buf))
+		return -1;
+	for (i = 0; i < nr_dynamic; i++)
+		if (dynamic[i].consume(dynamic[i].sink, c[i], pair, buf, len))
+			return -1;
+	return 0;
+}
+
+static int dynamic_close_thread(struct liblttd_callbacks *data,
+	unsigned long thread_num)
+{
+	liblttd::close_reader();
+	return 0;
+}
+
+static int dynamic_trace_end(struct liblttd_instance *instance)
+{
+	unsigned int i;
+
+	for (i = nr_dynamic; i-- > 0;)
+		dynamic[i].end(dynamic[i].sink, instance);
+	return 0;
+}
+
+template <class S>
+static void add_dynamic(S *sink)
+{
+	dynamic[nr_dynamic++] = dynamic_ops<S>::entry(sink);
+}
+
+static void show_arguments(void)
+{
+	printf("Usage : lttd-sinkbench [-N threads] [-d] channels trace\n");
+	printf("\n");
+	printf("-N threads    Reader threads.\n");
+	printf("-d            Call the sinks through function pointers, instead "
+		"of the pipeline\n");
+	printf("              composed at compile time.\n");
+	printf("\n");
+	printf("The sinks write the trace files, their .idx and .crc files.\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long num_threads = 1;
+	int use_dynamic = 0;
+	struct liblttd_callbacks callbacks;
+	struct liblttd_instance *instance;
+	int c;
+
+	while ((c = getopt(argc, argv, "N:dh")) != -1) {
+		switch (c) {
+		case 'N':
+			num_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			use_dynamic = 1;
+			break;
+		default:
+			show_arguments();
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 2) {
+		show_arguments();
+		return 1;
+	}
+
+	liblttd::file_sink file(argv[optind + 1]);
+	liblttd::index_sink index(argv[optind + 1]);
+	liblttd::checksum_sink checksum(argv[optind + 1]);
+	stats_sink counters;
+	liblttd::pipeline<liblttd::file_sink, liblttd::index_sink,
+		liblttd::checksum_sink, stats_sink>
+		pipeline(file, index, checksum, counters);
+
+	if (use_dynamic) {
+		add_dynamic(&file);
+		add_dynamic(&index);
+		add_dynamic(&checksum);
+		add_dynamic(&counters);
+		memset(&callbacks, 0, sizeof(callbacks));
+		callbacks.on_open_channel = dynamic_open_channel;
+		callbacks.on_close_channel = dynamic_close_channel;
+		callbacks.on_new_channels_folder = dynamic_new_channels_folder;
+		callbacks.on_read_subbuffer = dynamic_read_subbuffer;
+		callbacks.on_close_thread = dynamic_close_thread;
+		callbacks.on_trace_end = dynamic_trace_end;
+	}
+
+	instance = liblttd_new_instance(
+		use_dynamic ? &callbacks : pipeline.callbacks(), argv[optind],
+		num_threads, 0, 0, 0);
+	if (!instance) {
+		fprintf(stderr, "Error creating the instance\n");
+		return 1;
+	}
+	if (liblttd_start_instance(instance))
+		return 1;
+
+	printf("sinkbench: chain=%s subbufs=%llu bytes=%llu failed=%llu "
+		"cpu_ns=%llu cpu_ns_per_subbuf=%llu\n",
+		use_dynamic ? "dynamic" : "static", stats.subbufs, stats.bytes,
+		stats.failed, stats.cpu_time,
+		stats.subbufs ? stats.cpu_time / stats.subbufs : 0);
+	return 0;
+}
@@ -0,0 +1,112 @@
+#!/bin/sh
+#
+# lttdsim-bench
+#
+# Run lttd over the relay channel simulator and report its throughput, losses
+# and sub-buffer latency across thread counts, channel counts and sinks.
+#
+# Usage : lttdsim-bench.sh liblttdsim.so lttd-builddir liblttd-libdir
+#
+# The sweep is set with these variables :
+#   BENCH_THREADS	lttd -N values (default "1 2 4")
+#   BENCH_CHANNELS	simulated channels (default "4 16")
+#   BENCH_SINKS		directories the traces are written to
+#			(default "${TMPDIR:-/tmp} /dev/shm")
+# Any LTTDSIM_* variable is passed to the simulator, LTTDSIM_DURATION
+# defaults to 5 seconds.
+#
+# With one thread, lttd is run with the lock-free single reader and with the
+# locked multi-thread reader (lttd -L), to compare them.
+#
+# Copyright 2026 - The LTTng developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+SIM=$1
+LTTD_DIR=$2
+LIB_DIR=$3
+
+if [ -z "$SIM" ] || [ -z "$LTTD_DIR" ]; then
+	echo "Usage : $0 liblttdsim.so lttd-builddir [liblttd-libdir]" >&2
+	exit 1
+fi
+
+# Run the real binary, not the libtool wrapper which would load the simulator
+# in its shell too.
+if [ -x "$LTTD_DIR/.libs/lttd" ]; then
+	LTTD=$LTTD_DIR/.libs/lttd
+else
+	LTTD=$LTTD_DIR/lttd
+fi
+
+: ${BENCH_THREADS:="1 2 4"}
+: ${BENCH_CHANNELS:="4 16"}
+: ${BENCH_SINKS:="${TMPDIR:-/tmp} /dev/shm"}
+: ${LTTDSIM_DURATION:=5}
+export LTTDSIM_DURATION
+
+# Print the value of key in a lttdsim statistics line
+stat_value()
+{
+	echo "$1" | sed -n "s/.* $2=\([^ ]*\).*/\1/p"
+}
+
+printf "%-8s %-8s %-8s %-16s %10s %10s %8s %10s %10s %10s\n" \
+	threads reader channels sink "MB/s" subbufs lost "lat_avg" "lat_p99" \
+	"lat_max"
+
+for SINK in $BENCH_SINKS; do
+	if [ ! -d "$SINK" ] || [ ! -w "$SINK" ]; then
+		echo "Skipping sink $SINK : not a writable directory" >&2
+		continue
+	fi
+	for CHANNELS in $BENCH_CHANNELS; do
+		for THREADS in $BENCH_THREADS; do
+		if [ "$THREADS" = 1 ]; then
+			READERS="single locked"
+		else
+			READERS="locked"
+		fi
+		for READER in $READERS; do
+			if [ $READER = single ]; then
+				LOCKED=
+			else
+				LOCKED=-L
+			fi
+			ROOT=$SINK/lttdsim-channels.$$
+			TRACE=$SINK/lttdsim-trace.$$
+			STATS=`LD_LIBRARY_PATH=$LIB_DIR${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH} \
+				LD_PRELOAD=$SIM LTTDSIM_ROOT=$ROOT \
+				LTTDSIM_CHANNELS=$CHANNELS \
+				$LTTD -c $ROOT -t $TRACE -N $THREADS $LOCKED \
+				2>&1 >/dev/null | grep '^lttdsim:'`
+			rm -rf $TRACE
+			if [ -z "$STATS" ]; then
+				echo "lttd failed with $THREADS threads," \
+					"$CHANNELS channels on $SINK" >&2
+				continue
+			fi
+			printf "%-8s %-8s %-8s %-16s %10s %10s %8s %10s %10s %10s\n" \
+				$THREADS $READER $CHANNELS $SINK \
+				`stat_value "$STATS" throughput` \
+				`stat_value "$STATS" consumed` \
+				`stat_value "$STATS" lost` \
+				`stat_value "$STATS" lat_avg` \
+				`stat_value "$STATS" lat_p99` \
+				`stat_value "$STATS" lat_max`
+		done
+		done
+	done
+done
@@ -0,0 +1,342 @@
+/*
+ * lttdsim-control
+ *
+ * Linux Trace Toolkit debugfs control files stand-in
+ *
+ * With LTTDSIM_DEBUGFS set, the ltt control tree of the LTTng trace control
+ * module is created as real files under this directory, and the writes which
+ * make the kernel create or remove files are emulated :
+ *
+ * ltt/setup_trace		creates ltt/control/<trace>/{alloc,enabled,trans}
+ *				and the attribute files of each channel in
+ *				ltt/control/<trace>/channel/<channel>/
+ * ltt/destroy_trace		removes ltt/control/<trace> and ltt/<trace>
+ * ltt/control/<trace>/alloc	creates the buffer files ltt/<trace>/<channel>_<cpu>
+ *
+ * Every other control file is a plain file, written as it is. Point liblttctl
+ * to the stand-in with LTT_DEBUGFS set to the same directory.
+ *
+ * LTTDSIM_DEBUGFS		Root of the stand-in, created.
+ * LTTDSIM_DEBUGFS_CHANNELS	Channels of each trace, metadata included
+ *				(default 16).
+ * LTTDSIM_CPUS			Buffer files per channel (default 4).
+ * LTTDSIM_KEEP			Keep the stand-in at exit.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#undef _FILE_OFFSET_BITS
+#undef _FORTIFY_SOURCE
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "lttdsim.h"
+
+enum sim_ctl_file {
+	SIM_CTL_NONE,
+	SIM_CTL_SETUP,
+	SIM_CTL_DESTROY,
+	SIM_CTL_ALLOC,
+};
+
+static struct {
+	char root[PATH_MAX];
+	unsigned int channels;
+	unsigned int cpus;
+	int keep;
+	pid_t pid;
+} ctl_config;
+
+static int ctl_enabled;
+static unsigned char fd_ctl[SIM_MAX_FD];
+static char *fd_ctl_trace[SIM_MAX_FD];	/* trace of an alloc file */
+
+/* The attribute files of a channel, as created by ltt-trace-control */
+static const char *channel_files[] = {
+	"enable", "overwrite", "subbuf_num", "subbuf_size", "switch_timer",
+};
+
+static int sim_ctl_mkdir(const char *path)
+{
+	if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static int sim_ctl_touch(const char *path)
+{
+	int fd;
+
+	fd = real_open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	real_close(fd);
+	return 0;
+}
+
+static const char *sim_ctl_channel(unsigned int num, char *name)
+{
+	if (!num)
+		return "metadata";
+	sprintf(name, "chan%u", num);
+	return name;
+}
+
+static int sim_ctl_setup(const char *trace)
+{
+	char path[PATH_MAX], name[NAME_MAX];
+	unsigned int i, j;
+	int len;
+
+	len = snprintf(path, PATH_MAX, "%s/ltt/control/%s", ctl_config.root,
+		       trace);
+	if (mkdir(path, S_IRWXU) == -1)
+		return errno;
+
+	strcpy(path + len, "/alloc");
+	if (sim_ctl_touch(path))
+		return EIO;
+	strcpy(path + len, "/enabled");
+	if (sim_ctl_touch(path))
+		return EIO;
+	strcpy(path + len, "/trans");
+	if (sim_ctl_touch(path))
+		return EIO;
+	strcpy(path + len, "/channel");
+	if (sim_ctl_mkdir(path))
+		return EIO;
+
+	for (i = 0; i < ctl_config.channels; i++) {
+		snprintf(path + len, PATH_MAX - len, "/channel/%s",
+			 sim_ctl_channel(i, name));
+		if (sim_ctl_mkdir(path))
+			return EIO;
+		for (j = 0; j < sizeof(channel_files) / sizeof(char *); j++) {
+			snprintf(path + len, PATH_MAX - len, "/channel/%s/%s",
+				 sim_ctl_channel(i, name), channel_files[j]);
+			if (sim_ctl_touch(path))
+				return EIO;
+		}
+	}
+	return 0;
+}
+
+static int sim_ctl_alloc(const char *trace)
+{
+	char path[PATH_MAX], name[NAME_MAX];
+	unsigned int i, cpu;
+
+	snprintf(path, PATH_MAX, "%s/ltt/%s", ctl_config.root, trace);
+	if (mkdir(path, S_IRWXU) == -1)
+		return errno == EEXIST ? EPERM : errno;
+
+	for (i = 0; i < ctl_config.channels; i++) {
+		for (cpu = 0; cpu < ctl_config.cpus; cpu++) {
+			snprintf(path, PATH_MAX, "%s/ltt/%s/%s_%u",
+				 ctl_config.root, trace,
+				 sim_ctl_channel(i, name), cpu);
+			if (sim_ctl_touch(path))
+				return EIO;
+		}
+	}
+	return 0;
+}
+
+static int sim_ctl_remove(const char *path, const struct stat *stat_buf,
+			  int type, struct FTW *ftwbuf)
+{
+	if (remove(path) == -1)
+		perror(path);
+	return 0;
+}
+
+static int sim_ctl_rmtree(const char *path)
+{
+	return nftw(path, sim_ctl_remove, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+static int sim_ctl_destroy(const char *trace)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s/ltt/control/%s", ctl_config.root, trace);
+	if (access(path, F_OK) == -1)
+		return ENOENT;
+	sim_ctl_rmtree(path);
+	snprintf(path, PATH_MAX, "%s/ltt/%s", ctl_config.root, trace);
+	if (access(path, F_OK) == 0)
+		sim_ctl_rmtree(path);
+	return 0;
+}
+
+/*
+ * Recognize the control files which create or remove files, from the path
+ * liblttctl builds with the debugfs root.
+ */
+int sim_control_opened(int fd, const char *path)
+{
+	static const char alloc[] = "/alloc";
+	char prefix[PATH_MAX];
+	const char *trace;
+	size_t len, prefix_len;
+
+	if (!ctl_enabled || fd < 0 || fd >= SIM_MAX_FD)
+		return fd;
+
+	len = strlen(path);
+	prefix_len = snprintf(prefix, PATH_MAX, "%s/ltt/", ctl_config.root);
+	if (len <= prefix_len || strncmp(path, prefix, prefix_len))
+		return fd;
+	path += prefix_len;
+
+	if (!strcmp(path, "setup_trace")) {
+		fd_ctl[fd] = SIM_CTL_SETUP;
+	} else if (!strcmp(path, "destroy_trace")) {
+		fd_ctl[fd] = SIM_CTL_DESTROY;
+	} else if (!strncmp(path, "control/", sizeof("control/") - 1)) {
+		trace = path + sizeof("control/") - 1;
+		len = strlen(trace);
+		if (len <= sizeof(alloc) - 1
+		    || strcmp(trace + len - (sizeof(alloc) - 1), alloc))
+			return fd;
+		fd_ctl_trace[fd] = strndup(trace, len - (sizeof(alloc) - 1));
+		if (fd_ctl_trace[fd])
+			fd_ctl[fd] = SIM_CTL_ALLOC;
+	}
+	return fd;
+}
+
+void sim_control_closed(int fd)
+{
+	if (!ctl_enabled || fd < 0 || fd >= SIM_MAX_FD)
+		return;
+	fd_ctl[fd] = SIM_CTL_NONE;
+	free(fd_ctl_trace[fd]);
+	fd_ctl_trace[fd] = NULL;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	char arg[NAME_MAX + 1];
+	int ret;
+
+	/* Constructors of other libraries may write before ours */
+	if (!real_write)
+		real_write = dlsym(RTLD_NEXT, "write");
+	if (!ctl_enabled || fd < 0 || fd >= SIM_MAX_FD || !fd_ctl[fd])
+		return real_write(fd, buf, count);
+
+	if (!count || count > NAME_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* Like the kernel, ignore the end of line */
+	memcpy(arg, buf, count);
+	arg[count] = 0;
+	arg[strcspn(arg, " \t\n")] = 0;
+
+	switch (fd_ctl[fd]) {
+	case SIM_CTL_SETUP:
+		ret = sim_ctl_setup(arg);
+		break;
+	case SIM_CTL_DESTROY:
+		ret = sim_ctl_destroy(arg);
+		break;
+	case SIM_CTL_ALLOC:
+		ret = arg[0] == '1' ? sim_ctl_alloc(fd_ctl_trace[fd]) : 0;
+		break;
+	default:
+		ret = EINVAL;
+	}
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+	return count;
+}
+
+/*
+ * returns 0 when the control files are emulated.
+ */
+int sim_control_init(void)
+{
+	const char *root = getenv("LTTDSIM_DEBUGFS");
+	char path[PATH_MAX];
+
+	if (!root || !*root)
+		return -1;
+
+	strncpy(ctl_config.root, root, PATH_MAX - 1);
+	ctl_config.channels = sim_env_size("LTTDSIM_DEBUGFS_CHANNELS", 16);
+	ctl_config.cpus = sim_env_size("LTTDSIM_CPUS", 4);
+	ctl_config.keep = getenv("LTTDSIM_KEEP") != NULL;
+	ctl_config.pid = getpid();
+	if (!ctl_config.channels) {
+		fprintf(stderr, "lttdsim: invalid control configuration\n");
+		return -1;
+	}
+
+	snprintf(path, PATH_MAX, "%s", ctl_config.root);
+	if (sim_ctl_mkdir(path))
+		return -1;
+	snprintf(path, PATH_MAX, "%s/ltt", ctl_config.root);
+	if (sim_ctl_mkdir(path))
+		return -1;
+	snprintf(path, PATH_MAX, "%s/ltt/control", ctl_config.root);
+	if (sim_ctl_mkdir(path))
+		return -1;
+	snprintf(path, PATH_MAX, "%s/ltt/setup_trace", ctl_config.root);
+	if (sim_ctl_touch(path))
+		return -1;
+	snprintf(path, PATH_MAX, "%s/ltt/destroy_trace", ctl_config.root);
+	if (sim_ctl_touch(path))
+		return -1;
+
+	ctl_enabled = 1;
+	return 0;
+}
+
+/* Only the files of the stand-in are removed, by the process which made them */
+void sim_control_fini(void)
+{
+	char path[PATH_MAX];
+
+	if (!ctl_enabled || ctl_config.keep || getpid() != ctl_config.pid)
+		return;
+	ctl_enabled = 0;
+	snprintf(path, PATH_MAX, "%s/ltt", ctl_config.root);
+	sim_ctl_rmtree(path);
+	rmdir(ctl_config.root);
+}
@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# lttdsim-sinkbench
+#
+# Compare the sinks of liblttd.hpp composed at compile time with the same
+# sinks called through function pointers, over the relay channel simulator.
+# Both write the trace files with their .idx and .crc files.
+#
+# Usage : lttdsim-sinkbench.sh liblttdsim.so lttd-sinkbench liblttd-libdir
+#
+# The sweep is set with these variables :
+#   BENCH_THREADS	reader threads (default "1 4")
+#   BENCH_CHANNELS	simulated channels (default "4 16")
+#   BENCH_SINK		directory the traces are written to
+#			(default ${TMPDIR:-/tmp})
+# Any LTTDSIM_* variable is passed to the simulator, LTTDSIM_DURATION
+# defaults to 5 seconds.
+#
+# cpu/subbuf is the CPU time of the reader threads for each sub-buffer, in
+# nanoseconds, where the cost of the calls shows first.
+#
+# Copyright 2026 - The LTTng developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+SIM=$1
+BENCH=$2
+LIB_DIR=$3
+
+if [ -z "$SIM" ] || [ -z "$BENCH" ]; then
+	echo "Usage : $0 liblttdsim.so lttd-sinkbench [liblttd-libdir]" >&2
+	exit 1
+fi
+
+: ${BENCH_THREADS:="1 4"}
+: ${BENCH_CHANNELS:="4 16"}
+: ${BENCH_SINK:="${TMPDIR:-/tmp}"}
+: ${LTTDSIM_DURATION:=5}
+export LTTDSIM_DURATION
+
+# Print the value of key in a statistics line
+stat_value()
+{
+	echo "$1" | sed -n "s/.* $2=\([^ ]*\).*/\1/p"
+}
+
+printf "%-8s %-8s %-8s %10s %10s %8s %12s\n" \
+	threads channels chain "MB/s" subbufs lost "cpu/subbuf"
+
+for CHANNELS in $BENCH_CHANNELS; do
+	for THREADS in $BENCH_THREADS; do
+		for CHAIN in static dynamic; do
+			if [ $CHAIN = dynamic ]; then
+				DYNAMIC=-d
+			else
+				DYNAMIC=
+			fi
+			ROOT=$BENCH_SINK/lttdsim-channels.$$
+			TRACE=$BENCH_SINK/lttdsim-trace.$$
+			OUT=`LD_LIBRARY_PATH=$LIB_DIR${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH} \
+				LD_PRELOAD=$SIM LTTDSIM_ROOT=$ROOT \
+				LTTDSIM_CHANNELS=$CHANNELS \
+				$BENCH -N $THREADS $DYNAMIC $ROOT $TRACE 2>&1`
+			rm -rf $TRACE
+			STATS=`echo "$OUT" | grep '^lttdsim:'`
+			BENCH_STATS=`echo "$OUT" | grep '^sinkbench:'`
+			if [ -z "$STATS" ] || [ -z "$BENCH_STATS" ]; then
+				echo "lttd-sinkbench failed with $THREADS" \
+					"threads, $CHANNELS channels" >&2
+				continue
+			fi
+			printf "%-8s %-8s %-8s %10s %10s %8s %12s\n" \
+				$THREADS $CHANNELS $CHAIN \
+				`stat_value "$STATS" throughput` \
+				`stat_value "$STATS" consumed` \
+				`stat_value "$STATS" lost` \
+				`stat_value "$BENCH_STATS" cpu_ns_per_subbuf`
+		done
+	done
+done
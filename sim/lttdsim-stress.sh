@@ -0,0 +1,158 @@
+#!/bin/sh
+#
+# lttdsim-stress
+#
+# Run lttd over the relay channel simulator with faults injected in the
+# sub-buffer ioctls and splices, and check that it neither stalls nor
+# miscounts : every sub-buffer released is either written or counted as
+# failed, every push of the reader is counted as lost, the trace holds the
+# bytes lttd reports, and the throughput stays close to the fault-free run.
+# Faults which only interrupt or delay, eagain, eintr and short, must not
+# fail any sub-buffer.
+#
+# Usage : lttdsim-stress.sh liblttdsim.so lttd-builddir liblttd-libdir
+#
+# Set with these variables :
+#   STRESS_SCENARIOS	LTTDSIM_FAULTS values, separated by spaces
+#   STRESS_THREADS	lttd -N (default 2)
+#   STRESS_SINK		directory the traces are written to
+#			(default ${TMPDIR:-/tmp})
+#   STRESS_MIN_RATIO	lowest throughput accepted, relative to the run
+#			without fault (default 0.5)
+# Any LTTDSIM_* variable is passed to the simulator, LTTDSIM_DURATION
+# defaults to 3 seconds.
+#
+# Copyright 2026 - The LTTng developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+SIM=$1
+LTTD_DIR=$2
+LIB_DIR=$3
+
+if [ -z "$SIM" ] || [ -z "$LTTD_DIR" ]; then
+	echo "Usage : $0 liblttdsim.so lttd-builddir [liblttd-libdir]" >&2
+	exit 1
+fi
+
+if [ -x "$LTTD_DIR/.libs/lttd" ]; then
+	LTTD=$LTTD_DIR/.libs/lttd
+else
+	LTTD=$LTTD_DIR/lttd
+fi
+
+: ${STRESS_SCENARIOS:="get_sb:eagain:0.2
+	get_sb:eio:0.05,get_sb_size:eio:0.05
+	put_sb:eio:0.05
+	splice:eagain:0.2,splice:eintr:0.2,splice:short:0.3
+	splice:eio:0.05
+	get_sb:eagain:0.9@1-2"}
+: ${STRESS_THREADS:=2}
+: ${STRESS_SINK:=${TMPDIR:-/tmp}}
+: ${STRESS_MIN_RATIO:=0.5}
+: ${LTTDSIM_DURATION:=3}
+export LTTDSIM_DURATION
+
+# A run taking longer than this has stalled
+LIMIT=`echo "$LTTDSIM_DURATION" | awk '{ print int($1) + 30 }'`
+
+ROOT=$STRESS_SINK/lttdsim-channels.$$
+TRACE=$STRESS_SINK/lttdsim-trace.$$
+OUT=$STRESS_SINK/lttdsim-out.$$
+ERR=$STRESS_SINK/lttdsim-err.$$
+trap 'rm -rf $TRACE $OUT $ERR' 0
+
+# Print the value of key in a lttdsim statistics line
+stat_value()
+{
+	sed -n "s/^lttdsim:.* $1=\([^ ]*\).*/\1/p" $ERR
+}
+
+# Run lttd with faults $1, set the lttd_* and sim_* variables
+run()
+{
+	rm -rf $TRACE
+	# Only lttd loads the simulator, not timeout
+	timeout $LIMIT env \
+		LD_LIBRARY_PATH=$LIB_DIR${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH} \
+		LD_PRELOAD=$SIM LTTDSIM_ROOT=$ROOT LTTDSIM_FAULTS=$1 \
+		$LTTD -c $ROOT -t $TRACE -N $STRESS_THREADS -S >$OUT 2>$ERR
+	status=$?
+
+	lttd_bytes=`sed -n 's/^Consumed \([0-9]*\) bytes in \([0-9]*\) .*/\1/p' $OUT`
+	lttd_subbufs=`sed -n 's/^Consumed \([0-9]*\) bytes in \([0-9]*\) .*/\2/p' $OUT`
+	lttd_lost=`sed -n 's/^\([0-9]*\) sub-buffers corrupted.*/\1/p' $OUT`
+	lttd_failed=`sed -n 's/^\([0-9]*\) sub-buffers failed.*/\1/p' $OUT`
+	sim_consumed=`stat_value consumed`
+	sim_eio=`stat_value eio`
+	sim_faults=`stat_value faults`
+	sim_throughput=`stat_value throughput`
+	trace_bytes=`find $TRACE -type f -exec cat {} + 2>/dev/null | wc -c`
+}
+
+# Whether the faults $1 only interrupt or delay the operations
+benign()
+{
+	echo "$1" | tr ',' '\n' | awk -F: '
+		$2 != "eagain" && $2 != "eintr" && $2 != "short" { hard = 1 }
+		END { exit hard }'
+}
+
+FAILED=0
+
+run ""
+if [ $status -ne 0 ] || [ -z "$sim_throughput" ]; then
+	echo "lttd failed without fault (status $status)" >&2
+	exit 1
+fi
+BASELINE=$sim_throughput
+echo "Without fault : $BASELINE MB/s"
+
+for SCENARIO in $STRESS_SCENARIOS; do
+	run $SCENARIO
+	RESULT=PASS
+	REASON=
+	if [ $status -eq 124 ]; then
+		RESULT=FAIL
+		REASON="stalled"
+	elif [ $status -ne 0 ] || [ -z "$lttd_subbufs" ] \
+	     || [ -z "$sim_consumed" ]; then
+		RESULT=FAIL
+		REASON="exit status $status"
+	elif [ `expr $lttd_subbufs + $lttd_failed` -ne \
+	       `expr $sim_consumed + $sim_eio` ]; then
+		RESULT=FAIL
+		REASON="read $lttd_subbufs + failed $lttd_failed !="
+		REASON="$REASON released $sim_consumed + pushed $sim_eio"
+	elif [ $lttd_failed -ne 0 ] && benign $SCENARIO; then
+		RESULT=FAIL
+		REASON="sub-buffers failed on benign faults"
+	elif [ $lttd_lost -ne $sim_eio ]; then
+		RESULT=FAIL
+		REASON="lost $lttd_lost != pushed $sim_eio"
+	elif [ $trace_bytes -ne $lttd_bytes ]; then
+		RESULT=FAIL
+		REASON="trace holds $trace_bytes bytes, not $lttd_bytes"
+	elif [ `echo "$sim_throughput $BASELINE $STRESS_MIN_RATIO" \
+	       | awk '{ print ($1 < $2 * $3) }'` -eq 1 ]; then
+		RESULT=FAIL
+		REASON="throughput $sim_throughput MB/s"
+	fi
+	echo "$RESULT $SCENARIO : $sim_faults faults, $sim_throughput MB/s," \
+		"$lttd_lost lost, $lttd_failed failed $REASON"
+	[ $RESULT = PASS ] || FAILED=1
+done
+
+exit $FAILED
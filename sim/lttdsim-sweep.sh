@@ -0,0 +1,165 @@
+#!/bin/sh
+#
+# lttdsim-sweep
+#
+# Measure how lttd scales over the relay channel simulator : run it for every
+# combination of thread count, channel count, sub-buffer size and sink, write
+# one CSV line per run, and summarize for each setup the thread count after
+# which adding threads stops paying off.
+#
+# Usage : lttdsim-sweep.sh liblttdsim.so lttd-builddir liblttd-libdir
+#
+# The sweep is set with these variables :
+#   SWEEP_THREADS	lttd -N values (default 1 to the number of CPUs)
+#   SWEEP_CHANNELS	simulated channels (default "4 16 64")
+#   SWEEP_SUBBUF_SIZES	sub-buffer sizes (default "65536 262144 1048576")
+#   SWEEP_SINKS		directories the traces are written to
+#			(default "${TMPDIR:-/tmp} /dev/shm")
+#   SWEEP_CSV		CSV output file (default lttdsim-sweep.csv)
+#   SWEEP_MIN_GAIN	throughput gain, in percent, below which one more
+#			thread does not scale (default 10)
+# Any LTTDSIM_* variable is passed to the simulator, LTTDSIM_DURATION
+# defaults to 3 seconds.
+#
+# The contention columns add up the lttd -S counters of every thread :
+# trylocks of ready channels, trylocks which found the channel taken by
+# another thread, and time spent waiting for the channel table lock.
+#
+# Copyright 2026 - The LTTng developers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+SIM=$1
+LTTD_DIR=$2
+LIB_DIR=$3
+
+if [ -z "$SIM" ] || [ -z "$LTTD_DIR" ]; then
+	echo "Usage : $0 liblttdsim.so lttd-builddir [liblttd-libdir]" >&2
+	exit 1
+fi
+
+# Run the real binary, not the libtool wrapper which would load the simulator
+# in its shell too.
+if [ -x "$LTTD_DIR/.libs/lttd" ]; then
+	LTTD=$LTTD_DIR/.libs/lttd
+else
+	LTTD=$LTTD_DIR/lttd
+fi
+
+CPUS=`getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1`
+: ${SWEEP_THREADS:=`seq 1 $CPUS`}
+: ${SWEEP_CHANNELS:="4 16 64"}
+: ${SWEEP_SUBBUF_SIZES:="65536 262144 1048576"}
+: ${SWEEP_SINKS:="${TMPDIR:-/tmp} /dev/shm"}
+: ${SWEEP_CSV:=lttdsim-sweep.csv}
+: ${SWEEP_MIN_GAIN:=10}
+: ${LTTDSIM_DURATION:=3}
+export LTTDSIM_DURATION
+
+OUT=${TMPDIR:-/tmp}/lttdsim-sweep.$$
+trap 'rm -f $OUT' EXIT
+
+# Print the value of key in a lttdsim statistics line
+stat_value()
+{
+	sed -n "s/^lttdsim:.* $1=\([^ ]*\).*/\1/p" $OUT
+}
+
+# Add up the contention counters of the lttd -S thread lines
+thread_totals()
+{
+	awk '/^Thread [0-9]* : / {
+		split($8, t, "/")
+		trylocks += t[2]; failed += t[1]
+		wait += $12
+		if ($18 + 0 > max)
+			max = $18 + 0
+	}
+	END {
+		printf "%d,%d,%.1f,%.3f,%.3f\n", trylocks, failed,
+			trylocks ? 100 * failed / trylocks : 0, wait, max
+	}' $OUT
+}
+
+echo "threads,channels,subbuf_size,sink,mb_s,subbufs,lost,lat_avg_us," \
+"lat_p99_us,trylocks,trylock_failed,trylock_failed_pct,rwlock_wait_ms," \
+"rwlock_max_ms" | tr -d ' ' > $SWEEP_CSV
+
+for SINK in $SWEEP_SINKS; do
+	if [ ! -d "$SINK" ] || [ ! -w "$SINK" ]; then
+		echo "Skipping sink $SINK : not a writable directory" >&2
+		continue
+	fi
+	for SUBBUF_SIZE in $SWEEP_SUBBUF_SIZES; do
+	for CHANNELS in $SWEEP_CHANNELS; do
+		for THREADS in $SWEEP_THREADS; do
+			ROOT=$SINK/lttdsim-channels.$$
+			TRACE=$SINK/lttdsim-trace.$$
+			LD_LIBRARY_PATH=$LIB_DIR${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH} \
+				LD_PRELOAD=$SIM LTTDSIM_ROOT=$ROOT \
+				LTTDSIM_CHANNELS=$CHANNELS \
+				LTTDSIM_SUBBUF_SIZE=$SUBBUF_SIZE \
+				$LTTD -c $ROOT -t $TRACE -N $THREADS -S \
+				> $OUT 2>&1
+			rm -rf $TRACE
+			if ! grep -q '^lttdsim:' $OUT; then
+				echo "lttd failed with $THREADS threads," \
+					"$CHANNELS channels of $SUBBUF_SIZE" \
+					"bytes sub-buffers on $SINK" >&2
+				continue
+			fi
+			echo "$THREADS,$CHANNELS,$SUBBUF_SIZE,$SINK,`stat_value throughput`,`stat_value consumed`,`stat_value lost`,`stat_value lat_avg`,`stat_value lat_p99`,`thread_totals`" \
+				>> $SWEEP_CSV
+			echo "threads=$THREADS channels=$CHANNELS" \
+				"subbuf_size=$SUBBUF_SIZE sink=$SINK :" \
+				"`stat_value throughput` MB/s" >&2
+		done
+	done
+	done
+done
+
+# For each setup, the runs are in increasing thread count order. threads is
+# the last thread count which scaled, stops the first one which did not.
+echo
+awk -F, -v min_gain=$SWEEP_MIN_GAIN '
+function flush() {
+	if (key == "")
+		return
+	printf "%-8s %-12s %-16s %8s %10.1f %8s %10.1f\n", channels, subbuf,
+		sink, best_threads, best, stop ? stop : "-", best_fail
+}
+NR == 1 {
+	printf "%-8s %-12s %-16s %8s %10s %8s %10s\n", "channels",
+		"subbuf_size", "sink", "threads", "MB/s", "stops", "trylock%"
+	next
+}
+{
+	k = $2 "," $3 "," $4
+	if (k != key) {
+		flush()
+		key = k; channels = $2; subbuf = $3; sink = $4
+		best = -1; stop = 0
+	}
+	if (best < 0 || $5 > best * (1 + min_gain / 100)) {
+		if (!stop) {
+			best = $5; best_threads = $1; best_fail = $12
+		}
+	} else if (!stop) {
+		stop = $1
+	}
+}
+END { flush() }' $SWEEP_CSV
+
+echo "CSV written to $SWEEP_CSV"
@@ -0,0 +1,1008 @@
+/*
+ * lttdsim
+ *
+ * Linux Trace Toolkit relay channel simulator
+ *
+ * This is a LD_PRELOAD library which emulates the LTTng relay channel files in
+ * userspace, so lttd and liblttd can be run and benchmarked without an LTTng
+ * kernel. The channel files are created as regular files in a real directory;
+ * open, ioctl, poll, splice and close are intercepted for them only. Producer
+ * threads fill the sub-buffers at a configurable rate and burst, and CPU
+ * hot-plug is simulated by creating the files of a new CPU while tracing, so
+ * the inotify path of liblttd is used too. The debugfs control files can be
+ * emulated as well, see lttdsim-control.c.
+ *
+ * Configuration, read from the environment :
+ *
+ * LTTDSIM_ROOT			Channel directory to create (mandatory to
+ *				simulate channels).
+ * LTTDSIM_CHANNELS		Number of normal channels (default 4).
+ * LTTDSIM_FLIGHT_CHANNELS	Number of flight recorder channels (default 0).
+ * LTTDSIM_CPUS			CPUs, i.e. files per channel (default 4).
+ * LTTDSIM_SUBBUF_SIZE		Sub-buffer size, K/M suffix (default 256K).
+ * LTTDSIM_SUBBUF_NUM		Sub-buffers per channel file (default 4).
+ * LTTDSIM_RATE			Bytes per second per channel file, K/M/G suffix.
+ *				0 produces whenever a sub-buffer is free
+ *				(default 0).
+ * LTTDSIM_BURST		Sub-buffers produced back to back at each
+ *				period of the rate (default 1).
+ * LTTDSIM_PRODUCERS		Producer threads (default LTTDSIM_CPUS).
+ * LTTDSIM_DURATION		Seconds of production, then the channels are
+ *				finalized and hang up (default 10).
+ * LTTDSIM_HOTPLUG		Seconds after which the files of one more CPU
+ *				are created (default none).
+ * LTTDSIM_UNPLUG		Seconds after which the channels of the last
+ *				CPU are finalized and their files removed
+ *				(default none).
+ * LTTDSIM_REPLUG		Seconds after which the files of the unplugged
+ *				CPU are created again (default none).
+ * LTTDSIM_KEEP			Keep the channel directory at exit.
+ * LTTDSIM_FAULTS		Faults to inject, as a comma separated list of
+ *				OP:ERROR:PROBABILITY[@BEGIN-[END]], with BEGIN
+ *				and END in seconds of production. OP and ERROR
+ *				are one of
+ *				get_sb:eagain|eio|efault|enodata
+ *				get_sb_size:eio|efault
+ *				put_sb:eio (the writer pushed the reader)
+ *				splice:eagain|eintr|eio|short
+ *				ex. "put_sb:eio:0.01,splice:short:0.1@2-4"
+ * LTTDSIM_SEED			Seed of the fault injection (default 1).
+ *
+ * Production starts when the first channel file is opened. At exit, a line of
+ * statistics is printed on stderr.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+/* The symbols of libc are overridden as they are, not their wrappers */
+#undef _FILE_OFFSET_BITS
+#undef _FORTIFY_SOURCE
+
+#define _REENTRANT
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "lttdsim.h"
+
+/* Relayfs IOCTL, as in liblttd */
+#include <asm/ioctl.h>
+#include <asm/types.h>
+
+#define RELAY_GET_SB		_IOR(0xF5, 0x00,__u32)
+#define RELAY_PUT_SB		_IOW(0xF5, 0x01,__u32)
+#define RELAY_GET_N_SB		_IOR(0xF5, 0x02,__u32)
+#define RELAY_GET_SB_SIZE	_IOR(0xF5, 0x03, __u32)
+#define RELAY_GET_MAX_SB_SIZE	_IOR(0xF5, 0x04, __u32)
+
+#define SIM_LAT_BUCKETS		32
+#define SIM_MAX_FAULTS		16
+
+enum sim_op {
+	SIM_GET_SB,
+	SIM_GET_SB_SIZE,
+	SIM_PUT_SB,
+	SIM_SPLICE,
+	SIM_NR_OPS,
+};
+
+/* Error injected instead of doing the operation, or a short splice */
+#define SIM_SHORT	-1
+
+struct sim_fault {
+	enum sim_op op;
+	int error;
+	double probability;
+	double begin;
+	double end;
+};
+
+struct sim_chan {
+	pthread_mutex_t lock;
+	char path[PATH_MAX];
+	dev_t dev;
+	ino_t ino;
+	int efd;		/* readable when the channel may be ready */
+	int overwrite;		/* flight recorder channel */
+	unsigned long long produced;	/* sub-buffers completed */
+	unsigned long long consumed;	/* next sub-buffer to read */
+	int reserved;		/* consumed sub-buffer is held by the reader */
+	int pushed;		/* the writer overwrote the held sub-buffer */
+	int finalized;
+	unsigned int cpu;
+	struct timespec *done;	/* completion time of each sub-buffer */
+};
+
+struct sim_stats {
+	unsigned long long produced;
+	unsigned long long consumed;
+	unsigned long long lost;
+	unsigned long long eio;
+	unsigned long long bytes;
+	unsigned long long lat_sum;	/* ns */
+	unsigned long long lat_max;	/* ns */
+	unsigned long long lat_hist[SIM_LAT_BUCKETS];	/* log2 of us */
+	unsigned long long faults;
+};
+
+static struct sim_config {
+	char root[PATH_MAX];
+	unsigned int channels;
+	unsigned int flight_channels;
+	unsigned int cpus;
+	unsigned int subbuf_size;
+	unsigned int subbuf_num;
+	unsigned long long rate;
+	unsigned int burst;
+	unsigned int producers;
+	double duration;
+	double hotplug;
+	double unplug;
+	double replug;
+	int keep;
+	pid_t pid;
+	struct sim_fault faults[SIM_MAX_FAULTS];
+	int nr_faults;
+	unsigned int seed;
+} config;
+
+static struct sim_chan *chans;
+static unsigned int nr_chans;		/* published channels */
+static unsigned int max_chans;
+static pthread_mutex_t chans_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_chan *fd_chans[SIM_MAX_FD];
+static char *pattern;
+static struct sim_stats stats;
+static struct timespec start_time, end_time;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_t *producer_tids;
+static int enabled;
+static __thread unsigned int fault_seed;
+
+int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+int (*real_close)(int);
+ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static ssize_t (*real_splice)(int, loff_t *, int, loff_t *, size_t,
+			      unsigned int);
+
+static double sim_elapsed(const struct timespec *begin,
+			  const struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec)
+		+ (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+unsigned long long sim_env_size(const char *name, unsigned long long def)
+{
+	const char *val = getenv(name);
+	unsigned long long size;
+	char *end;
+
+	if (!val || !*val)
+		return def;
+	size = strtoull(val, &end, 0);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size <<= 10;
+		/* fall through */
+	case 'M':
+	case 'm':
+		size <<= 10;
+		/* fall through */
+	case 'K':
+	case 'k':
+		size <<= 10;
+	}
+	return size;
+}
+
+static double sim_env_double(const char *name, double def)
+{
+	const char *val = getenv(name);
+
+	if (!val || !*val)
+		return def;
+	return strtod(val, NULL);
+}
+
+static int sim_parse_faults(const char *spec)
+{
+	static const char *op_names[SIM_NR_OPS] = {
+		[SIM_GET_SB] = "get_sb",
+		[SIM_GET_SB_SIZE] = "get_sb_size",
+		[SIM_PUT_SB] = "put_sb",
+		[SIM_SPLICE] = "splice",
+	};
+	static const struct {
+		const char *name;
+		int error;
+		unsigned int ops;	/* mask of the operations allowed */
+	} errors[] = {
+		{ "eagain", EAGAIN, 1 << SIM_GET_SB | 1 << SIM_SPLICE },
+		{ "eintr", EINTR, 1 << SIM_SPLICE },
+		{ "eio", EIO, 1 << SIM_GET_SB | 1 << SIM_GET_SB_SIZE
+			| 1 << SIM_PUT_SB | 1 << SIM_SPLICE },
+		{ "efault", EFAULT, 1 << SIM_GET_SB | 1 << SIM_GET_SB_SIZE },
+		{ "enodata", ENODATA, 1 << SIM_GET_SB },
+		{ "short", SIM_SHORT, 1 << SIM_SPLICE },
+	};
+	char op[32], error[32];
+	struct sim_fault *fault;
+	const char *item;
+	int i, n;
+
+	for (item = spec; item && *item; item = strchr(item, ',')) {
+		if (*item == ',')
+			item++;
+		if (config.nr_faults == SIM_MAX_FAULTS) {
+			fprintf(stderr, "lttdsim: too many faults\n");
+			return -1;
+		}
+		fault = &config.faults[config.nr_faults];
+		fault->begin = 0;
+		fault->end = 0;
+		if (sscanf(item, "%31[^:]:%31[^:]:%lf%n", op, error,
+			   &fault->probability, &n) < 3)
+			goto invalid;
+		if (item[n] == '@'
+		    && sscanf(item + n, "@%lf-%lf", &fault->begin,
+			      &fault->end) < 1)
+			goto invalid;
+
+		for (i = 0; i < SIM_NR_OPS; i++)
+			if (!strcmp(op, op_names[i]))
+				break;
+		if (i == SIM_NR_OPS)
+			goto invalid;
+		fault->op = i;
+		for (i = 0; i < sizeof(errors) / sizeof(errors[0]); i++)
+			if (!strcmp(error, errors[i].name))
+				break;
+		if (i == sizeof(errors) / sizeof(errors[0])
+		    || !(errors[i].ops & 1 << fault->op))
+			goto invalid;
+		fault->error = errors[i].error;
+		config.nr_faults++;
+	}
+	return 0;
+
+invalid:
+	fprintf(stderr, "lttdsim: invalid fault %s\n", item);
+	return -1;
+}
+
+/*
+ * Draw the faults of op.
+ *
+ * returns the error to inject, SIM_SHORT or 0.
+ */
+static int sim_fault(enum sim_op op)
+{
+	struct sim_fault *fault;
+	struct timespec now;
+	double elapsed;
+	int i;
+
+	if (!config.nr_faults)
+		return 0;
+	if (!fault_seed)
+		fault_seed = config.seed ^ (unsigned int)pthread_self();
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = sim_elapsed(&start_time, &now);
+	for (i = 0; i < config.nr_faults; i++) {
+		fault = &config.faults[i];
+		if (fault->op != op || elapsed < fault->begin
+		    || (fault->end > fault->begin && elapsed >= fault->end))
+			continue;
+		if (rand_r(&fault_seed) < fault->probability * RAND_MAX) {
+			__sync_fetch_and_add(&stats.faults, 1);
+			return fault->error;
+		}
+	}
+	return 0;
+}
+
+static struct sim_chan *sim_fd_chan(int fd)
+{
+	if (!enabled || fd < 0 || fd >= SIM_MAX_FD)
+		return NULL;
+	return fd_chans[fd];
+}
+
+/*
+ * Create the file of a channel. chans_lock is held until the channel is
+ * published, so an open racing with the creation waits for it.
+ */
+static int sim_create_chan(const char *name, unsigned int cpu, int overwrite)
+{
+	struct sim_chan *chan = &chans[nr_chans];
+	struct stat stat_buf;
+	int fd;
+	int ret = -1;
+
+	pthread_mutex_lock(&chans_lock);
+	snprintf(chan->path, PATH_MAX, "%s/%s_%u", config.root, name, cpu);
+	fd = real_open(chan->path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	if (fd == -1 || fstat(fd, &stat_buf) == -1) {
+		perror(chan->path);
+		if (fd != -1)
+			real_close(fd);
+		goto unlock;
+	}
+	real_close(fd);
+
+	pthread_mutex_init(&chan->lock, NULL);
+	chan->dev = stat_buf.st_dev;
+	chan->ino = stat_buf.st_ino;
+	chan->efd = eventfd(0, EFD_NONBLOCK);
+	chan->overwrite = overwrite;
+	chan->cpu = cpu;
+	chan->done = calloc(config.subbuf_num, sizeof(struct timespec));
+	if (chan->efd == -1 || !chan->done) {
+		perror("lttdsim: channel allocation");
+		goto unlock;
+	}
+	__sync_synchronize();
+	nr_chans++;
+	ret = 0;
+unlock:
+	pthread_mutex_unlock(&chans_lock);
+	return ret;
+}
+
+/* Create the files of one CPU for every channel */
+static int sim_create_cpu(unsigned int cpu)
+{
+	char name[NAME_MAX];
+	unsigned int i;
+
+	for (i = 0; i < config.channels + config.flight_channels; i++) {
+		if (i < config.channels)
+			snprintf(name, NAME_MAX, "chan%u", i);
+		else
+			snprintf(name, NAME_MAX, "flight-chan%u",
+				 i - config.channels);
+		if (sim_create_chan(name, cpu, i >= config.channels))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Complete one sub-buffer. A normal channel drops it when the reader did not
+ * free a sub-buffer, a flight recorder channel overwrites the oldest one,
+ * pushing the reader if it holds it. Without a rate, the producer only waits
+ * for the reader.
+ *
+ * returns 1 if the sub-buffer was written.
+ */
+static int sim_produce(struct sim_chan *chan, const struct timespec *now)
+{
+	uint64_t one = 1;
+	int written = 1;
+
+	pthread_mutex_lock(&chan->lock);
+	if (chan->finalized) {
+		written = 0;
+		goto unlock;
+	}
+	if (chan->produced - chan->consumed >= config.subbuf_num) {
+		if (!config.rate) {
+			written = 0;
+			goto unlock;
+		}
+		if (!chan->overwrite) {
+			__sync_fetch_and_add(&stats.lost, 1);
+			written = 0;
+			goto unlock;
+		}
+		if (chan->reserved)
+			chan->pushed = 1;
+		else
+			chan->consumed++;
+		__sync_fetch_and_add(&stats.lost, 1);
+	}
+	chan->done[chan->produced % config.subbuf_num] = *now;
+	chan->produced++;
+	__sync_fetch_and_add(&stats.produced, 1);
+	if (write(chan->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("lttdsim: eventfd write");
+unlock:
+	pthread_mutex_unlock(&chan->lock);
+	return written;
+}
+
+static void sim_finalize(struct sim_chan *chan)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&chan->lock);
+	chan->finalized = 1;
+	if (write(chan->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("lttdsim: eventfd write");
+	pthread_mutex_unlock(&chan->lock);
+}
+
+/* Like CPU hot-unplug, finalize the channels of cpu and remove their files */
+static void sim_unplug_cpu(unsigned int cpu)
+{
+	unsigned int i, n = nr_chans;
+
+	for (i = 0; i < n; i++) {
+		if (chans[i].cpu != cpu)
+			continue;
+		sim_finalize(&chans[i]);
+		if (unlink(chans[i].path) == -1)
+			perror(chans[i].path);
+	}
+}
+
+/*
+ * Producer thread n writes the channels n, n + producers, ... With a rate,
+ * each of them gets burst sub-buffers at every period. Without, sub-buffers
+ * are produced as soon as the reader frees them.
+ */
+static void *sim_producer(void *arg)
+{
+	unsigned long num = (unsigned long)arg;
+	struct timespec now, next;
+	double period = 0;
+	unsigned int i, j, n;
+	int hotplugged = 0;
+	int unplugged = 0;
+	int replugged = 0;
+	int written;
+
+	if (config.rate)
+		period = (double)config.burst * config.subbuf_size
+			/ config.rate;
+	next = start_time;
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (sim_elapsed(&start_time, &now) >= config.duration)
+			break;
+		if (num == 0 && config.hotplug > 0 && !hotplugged
+		    && sim_elapsed(&start_time, &now) >= config.hotplug) {
+			sim_create_cpu(config.cpus);
+			hotplugged = 1;
+		}
+		if (num == 0 && config.unplug > 0 && !unplugged
+		    && sim_elapsed(&start_time, &now) >= config.unplug) {
+			sim_unplug_cpu(config.cpus - 1);
+			unplugged = 1;
+		}
+		if (num == 0 && unplugged && config.replug > 0 && !replugged
+		    && sim_elapsed(&start_time, &now) >= config.replug) {
+			sim_create_cpu(config.cpus - 1);
+			replugged = 1;
+		}
+
+		written = 0;
+		n = nr_chans;
+		for (i = num; i < n; i += config.producers)
+			for (j = 0; j < (config.rate ? config.burst : 1); j++)
+				written += sim_produce(&chans[i], &now);
+
+		if (config.rate) {
+			next.tv_sec += (time_t)period;
+			next.tv_nsec += (long)((period - (time_t)period) * 1e9);
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_sec++;
+				next.tv_nsec -= 1000000000;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+					NULL);
+		} else if (!written) {
+			/* Every buffer is full, let the reader catch up */
+			usleep(50);
+		}
+	}
+
+	n = nr_chans;
+	for (i = num; i < n; i += config.producers)
+		sim_finalize(&chans[i]);
+	return NULL;
+}
+
+static void sim_start(void)
+{
+	unsigned long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	producer_tids = malloc(sizeof(pthread_t) * config.producers);
+	for (i = 0; i < config.producers; i++)
+		if (pthread_create(&producer_tids[i], NULL, sim_producer,
+				   (void *)i))
+			perror("lttdsim: producer thread");
+}
+
+/*
+ * Readiness of a channel, as the LTTng poll : POLLPRI when the buffer is
+ * almost full, POLLIN when a sub-buffer can be read, POLLHUP once finalized
+ * and empty. The eventfd is drained when nothing is ready, under the lock the
+ * producer takes to signal it, so it stays readable while the channel is.
+ */
+static short sim_revents(struct sim_chan *chan)
+{
+	unsigned long long avail;
+	uint64_t count;
+	short revents = 0;
+
+	pthread_mutex_lock(&chan->lock);
+	avail = chan->produced - chan->consumed;
+	if (avail > (unsigned long long)chan->reserved) {
+		if (config.subbuf_num > 1 && avail >= config.subbuf_num - 1)
+			revents = POLLPRI;
+		else
+			revents = POLLIN;
+	} else if (chan->finalized && !avail) {
+		revents = POLLHUP;
+	} else {
+		if (read(chan->efd, &count, sizeof(count)) < 0
+		    && errno != EAGAIN)
+			perror("lttdsim: eventfd read");
+	}
+	pthread_mutex_unlock(&chan->lock);
+	return revents;
+}
+
+static int sim_get_sb(struct sim_chan *chan, unsigned int *cookie)
+{
+	int ret;
+
+	ret = sim_fault(SIM_GET_SB);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&chan->lock);
+	if (chan->reserved || chan->produced == chan->consumed) {
+		ret = chan->finalized && chan->produced == chan->consumed
+			? ENODATA : EAGAIN;
+		goto unlock;
+	}
+	chan->reserved = 1;
+	chan->pushed = 0;
+	*cookie = (unsigned int)chan->consumed;
+unlock:
+	pthread_mutex_unlock(&chan->lock);
+	return ret;
+}
+
+static void sim_account_latency(const struct timespec *done)
+{
+	struct timespec now;
+	unsigned long long lat, max;
+	unsigned int bucket = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	lat = (now.tv_sec - done->tv_sec) * 1000000000ULL
+		+ now.tv_nsec - done->tv_nsec;
+	__sync_fetch_and_add(&stats.lat_sum, lat);
+	while ((max = stats.lat_max) < lat)
+		__sync_bool_compare_and_swap(&stats.lat_max, max, lat);
+	while (bucket < SIM_LAT_BUCKETS - 1 && (lat / 1000) >> bucket)
+		bucket++;
+	__sync_fetch_and_add(&stats.lat_hist[bucket], 1);
+}
+
+static int sim_put_sb(struct sim_chan *chan, unsigned int cookie)
+{
+	int ret = 0;
+	int pushed = sim_fault(SIM_PUT_SB);
+
+	pthread_mutex_lock(&chan->lock);
+	if (!chan->reserved || cookie != (unsigned int)chan->consumed) {
+		ret = EFAULT;
+		goto unlock;
+	}
+	chan->reserved = 0;
+	if (chan->pushed || pushed) {
+		/* The writer already moved consumed past this sub-buffer */
+		chan->consumed++;
+		__sync_fetch_and_add(&stats.eio, 1);
+		ret = EIO;
+		goto unlock;
+	}
+	sim_account_latency(&chan->done[chan->consumed % config.subbuf_num]);
+	chan->consumed++;
+	__sync_fetch_and_add(&stats.consumed, 1);
+unlock:
+	pthread_mutex_unlock(&chan->lock);
+	return ret;
+}
+
+static int sim_ioctl(struct sim_chan *chan, unsigned long request,
+		     unsigned int *arg)
+{
+	int ret;
+
+	switch (request) {
+	case RELAY_GET_SB:
+		ret = sim_get_sb(chan, arg);
+		break;
+	case RELAY_PUT_SB:
+		ret = sim_put_sb(chan, *arg);
+		break;
+	case RELAY_GET_N_SB:
+		*arg = config.subbuf_num;
+		ret = 0;
+		break;
+	case RELAY_GET_SB_SIZE:
+		ret = sim_fault(SIM_GET_SB_SIZE);
+		if (!ret)
+			*arg = config.subbuf_size;
+		break;
+	case RELAY_GET_MAX_SB_SIZE:
+		*arg = config.subbuf_size;
+		ret = 0;
+		break;
+	default:
+		ret = ENOTTY;
+	}
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
+
+/* The newest first, the inode of a removed channel file may be reused */
+static struct sim_chan *sim_lookup(const struct stat *stat_buf)
+{
+	unsigned int i = nr_chans;
+
+	while (i-- > 0)
+		if (chans[i].ino == stat_buf->st_ino
+		    && chans[i].dev == stat_buf->st_dev)
+			return &chans[i];
+	return NULL;
+}
+
+/* Register fd if it is a channel file */
+static int sim_opened(int fd)
+{
+	struct stat stat_buf;
+	struct sim_chan *chan;
+
+	if (fd < 0 || fd >= SIM_MAX_FD || !enabled)
+		return fd;
+	if (fstat(fd, &stat_buf) == -1 || !S_ISREG(stat_buf.st_mode))
+		return fd;
+	chan = sim_lookup(&stat_buf);
+	if (!chan) {
+		/* The file may be a hot-plugged channel being published */
+		pthread_mutex_lock(&chans_lock);
+		chan = sim_lookup(&stat_buf);
+		pthread_mutex_unlock(&chans_lock);
+	}
+	if (chan) {
+		pthread_once(&start_once, sim_start);
+		fd_chans[fd] = chan;
+	}
+	return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return sim_control_opened(sim_opened(real_open(path, flags, mode)),
+				  path);
+}
+
+int open64(const char *path, int flags, ...)
+	__attribute__((alias("open")));
+
+int __open_2(const char *path, int flags)
+{
+	return sim_control_opened(sim_opened(real_open(path, flags)), path);
+}
+
+int __open64_2(const char *path, int flags)
+	__attribute__((alias("__open_2")));
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return sim_opened(real_openat(dirfd, path, flags, mode));
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+	__attribute__((alias("openat")));
+
+int __openat_2(int dirfd, const char *path, int flags)
+{
+	return sim_opened(real_openat(dirfd, path, flags));
+}
+
+int __openat64_2(int dirfd, const char *path, int flags)
+	__attribute__((alias("__openat_2")));
+
+int close(int fd)
+{
+	if (sim_fd_chan(fd))
+		fd_chans[fd] = NULL;
+	sim_control_closed(fd);
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct sim_chan *chan = sim_fd_chan(fd);
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (chan)
+		return sim_ioctl(chan, request, arg);
+	return real_ioctl(fd, request, arg);
+}
+
+/*
+ * Channel fds are polled through their eventfd. The channel state is checked
+ * first, the real poll is only used to wait or to get the other fds.
+ */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	struct pollfd *real_fds;
+	struct sim_chan *chan;
+	nfds_t i;
+	int nr_sim = 0;
+	int num_rdy, ret;
+
+	for (i = 0; i < nfds; i++)
+		if (sim_fd_chan(fds[i].fd))
+			nr_sim++;
+	if (!nr_sim)
+		return real_poll(fds, nfds, timeout);
+
+	real_fds = malloc(nfds * sizeof(struct pollfd));
+	if (!real_fds) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (;;) {
+		num_rdy = 0;
+		for (i = 0; i < nfds; i++) {
+			real_fds[i] = fds[i];
+			chan = sim_fd_chan(fds[i].fd);
+			if (!chan)
+				continue;
+			real_fds[i].fd = chan->efd;
+			real_fds[i].events = POLLIN;
+			fds[i].revents = sim_revents(chan);
+			if (fds[i].revents)
+				num_rdy++;
+		}
+
+		ret = real_poll(real_fds, nfds, num_rdy ? 0 : timeout);
+		if (ret < 0)
+			goto end;
+
+		for (i = 0; i < nfds; i++) {
+			chan = sim_fd_chan(fds[i].fd);
+			if (!chan) {
+				fds[i].revents = real_fds[i].revents;
+				if (fds[i].revents)
+					num_rdy++;
+			} else if (!fds[i].revents && real_fds[i].revents) {
+				fds[i].revents = sim_revents(chan);
+				if (fds[i].revents)
+					num_rdy++;
+			}
+		}
+		/* Woken up by an eventfd left from a sub-buffer now read */
+		if (num_rdy || timeout >= 0)
+			break;
+	}
+	ret = num_rdy;
+end:
+	free(real_fds);
+	return ret;
+}
+
+int __poll_chk(struct pollfd *fds, nfds_t nfds, int timeout, size_t fdslen)
+{
+	return poll(fds, nfds, timeout);
+}
+
+/* The reserved sub-buffer is moved to the pipe from the pattern pages */
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+	       size_t len, unsigned int flags)
+{
+	struct sim_chan *chan = sim_fd_chan(fd_in);
+	struct iovec iov;
+	loff_t offset = off_in ? *off_in : 0;
+	ssize_t ret;
+	int fault;
+
+	if (!chan)
+		return real_splice(fd_in, off_in, fd_out, off_out, len, flags);
+
+	if (!chan->reserved || offset >= config.subbuf_size) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((loff_t)len > config.subbuf_size - offset)
+		len = config.subbuf_size - offset;
+	fault = sim_fault(SIM_SPLICE);
+	if (fault == SIM_SHORT) {
+		len = (len + 1) / 2;
+	} else if (fault) {
+		errno = fault;
+		return -1;
+	}
+	iov.iov_base = pattern + offset;
+	iov.iov_len = len;
+	ret = vmsplice(fd_out, &iov, 1, flags & SPLICE_F_NONBLOCK);
+	if (ret > 0) {
+		__sync_fetch_and_add(&stats.bytes, ret);
+		if (off_in)
+			*off_in += ret;
+	}
+	return ret;
+}
+
+static void __attribute__((constructor)) sim_init(void)
+{
+	const char *root = getenv("LTTDSIM_ROOT");
+	unsigned int cpu;
+	size_t i;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+	real_splice = dlsym(RTLD_NEXT, "splice");
+
+	/* Child processes started by the traced program keep their files */
+	if (!sim_control_init() || (root && *root))
+		unsetenv("LD_PRELOAD");
+	if (!root || !*root)
+		return;
+
+	strncpy(config.root, root, PATH_MAX - 1);
+	config.channels = sim_env_size("LTTDSIM_CHANNELS", 4);
+	config.flight_channels = sim_env_size("LTTDSIM_FLIGHT_CHANNELS", 0);
+	config.cpus = sim_env_size("LTTDSIM_CPUS", 4);
+	config.subbuf_size = sim_env_size("LTTDSIM_SUBBUF_SIZE", 256 << 10);
+	config.subbuf_num = sim_env_size("LTTDSIM_SUBBUF_NUM", 4);
+	config.rate = sim_env_size("LTTDSIM_RATE", 0);
+	config.burst = sim_env_size("LTTDSIM_BURST", 1);
+	config.producers = sim_env_size("LTTDSIM_PRODUCERS", config.cpus);
+	config.duration = sim_env_double("LTTDSIM_DURATION", 10);
+	config.hotplug = sim_env_double("LTTDSIM_HOTPLUG", 0);
+	config.unplug = sim_env_double("LTTDSIM_UNPLUG", 0);
+	config.replug = sim_env_double("LTTDSIM_REPLUG", 0);
+	config.keep = getenv("LTTDSIM_KEEP") != NULL;
+	config.pid = getpid();
+	config.seed = sim_env_size("LTTDSIM_SEED", 1);
+	if (sim_parse_faults(getenv("LTTDSIM_FAULTS")))
+		return;
+
+	if (!config.cpus || !config.subbuf_size || !config.subbuf_num
+	    || !config.burst || !config.producers
+	    || !(config.channels + config.flight_channels)) {
+		fprintf(stderr, "lttdsim: invalid configuration\n");
+		return;
+	}
+
+	pattern = malloc(config.subbuf_size);
+	/* With one CPU hot-plugged and one plugged again */
+	max_chans = (config.channels + config.flight_channels)
+		* (config.cpus + 2);
+	chans = calloc(max_chans, sizeof(struct sim_chan));
+	if (!pattern || !chans) {
+		fprintf(stderr, "lttdsim: out of memory\n");
+		return;
+	}
+	for (i = 0; i < config.subbuf_size; i++)
+		pattern[i] = (char)i;
+
+	if (mkdir(config.root, S_IRWXU) == -1 && errno != EEXIST) {
+		perror(config.root);
+		return;
+	}
+	for (cpu = 0; cpu < config.cpus; cpu++)
+		if (sim_create_cpu(cpu))
+			return;
+	enabled = 1;
+}
+
+static void __attribute__((destructor)) sim_fini(void)
+{
+	unsigned long long count = 0, p99 = 0;
+	unsigned int i;
+	double duration;
+
+	sim_control_fini();
+	if (!enabled)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	duration = start_time.tv_sec ? sim_elapsed(&start_time, &end_time) : 0;
+
+	/* Upper bound of the bucket holding the 99th percentile */
+	for (i = 0; stats.consumed && i < SIM_LAT_BUCKETS; i++) {
+		count += stats.lat_hist[i];
+		if (count * 100 >= stats.consumed * 99) {
+			p99 = 1ULL << i;
+			break;
+		}
+	}
+
+	fprintf(stderr, "lttdsim: channels=%u produced=%llu consumed=%llu"
+		" lost=%llu eio=%llu bytes=%llu duration=%.3f"
+		" throughput=%.1f lat_avg=%.1f lat_p99=%llu lat_max=%.1f"
+		" faults=%llu\n",
+		nr_chans, stats.produced, stats.consumed, stats.lost,
+		stats.eio, stats.bytes, duration,
+		duration > 0 ? stats.bytes / duration / 1e6 : 0,
+		stats.consumed ? stats.lat_sum / 1e3 / stats.consumed : 0,
+		p99, stats.lat_max / 1e3, stats.faults);
+
+	if (config.keep || getpid() != config.pid)
+		return;
+	for (i = 0; i < nr_chans; i++)
+		unlink(chans[i].path);
+	rmdir(config.root);
+}
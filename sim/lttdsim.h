@@ -0,0 +1,43 @@
+/*
+ * lttdsim
+ *
+ * Linux Trace Toolkit relay channel simulator, shared by its parts.
+ *
+ * Copyright 2026 - The LTTng developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LTTDSIM_H
+#define _LTTDSIM_H
+
+#include <sys/types.h>
+
+#define SIM_MAX_FD		65536
+
+/* The libc functions overridden */
+extern int (*real_open)(const char *, int, ...);
+extern int (*real_close)(int);
+extern ssize_t (*real_write)(int, const void *, size_t);
+
+unsigned long long sim_env_size(const char *name, unsigned long long def);
+
+/* Stand-in of the debugfs control files, in lttdsim-control.c */
+int sim_control_init(void);
+void sim_control_fini(void);
+int sim_control_opened(int fd, const char *path);
+void sim_control_closed(int fd);
+
+#endif /* _LTTDSIM_H */